@@ -13,6 +13,7 @@
 
 #include "my_assert.h"
 #include "my_str.h"
+#include "my_mem.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #define IS(w, y) !strcmp(w, y)
@@ -401,6 +402,7 @@ int main(int argc, char *argv[])
   int rlist_alloc;
   int is_label;
   int is_bss;
+  int mem_rep = 0;
   int wordc;
   int first;
   int arg_out;
@@ -412,7 +414,7 @@ int main(int argc, char *argv[])
 
   if (argc < 4) {
     // -nd: no symbol decorations
-    printf("usage:\n%s [-nd] [-i] [-a] <.s> <.asm> <hdrf> [rlist]*\n",
+    printf("usage:\n%s [-nd] [-i] [-a] [-M] <.s> <.asm> <hdrf> [rlist]*\n",
       argv[0]);
     return 1;
   }
@@ -426,6 +428,8 @@ int main(int argc, char *argv[])
       comment_char = '@';
       g_arm_mode = 1;
     }
+    else if (IS(argv[arg], "-M"))
+      mem_rep = 1;
     else
       break;
   }
@@ -444,11 +448,11 @@ int main(int argc, char *argv[])
   my_assert_not(fout, NULL);
 
   pub_sym_alloc = 64;
-  pub_syms = malloc(pub_sym_alloc * sizeof(pub_syms[0]));
+  pub_syms = mem_malloc(MEM_SYMS, pub_sym_alloc * sizeof(pub_syms[0]));
   my_assert_not(pub_syms, NULL);
 
   rlist_alloc = 64;
-  rlist = malloc(rlist_alloc * sizeof(rlist[0]));
+  rlist = mem_malloc(MEM_SYMS, rlist_alloc * sizeof(rlist[0]));
   my_assert_not(rlist, NULL);
 
   for (; arg < argc; arg++) {
@@ -466,10 +470,11 @@ int main(int argc, char *argv[])
 
       if (rlist_cnt >= rlist_alloc) {
         rlist_alloc = rlist_alloc * 2 + 64;
-        rlist = realloc(rlist, rlist_alloc * sizeof(rlist[0]));
+        rlist = mem_realloc(MEM_SYMS, rlist,
+          rlist_alloc * sizeof(rlist[0]));
         my_assert_not(rlist, NULL);
       }
-      rlist[rlist_cnt++] = strdup(words[0]);
+      rlist[rlist_cnt++] = mem_strdup(MEM_SYMS, words[0]);
     }
 
     fclose(frlist);
@@ -573,10 +578,11 @@ int main(int argc, char *argv[])
           // public/global name
           if (pub_sym_cnt >= pub_sym_alloc) {
             pub_sym_alloc *= 2;
-            pub_syms = realloc(pub_syms, pub_sym_alloc * sizeof(pub_syms[0]));
+            pub_syms = mem_realloc(MEM_SYMS, pub_syms,
+              pub_sym_alloc * sizeof(pub_syms[0]));
             my_assert_not(pub_syms, NULL);
           }
-          pub_syms[pub_sym_cnt++] = strdup(sym);
+          pub_syms[pub_sym_cnt++] = mem_strdup(MEM_SYMS, sym);
         }
 
         len = strlen(sym);
@@ -776,6 +782,15 @@ fin:
   fclose(fasm);
   fclose(fhdr);
 
+  for (i = 0; i < pub_sym_cnt; i++)
+    mem_free(pub_syms[i]);
+  mem_free(pub_syms);
+  for (i = 0; i < rlist_cnt; i++)
+    mem_free(rlist[i]);
+  mem_free(rlist);
+  if (mem_rep)
+    mem_report(stdout);
+
   return 0;
 }
 
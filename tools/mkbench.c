@@ -0,0 +1,1018 @@
+/*
+ * ia32rtools
+ * (C) notaz, 2013,2014
+ *
+ * This work is licensed under the terms of 3-clause BSD license.
+ * See COPYING file in the top-level directory.
+ */
+
+// generates synthetic IDA-style asm + matching header,
+// meant for benchmarking the tools without a real binary.
+// -r runs a tool over such asm and reports its throughput.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "my_assert.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+enum func_kind {
+  FK_BP,    // ebp based frame
+  FK_SP,    // esp frame: sub esp, N
+  FK_LEAF,  // no frame, esp based args
+  FK_FAST,  // __fastcall, no frame
+  FK_USER,  // __usercall, args in eax, edx
+};
+
+enum chunk_pos {
+  CP_NONE,
+  CP_BEFORE,
+  CP_AFTER,
+};
+
+struct gen_func {
+  unsigned int addr;
+  unsigned int chunk_addr;
+  enum func_kind kind;
+  enum chunk_pos chunk;
+  int argc;         // stack args
+  int varc;         // dword stack vars
+  int has_buf;      // 8 dword stack buffer after vars
+  unsigned int is_stdcall:1;
+  unsigned int is_void:1;
+  unsigned int save_esi:1;
+  unsigned int save_edi:1;
+};
+
+struct gen_table {
+  unsigned int addr;
+  int is_byte;
+  int count;
+  unsigned int vals[8];
+};
+
+#define FUNC_SPACING 0x1000
+#define TEXT_BASE    0x401000
+#define GLOBAL_CNT   64
+#define BGLOBAL_CNT  16
+#define FPTR_CNT     8
+#define STR_CNT      16
+
+static struct gen_func *funcs;
+static int func_cnt;
+static unsigned int data_base;
+static unsigned int rdata_base;
+static int use_libc;
+
+static unsigned int rnd_state = 0x12345678;
+
+static unsigned int rnd(unsigned int range)
+{
+  // xorshift32
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state % range;
+}
+
+// masm style number: 8, 0Ch, -10h
+static const char *mnum(int v)
+{
+  static char bufs[8][32];
+  static int bi;
+  char *buf = bufs[bi++ & 7];
+  const char *sign = "";
+  char tmp[16];
+
+  if (v < 0) {
+    sign = "-";
+    v = -v;
+  }
+  if (v < 10) {
+    snprintf(buf, sizeof(bufs[0]), "%s%d", sign, v);
+    return buf;
+  }
+  snprintf(tmp, sizeof(tmp), "%X", v);
+  snprintf(buf, sizeof(bufs[0]), "%s%s%sh", sign,
+    (tmp[0] >= 'A') ? "0" : "", tmp);
+  return buf;
+}
+
+static unsigned int global_addr(int i)
+{
+  return data_base + i * 4;
+}
+
+static unsigned int bglobal_addr(int i)
+{
+  return data_base + GLOBAL_CNT * 4 + i;
+}
+
+static unsigned int fptr_addr(int i)
+{
+  return data_base + GLOBAL_CNT * 4 + BGLOBAL_CNT + i * 4;
+}
+
+struct emit_state {
+  FILE *f;
+  const struct gen_func *fn;
+  int label_cnt;
+  int esp_bias;     // pushes since frame setup (esp based funcs)
+  int has_switch;
+  struct gen_table tables[4];
+  int table_cnt;
+};
+
+static unsigned int new_label(struct emit_state *st)
+{
+  st->label_cnt++;
+  my_assert((st->label_cnt < 0x1c0), 1);
+  return st->fn->addr + 0x10 + st->label_cnt * 8;
+}
+
+static void emit_label(struct emit_state *st, unsigned int addr)
+{
+  fprintf(st->f, "\nloc_%X:\n", addr);
+}
+
+static void emit(struct emit_state *st, const char *op, const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+
+static void emit(struct emit_state *st, const char *op, const char *fmt, ...)
+{
+  va_list ap;
+
+  if (fmt[0] == ' ') {
+    fprintf(st->f, "                %s\n", op);
+    return;
+  }
+  fprintf(st->f, "                %-8s", op);
+  va_start(ap, fmt);
+  vfprintf(st->f, fmt, ap);
+  va_end(ap);
+  fprintf(st->f, "\n");
+}
+
+static int saved_regs(const struct gen_func *fn)
+{
+  return fn->save_esi + fn->save_edi;
+}
+
+static int frame_size(const struct gen_func *fn)
+{
+  return fn->varc * 4 + (fn->has_buf ? 0x20 : 0);
+}
+
+// stack arg/var reference in IDA notation
+static const char *stack_ref(struct emit_state *st, const char *pfx, int ofs)
+{
+  static char bufs[4][64];
+  static int bi;
+  const struct gen_func *fn = st->fn;
+  char *buf = bufs[bi++ & 3];
+  int bias;
+
+  if (fn->kind == FK_BP) {
+    snprintf(buf, sizeof(bufs[0]), "[ebp+%s_%X]", pfx, ofs);
+    return buf;
+  }
+
+  bias = saved_regs(fn) * 4 + st->esp_bias;
+  if (fn->kind == FK_SP)
+    bias += frame_size(fn);
+  if (bias == 0)
+    snprintf(buf, sizeof(bufs[0]), "[esp+%s_%X]", pfx, ofs);
+  else
+    snprintf(buf, sizeof(bufs[0]), "[esp+%s+%s_%X]", mnum(bias), pfx, ofs);
+  return buf;
+}
+
+static const char *arg_ref(struct emit_state *st, int i)
+{
+  return stack_ref(st, "arg", i * 4);
+}
+
+static const char *var_ref(struct emit_state *st, int i)
+{
+  return stack_ref(st, "var", (i + 1) * 4);
+}
+
+// some source operand, any size of dword
+static const char *src_opr(struct emit_state *st)
+{
+  static char buf[64];
+  const struct gen_func *fn = st->fn;
+
+  switch (rnd(6)) {
+  case 0:
+    if (fn->argc > 0)
+      return arg_ref(st, rnd(fn->argc));
+    break;
+  case 1:
+    if (fn->varc > 0)
+      return var_ref(st, rnd(fn->varc));
+    break;
+  case 2:
+    snprintf(buf, sizeof(buf), "dword_%X", global_addr(rnd(GLOBAL_CNT)));
+    return buf;
+  case 3:
+    return mnum(rnd(0x200));
+  default:
+    break;
+  }
+
+  return rnd(2) ? "ecx" : "edx";
+}
+
+// plain arithmetic op, never touches ecx if keep_ecx
+static void emit_arith(struct emit_state *st, int keep_ecx)
+{
+  const struct gen_func *fn = st->fn;
+  const char *r = keep_ecx ? "edx" : (rnd(2) ? "ecx" : "edx");
+  static const char *dops[] = { "add", "sub", "and", "or", "xor" };
+  static const char *sops[] = { "shl", "shr", "sar" };
+
+  switch (rnd(16)) {
+  case 0:
+  case 1:
+    emit(st, "mov", "eax, %s", src_opr(st));
+    break;
+  case 2:
+    emit(st, dops[rnd(ARRAY_SIZE(dops))], "eax, %s", r);
+    break;
+  case 3:
+    emit(st, dops[rnd(ARRAY_SIZE(dops))], "eax, %s", mnum(rnd(0x100) + 1));
+    break;
+  case 4:
+    emit(st, sops[rnd(ARRAY_SIZE(sops))], "eax, %d", rnd(7) + 1);
+    break;
+  case 5:
+    emit(st, "imul", "eax, %s", r);
+    break;
+  case 6:
+    emit(st, rnd(2) ? "inc" : "dec", "eax");
+    break;
+  case 7:
+    emit(st, rnd(2) ? "neg" : "not", "eax");
+    break;
+  case 8:
+    emit(st, "lea", "%s, [eax+eax*2]", r);
+    break;
+  case 9:
+    emit(st, "lea", "eax, [%s+%s]", r, mnum((rnd(8) + 1) * 4));
+    break;
+  case 10:
+    if (fn->varc > 0) {
+      emit(st, "mov", "%s, eax", var_ref(st, rnd(fn->varc)));
+      break;
+    }
+    // fallthrough
+  case 11:
+    emit(st, "mov", "dword_%X, eax", global_addr(rnd(GLOBAL_CNT)));
+    break;
+  case 12:
+    emit(st, "add", "dword_%X, %s", global_addr(rnd(GLOBAL_CNT)),
+      rnd(2) ? "eax" : mnum(rnd(16) + 1));
+    break;
+  case 13:
+    emit(st, "movzx", "eax, byte_%X", bglobal_addr(rnd(BGLOBAL_CNT)));
+    break;
+  case 14:
+    emit(st, "mov", "byte_%X, al", bglobal_addr(rnd(BGLOBAL_CNT)));
+    break;
+  case 15:
+    emit(st, "mov", "%s, [eax+%s]", r, mnum(rnd(8) * 4 + 4));
+    break;
+  }
+}
+
+static void emit_if(struct emit_state *st)
+{
+  static const char *jcc_cmp[] = {
+    "jz", "jnz", "jl", "jle", "jg", "jge", "jb", "jbe", "ja", "jnb",
+  };
+  static const char *jcc_test[] = { "jz", "jnz", "js", "jns" };
+  unsigned int l_skip, l_else = 0;
+  int i, n;
+
+  switch (rnd(4)) {
+  case 0:
+    emit(st, "cmp", "eax, %s", mnum(rnd(0x100)));
+    emit(st, jcc_cmp[rnd(ARRAY_SIZE(jcc_cmp))], "short loc_%X",
+      l_skip = new_label(st));
+    break;
+  case 1:
+    emit(st, "cmp", "eax, %s", rnd(2) ? "ecx" : "edx");
+    emit(st, jcc_cmp[rnd(ARRAY_SIZE(jcc_cmp))], "short loc_%X",
+      l_skip = new_label(st));
+    break;
+  case 2:
+    emit(st, "test", "eax, eax");
+    emit(st, jcc_test[rnd(ARRAY_SIZE(jcc_test))], "short loc_%X",
+      l_skip = new_label(st));
+    break;
+  default:
+    emit(st, "and", "eax, %s", mnum(rnd(0xff) + 1));
+    emit(st, rnd(2) ? "jz" : "jnz", "short loc_%X",
+      l_skip = new_label(st));
+    break;
+  }
+
+  n = rnd(3) + 1;
+  for (i = 0; i < n; i++)
+    emit_arith(st, 0);
+
+  if (rnd(3) == 0) {
+    // else branch
+    l_else = l_skip;
+    emit(st, "jmp", "short loc_%X", l_skip = new_label(st));
+    emit_label(st, l_else);
+    n = rnd(2) + 1;
+    for (i = 0; i < n; i++)
+      emit_arith(st, 0);
+  }
+
+  emit_label(st, l_skip);
+}
+
+static void emit_loop(struct emit_state *st)
+{
+  unsigned int l_loop;
+  int i, n;
+
+  emit(st, "mov", "ecx, %s", mnum(rnd(0x40) + 2));
+  emit_label(st, l_loop = new_label(st));
+  n = rnd(3) + 1;
+  for (i = 0; i < n; i++)
+    emit_arith(st, 1);
+  emit(st, "dec", "ecx");
+  emit(st, "jnz", "short loc_%X", l_loop);
+}
+
+static void emit_call(struct emit_state *st)
+{
+  const struct gen_func *callee;
+  int i, k;
+
+  if (use_libc && rnd(8) == 0) {
+    emit(st, "push", "%s", mnum((rnd(16) + 1) * 16));
+    emit(st, "call", "_malloc");
+    emit(st, "add", "esp, 4");
+    emit(st, "push", "eax");
+    emit(st, "call", "_free");
+    emit(st, "add", "esp, 4");
+    return;
+  }
+
+  if (rnd(8) == 0) {
+    // indirect call via global func ptr
+    k = rnd(FPTR_CNT);
+    emit(st, "push", "eax");
+    if (rnd(2)) {
+      emit(st, "mov", "edx, dword_%X", fptr_addr(k));
+      emit(st, "call", "edx");
+    }
+    else
+      emit(st, "call", "dword_%X", fptr_addr(k));
+    emit(st, "add", "esp, 4");
+    return;
+  }
+
+  callee = &funcs[rnd(func_cnt)];
+  if (callee->kind == FK_FAST) {
+    emit(st, "mov", "ecx, eax");
+    emit(st, "mov", "edx, %s", mnum(rnd(0x100)));
+    emit(st, "call", "sub_%X", callee->addr);
+  }
+  else if (callee->kind == FK_USER) {
+    emit(st, "mov", "edx, %s", mnum(rnd(0x100)));
+    emit(st, "call", "sub_%X", callee->addr);
+  }
+  else {
+    for (i = 0; i < callee->argc; i++) {
+      switch (rnd(3)) {
+      case 0:
+        emit(st, "push", "eax");
+        break;
+      case 1:
+        emit(st, "push", "%s", mnum(rnd(0x1000)));
+        break;
+      default:
+        emit(st, "push", "%s", rnd(2) ? "ecx" : "edx");
+        break;
+      }
+      st->esp_bias += 4;
+    }
+    emit(st, "call", "sub_%X", callee->addr);
+    if (!callee->is_stdcall && callee->argc > 0) {
+      emit(st, "add", "esp, %s", mnum(callee->argc * 4));
+    }
+    st->esp_bias -= callee->argc * 4;
+  }
+
+  if (!callee->is_void && rnd(2))
+    emit(st, "mov", "%s, eax", rnd(2) ? "ecx" : "edx");
+}
+
+// a cdecl call on one path only, its args left for the
+// epilogue ('mov esp, ebp') to drop
+static int emit_call_noadj(struct emit_state *st)
+{
+  const struct gen_func *callee;
+  unsigned int l_skip;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    callee = &funcs[rnd(func_cnt)];
+    if (callee->kind != FK_FAST && callee->kind != FK_USER
+        && !callee->is_stdcall && callee->argc > 0)
+      break;
+  }
+  if (i == 8)
+    return 0;
+
+  emit(st, "test", "eax, eax");
+  emit(st, "jz", "short loc_%X", l_skip = new_label(st));
+  for (i = 0; i < callee->argc; i++)
+    emit(st, "push", "eax");
+  emit(st, "call", "sub_%X", callee->addr);
+  emit_label(st, l_skip);
+  return 1;
+}
+
+static void emit_switch(struct emit_state *st)
+{
+  struct gen_table *jt, *bt = NULL;
+  unsigned int l_def, l_end;
+  unsigned int cases[8];
+  int i, n;
+
+  my_assert((st->table_cnt + 2 <= ARRAY_SIZE(st->tables)), 1);
+  n = rnd(6) + 3;
+  l_def = new_label(st);
+  l_end = new_label(st);
+  for (i = 0; i < n; i++)
+    cases[i] = new_label(st);
+
+  jt = &st->tables[st->table_cnt++];
+  jt->addr = st->fn->addr + 0xe00 + st->table_cnt * 0x40;
+  jt->is_byte = 0;
+
+  if (rnd(3) == 0) {
+    // msvc's 2-level switch: byte index table
+    bt = &st->tables[st->table_cnt++];
+    bt->addr = st->fn->addr + 0xe00 + st->table_cnt * 0x40;
+    bt->is_byte = 1;
+    bt->count = n + rnd(8 - n + 1);
+    for (i = 0; i < bt->count; i++)
+      bt->vals[i] = rnd(n);
+  }
+
+  emit(st, "cmp", "eax, %d", (bt ? bt->count : n) - 1);
+  emit(st, "ja", "short loc_%X", l_def);
+  if (bt != NULL) {
+    emit(st, "movzx", "eax, ds:byte_%X[eax]", bt->addr);
+  }
+  emit(st, "jmp", "ds:off_%X[eax*4]", jt->addr);
+
+  jt->count = n;
+  for (i = 0; i < n; i++) {
+    jt->vals[i] = cases[i];
+    emit_label(st, cases[i]);
+    emit(st, "mov", "ecx, %s", mnum(rnd(0x100)));
+    emit(st, "jmp", "short loc_%X", l_end);
+  }
+
+  emit_label(st, l_def);
+  emit(st, "xor", "ecx, ecx");
+  emit_label(st, l_end);
+  emit(st, "add", "eax, ecx");
+  st->has_switch = 1;
+}
+
+static void emit_misc(struct emit_state *st)
+{
+  switch (rnd(4)) {
+  case 0:
+    emit(st, "xor", "edx, edx");
+    emit(st, "cmp", "eax, ecx");
+    emit(st, "setl", "dl");
+    emit(st, "mov", "eax, edx");
+    break;
+  case 1:
+    emit(st, "mov", "ecx, %s", mnum(rnd(0x100) + 1));
+    emit(st, "cdq", " ");
+    emit(st, "idiv", "ecx");
+    break;
+  case 2:
+    emit(st, "mov", "ecx, %s", mnum(rnd(0x100) + 1));
+    emit(st, "xor", "edx, edx");
+    emit(st, "div", "ecx");
+    break;
+  default:
+    emit(st, "add", "eax, ecx");
+    emit(st, "adc", "edx, 0");
+    break;
+  }
+}
+
+static void emit_prologue(struct emit_state *st)
+{
+  const struct gen_func *fn = st->fn;
+  int fsz = frame_size(fn);
+
+  if (fn->kind == FK_BP) {
+    emit(st, "push", "ebp");
+    emit(st, "mov", "ebp, esp");
+    if (fsz)
+      emit(st, "sub", "esp, %s", mnum(fsz));
+  }
+  else if (fn->kind == FK_SP)
+    emit(st, "sub", "esp, %s", mnum(fsz));
+
+  if (fn->save_esi)
+    emit(st, "push", "esi");
+  if (fn->save_edi)
+    emit(st, "push", "edi");
+
+  if (fn->kind == FK_FAST) {
+    emit(st, "mov", "eax, ecx");
+    emit(st, "add", "eax, edx");
+  }
+  else if (fn->kind == FK_USER)
+    emit(st, "add", "eax, edx");
+  else if (fn->argc > 0)
+    emit(st, "mov", "eax, %s", arg_ref(st, 0));
+  else
+    emit(st, "xor", "eax, eax");
+
+  if (fn->save_esi)
+    emit(st, "mov", "esi, eax");
+  if (fn->has_buf) {
+    emit(st, "lea", "edi, %s", stack_ref(st, "var", fsz));
+    emit(st, "xor", "eax, eax");
+    emit(st, "mov", "ecx, 8");
+    emit(st, "rep", "stosd");
+    emit(st, "mov", "eax, esi");
+  }
+}
+
+static void emit_epilogue(struct emit_state *st, const char *tail)
+{
+  const struct gen_func *fn = st->fn;
+
+  if (fn->save_esi)
+    emit(st, "add", "eax, esi");
+  if (fn->save_edi)
+    emit(st, "pop", "edi");
+  if (fn->save_esi)
+    emit(st, "pop", "esi");
+
+  if (fn->kind == FK_BP) {
+    if (frame_size(fn))
+      emit(st, "mov", "esp, ebp");
+    emit(st, "pop", "ebp");
+  }
+  else if (fn->kind == FK_SP)
+    emit(st, "add", "esp, %s", mnum(frame_size(fn)));
+
+  if (tail != NULL)
+    emit(st, "jmp", "%s", tail);
+  else if (fn->is_stdcall && fn->argc > 0)
+    emit(st, "retn", "%s", mnum(fn->argc * 4));
+  else
+    emit(st, "retn", " ");
+}
+
+// tail call target: same stack args, cconv and return
+static const struct gen_func *find_tail_target(const struct gen_func *fn)
+{
+  const struct gen_func *t;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    t = &funcs[rnd(func_cnt)];
+    if (t == fn || t->kind == FK_FAST || t->kind == FK_USER)
+      continue;
+    if (t->argc != fn->argc || t->is_void != fn->is_void)
+      continue;
+    if (t->argc > 0 && t->is_stdcall != fn->is_stdcall)
+      continue;
+    return t;
+  }
+
+  return NULL;
+}
+
+static void emit_chunk(FILE *f, const struct gen_func *fn)
+{
+  fprintf(f, "; START OF FUNCTION CHUNK FOR sub_%X\n\n", fn->addr);
+  fprintf(f, "loc_%X:                             "
+    "; CODE XREF: sub_%X+8j\n", fn->chunk_addr, fn->addr);
+  fprintf(f, "                %-8s" "eax, %s\n", "add", mnum(rnd(0x80) + 1));
+  fprintf(f, "                %-8s" "loc_%X\n", "jmp", fn->addr + 0xff8);
+  fprintf(f, "; END OF FUNCTION CHUNK FOR sub_%X\n\n", fn->addr);
+}
+
+static void emit_func(FILE *f, const struct gen_func *fn)
+{
+  struct emit_state st;
+  const struct gen_func *tail = NULL;
+  char tail_name[32];
+  unsigned int l_ret2 = 0;
+  struct gen_table *t;
+  int noadj = 0;
+  int blocks;
+  int i, j;
+
+  memset(&st, 0, sizeof(st));
+  st.f = f;
+  st.fn = fn;
+
+  fprintf(f, "; =============== S U B R O U T I N E "
+    "=======================================\n\n");
+  if (fn->kind == FK_BP)
+    fprintf(f, "; Attributes: bp-based frame\n\n");
+  fprintf(f, "sub_%X       proc near               "
+    "; CODE XREF: sub_%X+%Xp\n", fn->addr,
+    funcs[rnd(func_cnt)].addr, rnd(0x100));
+  if (fn->chunk != CP_NONE)
+    fprintf(f, "\n; FUNCTION CHUNK AT %08X SIZE 00000008 BYTES\n",
+      fn->chunk_addr);
+  fprintf(f, "\n");
+
+  if (fn->has_buf)
+    fprintf(f, "var_%X          = dword ptr %s\n",
+      frame_size(fn), mnum(-frame_size(fn)));
+  for (i = fn->varc - 1; i >= 0; i--)
+    fprintf(f, "var_%X           = dword ptr %s\n",
+      (i + 1) * 4, mnum(-(i + 1) * 4));
+  for (i = 0; i < fn->argc; i++)
+    fprintf(f, "arg_%X           = dword ptr  %s\n", i * 4,
+      mnum(i * 4 + (fn->kind == FK_BP ? 8 : 4)));
+  fprintf(f, "\n");
+
+  emit_prologue(&st);
+
+  if (fn->chunk != CP_NONE) {
+    emit(&st, "test", "eax, eax");
+    emit(&st, "jz", "loc_%X", fn->chunk_addr);
+  }
+
+  blocks = rnd(12) + 2;
+  for (i = 0; i < blocks; i++) {
+    j = rnd(100);
+    if (j < 30)
+      emit_arith(&st, 0);
+    else if (j < 50)
+      emit_if(&st);
+    else if (j < 60)
+      emit_loop(&st);
+    else if (j < 80)
+      emit_call(&st);
+    else if (j < 88 && st.table_cnt == 0)
+      emit_switch(&st);
+    else
+      emit_misc(&st);
+  }
+
+  if (fn->chunk != CP_NONE) {
+    emit(&st, "inc", "eax");
+    emit_label(&st, fn->addr + 0xff8);
+    emit(&st, "or", "eax, 1");
+  }
+
+  if (fn->kind != FK_FAST && rnd(4) == 0) {
+    emit(&st, "test", "eax, eax");
+    emit(&st, "jz", "short loc_%X", l_ret2 = new_label(&st));
+  }
+
+  // saved regs would be popped from under the args
+  if (fn->kind == FK_BP && frame_size(fn) && !fn->save_esi
+      && !fn->save_edi && rnd(8) == 0)
+    noadj = emit_call_noadj(&st);
+
+  // translate wants a ret before any trailing chunk
+  if (fn->kind == FK_BP && l_ret2 == 0 && fn->chunk == CP_NONE
+      && !noadj && rnd(6) == 0)
+    tail = find_tail_target(fn);
+  if (tail != NULL) {
+    snprintf(tail_name, sizeof(tail_name), "sub_%X", tail->addr);
+    emit_epilogue(&st, tail_name);
+  }
+  else
+    emit_epilogue(&st, NULL);
+
+  if (l_ret2) {
+    emit_label(&st, l_ret2);
+    emit(&st, "xor", "eax, eax");
+    emit_epilogue(&st, NULL);
+  }
+
+  fprintf(f, "sub_%X       endp\n\n", fn->addr);
+
+  for (i = 0; i < st.table_cnt; i++) {
+    t = &st.tables[i];
+    fprintf(f, "; ---------------------------------------------------------------------------\n");
+    if (t->is_byte) {
+      fprintf(f, "byte_%X     db ", t->addr);
+      for (j = 0; j < t->count; j++)
+        fprintf(f, "%s%d", j ? ", " : "", t->vals[j]);
+      fprintf(f, "\n");
+      continue;
+    }
+    fprintf(f, "                align 4\n");
+    fprintf(f, "off_%X      dd offset loc_%X", t->addr, t->vals[0]);
+    for (j = 1; j < t->count; j++) {
+      if ((j & 3) == 0)
+        fprintf(f, "\n                dd offset loc_%X", t->vals[j]);
+      else
+        fprintf(f, ", offset loc_%X", t->vals[j]);
+    }
+    fprintf(f, "\n                                        "
+      "; DATA XREF: sub_%X+40r\n", fn->addr);
+  }
+}
+
+static void output_proto(FILE *f, const struct gen_func *fn)
+{
+  const char *cconv = "__cdecl";
+  int i;
+
+  if (fn->kind == FK_FAST) {
+    fprintf(f, "int __fastcall sub_%X(int a1, int a2);\n", fn->addr);
+    return;
+  }
+  if (fn->kind == FK_USER) {
+    fprintf(f, "int __usercall sub_%X<eax>(int a1<eax>, int a2<edx>);\n",
+      fn->addr);
+    return;
+  }
+  if (fn->is_stdcall)
+    cconv = "__stdcall";
+
+  fprintf(f, "%s %s sub_%X(", fn->is_void ? "void" : "int",
+    cconv, fn->addr);
+  for (i = 0; i < fn->argc; i++)
+    fprintf(f, "%sint a%d", i ? ", " : "", i + 1);
+  if (fn->argc == 0)
+    fprintf(f, "void");
+  fprintf(f, ");\n");
+}
+
+static void output_data(FILE *f)
+{
+  const struct gen_func *fn;
+  int i, j;
+
+  fprintf(f, "_text           ends\n\n");
+
+  fprintf(f, "; Section 2. (virtual address %08X)\n", rdata_base);
+  fprintf(f, "_rdata          segment para public 'DATA' use32\n");
+  fprintf(f, "                assume cs:_rdata\n");
+  fprintf(f, "                ;org %Xh\n", rdata_base);
+  for (i = 0; i < STR_CNT; i++) {
+    fprintf(f, "aString%d        db 'String \"%d\" here',0\n", i, i);
+    fprintf(f, "                align 10h\n");
+  }
+  fprintf(f, "_rdata          ends\n\n");
+
+  fprintf(f, "; Section 3. (virtual address %08X)\n", data_base);
+  fprintf(f, "_data           segment para public 'DATA' use32\n");
+  fprintf(f, "                assume cs:_data\n");
+  fprintf(f, "                ;org %Xh\n", data_base);
+  for (i = 0; i < GLOBAL_CNT; i++) {
+    if (i & 1)
+      fprintf(f, "dword_%X     dd %s\n", global_addr(i), mnum(rnd(0x10000)));
+    else
+      fprintf(f, "dword_%X     dd 0\n", global_addr(i));
+  }
+  for (i = 0; i < BGLOBAL_CNT; i++)
+    fprintf(f, "byte_%X      db %d\n", bglobal_addr(i), rnd(10));
+  for (i = 0; i < FPTR_CNT; i++) {
+    // point to a matching func if there is one
+    fn = NULL;
+    for (j = 0; j < 16 && fn == NULL; j++) {
+      fn = &funcs[rnd(func_cnt)];
+      if (fn->kind == FK_FAST || fn->kind == FK_USER
+          || fn->is_stdcall || fn->is_void
+          || fn->argc != 1)
+        fn = NULL;
+    }
+    if (fn != NULL)
+      fprintf(f, "dword_%X     dd offset sub_%X\n", fptr_addr(i), fn->addr);
+    else
+      fprintf(f, "dword_%X     dd 0\n", fptr_addr(i));
+  }
+  fprintf(f, "_data           ends\n\n");
+  fprintf(f, "                end\n");
+}
+
+// -r: run a tool over an .asm, stdout discarded,
+// report its lines/s, functions/s and peak RSS
+static int run_bench(const char *name, const char *asm_fn, char *cmd[])
+{
+  unsigned long lines = 0, procs = 0;
+  struct timespec t0, t1;
+  struct rusage ru;
+  char line[256];
+  double secs;
+  int status;
+  pid_t pid;
+  FILE *f;
+  int fd;
+
+  f = fopen(asm_fn, "r");
+  my_assert_not(f, NULL);
+  while (fgets(line, sizeof(line), f)) {
+    if (strchr(line, '\n') != NULL)
+      lines++;
+    if (strstr(line, " proc near") != NULL)
+      procs++;
+  }
+  fclose(f);
+
+  fflush(stdout);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pid = fork();
+  if (pid == 0) {
+    fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0)
+      dup2(fd, 1);
+    execv(cmd[0], cmd);
+    perror(cmd[0]);
+    _exit(127);
+  }
+  if (pid < 0 || wait4(pid, &status, 0, &ru) != pid) {
+    perror("fork/wait4");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%s: %s failed, status %x\n", name, cmd[0], status);
+    return 1;
+  }
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  if (secs <= 0)
+    secs = 1e-9;
+  printf("%-10s %-20s %9lu lines %7lu funcs %8.3fs %10.0f lines/s "
+    "%8.0f funcs/s %8ld kB RSS\n", name, asm_fn, lines, procs, secs,
+    lines / secs, procs / secs, ru.ru_maxrss);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fasm, *fhdr, *flist = NULL;
+  const char *inc = NULL;
+  struct gen_func *fn;
+  int arg;
+  int i;
+
+  if (argc >= 5 && !strcmp(argv[1], "-r"))
+    return run_bench(argv[2], argv[3], argv + 4);
+
+  for (arg = 1; arg < argc; arg++) {
+    if (!strcmp(argv[arg], "-s") && arg + 1 < argc)
+      rnd_state = strtoul(argv[++arg], NULL, 0) * 2654435761u + 1;
+    else if (!strcmp(argv[arg], "-i") && arg + 1 < argc)
+      inc = argv[++arg];
+    else if (!strcmp(argv[arg], "-l") && arg + 1 < argc) {
+      flist = fopen(argv[++arg], "w");
+      my_assert_not(flist, NULL);
+    }
+    else
+      break;
+  }
+
+  if (argc != arg + 3) {
+    printf("usage:\n%s [-s seed] [-i <hlist>] [-l <symlist>] "
+      "<nfuncs> <.asm> <.h>\n", argv[0]);
+    printf("%s -r <name> <.asm> <tool> [args]*\n", argv[0]);
+    printf("  -i - add //#include <hlist> to header, use libc calls\n"
+           "  -l - also write a list of some func names (rlist)\n"
+           "  -r - run a tool on .asm, report throughput\n");
+    return 1;
+  }
+
+  func_cnt = atoi(argv[arg++]);
+  if (func_cnt <= 0) {
+    printf("bad func count: %d\n", func_cnt);
+    return 1;
+  }
+  use_libc = (inc != NULL);
+
+  fasm = fopen(argv[arg++], "w");
+  my_assert_not(fasm, NULL);
+  fhdr = fopen(argv[arg++], "w");
+  my_assert_not(fhdr, NULL);
+
+  funcs = calloc(func_cnt, sizeof(funcs[0]));
+  my_assert_not(funcs, NULL);
+
+  for (i = 0; i < func_cnt; i++) {
+    fn = &funcs[i];
+    fn->addr = TEXT_BASE + i * FUNC_SPACING;
+    fn->kind = rnd(10);
+    if (fn->kind > FK_USER)
+      fn->kind = FK_BP;
+    if (fn->kind != FK_FAST && fn->kind != FK_USER) {
+      fn->argc = rnd(4);
+      fn->is_stdcall = rnd(3) == 0;
+      fn->is_void = rnd(5) == 0;
+    }
+    if (fn->kind == FK_BP || fn->kind == FK_SP)
+      fn->varc = rnd(5) + 1;
+    if (fn->kind == FK_BP) {
+      fn->save_esi = rnd(2);
+      fn->has_buf = fn->save_esi && rnd(4) == 0;
+      fn->save_edi = fn->has_buf;
+    }
+    if (fn->kind == FK_SP)
+      fn->save_esi = rnd(3) == 0;
+
+    if (rnd(8) == 0) {
+      fn->chunk = (i > 0 && rnd(2)) ? CP_BEFORE : CP_AFTER;
+      if (fn->chunk == CP_BEFORE)
+        fn->chunk_addr = fn->addr - 0x40;
+      else if (i + 1 < func_cnt)
+        fn->chunk_addr = fn->addr + FUNC_SPACING + 0xfc0;
+      else
+        fn->chunk_addr = fn->addr + 0xfc0;
+    }
+    if (flist != NULL && (i & 15) == 15)
+      fprintf(flist, "sub_%X\n", fn->addr);
+  }
+  // before-chunks can't share space with a preceding after-chunk
+  for (i = 1; i < func_cnt; i++) {
+    if (funcs[i].chunk == CP_BEFORE && funcs[i - 1].chunk == CP_AFTER)
+      funcs[i].chunk = CP_NONE;
+    if (i >= 2 && funcs[i].chunk == CP_BEFORE
+        && funcs[i - 2].chunk == CP_AFTER)
+      funcs[i].chunk = CP_NONE;
+  }
+
+  rdata_base = (TEXT_BASE + func_cnt * FUNC_SPACING + 0xfff) & ~0xfff;
+  data_base = rdata_base + 0x1000;
+
+  // header
+  if (inc != NULL)
+    fprintf(fhdr, "//#include %s\n", inc);
+  fprintf(fhdr, "// generated by mkbench\n");
+  for (i = 0; i < func_cnt; i++)
+    output_proto(fhdr, &funcs[i]);
+  for (i = 0; i < GLOBAL_CNT; i++)
+    fprintf(fhdr, "int dword_%X;\n", global_addr(i));
+  for (i = 0; i < BGLOBAL_CNT; i++)
+    fprintf(fhdr, "unsigned char byte_%X;\n", bglobal_addr(i));
+  for (i = 0; i < FPTR_CNT; i++)
+    fprintf(fhdr, "int (__cdecl *dword_%X)(int a1);\n", fptr_addr(i));
+  for (i = 0; i < STR_CNT; i++)
+    fprintf(fhdr, "char aString%d[];\n", i);
+
+  // asm
+  fprintf(fasm, "; File Name   : bench.exe\n"
+    "; Format      : Portable executable for 80386 (PE)\n\n"
+    "                .686p\n"
+    "                .mmx\n"
+    "                .model flat\n\n"
+    "; Segment type: Pure code\n"
+    "_text           segment para public 'CODE' use32\n"
+    "                assume cs:_text\n"
+    "                ;org %Xh\n"
+    "                assume es:nothing, ss:nothing, ds:_data, "
+    "fs:nothing, gs:nothing\n\n", TEXT_BASE);
+
+  for (i = 0; i < func_cnt; i++) {
+    fn = &funcs[i];
+    if (fn->chunk == CP_BEFORE)
+      emit_chunk(fasm, fn);
+    emit_func(fasm, fn);
+    if (i > 0 && funcs[i - 1].chunk == CP_AFTER)
+      emit_chunk(fasm, &funcs[i - 1]);
+  }
+  if (func_cnt > 0 && funcs[func_cnt - 1].chunk == CP_AFTER)
+    emit_chunk(fasm, &funcs[func_cnt - 1]);
+
+  output_data(fasm);
+
+  fclose(fasm);
+  fclose(fhdr);
+  if (flist != NULL)
+    fclose(flist);
+  free(funcs);
+
+  return 0;
+}
+
+// vim:ts=2:shiftwidth=2:expandtab
@@ -12,12 +12,16 @@
 
 #include "my_assert.h"
 #include "my_str.h"
+#include "my_mem.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #define IS(w, y) !strcmp(w, y)
 
 #include "protoparse.h"
 
+// args repushed for vararg funcs, hopefully enough?
+#define VARARG_REPUSH 16
+
 static const char *c_save_regs[] = { "ebx", "esi", "edi", "ebp" };
 
 static int is_x86_reg_saved(const char *reg)
@@ -68,8 +72,8 @@ static void out_toasm_x86(FILE *f, const char *sym_out,
 	int i;
 
 	argc_repush = pp->argc;
-	if (pp->is_vararg)
-		argc_repush = ARRAY_SIZE(pp->arg); // hopefully enough?
+	if (pp->is_vararg && argc_repush < VARARG_REPUSH)
+		argc_repush = VARARG_REPUSH;
 
 	for (i = 0; i < pp->argc; i++) {
 		if (pp->arg[i].reg != NULL)
@@ -112,7 +116,7 @@ static void out_toasm_x86(FILE *f, const char *sym_out,
 
 	// reconstruct arg stack for asm
 	for (i = argc_repush - 1; i >= 0; i--) {
-		if (pp->arg[i].reg == NULL) {
+		if (i >= pp->argc || pp->arg[i].reg == NULL) {
 			fprintf(f, "\tmovl %d(%%esp), %%eax\n",
 				(i + sarg_ofs) * 4);
 			fprintf(f, "\tpushl %%eax\n");
@@ -161,7 +165,7 @@ static void out_toasm_x86(FILE *f, const char *sym_out,
 static void out_fromasm_x86(FILE *f, const char *sym,
 	const struct parsed_proto *pp)
 {
-	int reg_ofs[ARRAY_SIZE(pp->arg)];
+	int reg_ofs[pp->argc + 1];
 	int sarg_ofs = 1; // stack offset to args, in DWORDs
 	int saved_regs = 0;
 	int ecx_ofs = -1;
@@ -174,8 +178,8 @@ static void out_fromasm_x86(FILE *f, const char *sym,
 
 	argc_repush = pp->argc;
 	stack_args = pp->argc_stack;
-	if (pp->is_vararg) {
-		argc_repush = ARRAY_SIZE(pp->arg); // hopefully enough?
+	if (pp->is_vararg && argc_repush < VARARG_REPUSH) {
+		argc_repush = VARARG_REPUSH;
 		stack_args = argc_repush - pp->argc_reg;
 	}
 
@@ -234,7 +238,7 @@ static void out_fromasm_x86(FILE *f, const char *sym,
 
 	// construct arg stack
 	for (i = argc_repush - 1; i >= 0; i--) {
-		if (pp->arg[i].reg == NULL) {
+		if (i >= pp->argc || pp->arg[i].reg == NULL) {
 			fprintf(f, "\tmovl %d(%%esp), %%ecx\n",
 				(sarg_ofs + stack_args - 1) * 4);
 			fprintf(f, "\tpushl %%ecx\n");
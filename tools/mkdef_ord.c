@@ -12,6 +12,7 @@
 
 #include "my_assert.h"
 #include "my_str.h"
+#include "my_mem.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #define IS(w, y) !strcmp(w, y)
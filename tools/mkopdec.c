@@ -0,0 +1,163 @@
+/*
+ * ia32rtools
+ * (C) notaz, 2013,2014
+ *
+ * This work is licensed under the terms of 3-clause BSD license.
+ * See COPYING file in the top-level directory.
+ */
+
+// generates opdec.h: prefix/opcode/register name lookup
+// as nested switches over name chars, from x86_ops.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "my_assert.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+static const char *prefix_names[] = {
+#define PREFIX(name, flags) name,
+#include "x86_ops.h"
+};
+
+static const char *op_names[] = {
+#define OP(name, op, minopr, maxopr, flags, pfo, pfo_inv) name,
+#include "x86_ops.h"
+};
+
+static const char *reg_names[] = {
+#define REG(name, reg, lmod) name,
+#include "x86_ops.h"
+};
+
+struct name_ent {
+  const char *name;
+  int idx;
+};
+
+static int cmp_names(const void *p1, const void *p2)
+{
+  const struct name_ent *n1 = p1, *n2 = p2;
+  return strcmp(n1->name, n2->name);
+}
+
+static void indent(FILE *f, int level)
+{
+  fprintf(f, "%*s", level * 2, "");
+}
+
+// ents are sorted and share first 'depth' chars
+static void gen_node(FILE *f, const struct name_ent *ents, int cnt,
+  int depth, int level)
+{
+  int i, j;
+
+  if (cnt == 1) {
+    indent(f, level);
+    if (ents[0].name[depth] == 0)
+      fprintf(f, "if (s[%d] == 0)\n", depth);
+    else
+      fprintf(f, "if (!strcmp(s + %d, \"%s\"))\n",
+        depth, ents[0].name + depth);
+    indent(f, level + 1);
+    fprintf(f, "return %d; // %s\n", ents[0].idx, ents[0].name);
+    indent(f, level);
+    fprintf(f, "return -1;\n");
+    return;
+  }
+
+  // common part (first and last differ the most, as sorted)
+  for (i = depth; ents[0].name[i] != 0; i++)
+    if (ents[0].name[i] != ents[cnt - 1].name[i])
+      break;
+  if (i > depth) {
+    indent(f, level);
+    fprintf(f, "if (strncmp(s + %d, \"%.*s\", %d))\n",
+      depth, i - depth, ents[0].name + depth, i - depth);
+    indent(f, level + 1);
+    fprintf(f, "return -1;\n");
+    depth = i;
+  }
+
+  indent(f, level);
+  fprintf(f, "switch (s[%d]) {\n", depth);
+  for (i = 0; i < cnt; i = j) {
+    for (j = i + 1; j < cnt; j++)
+      if (ents[j].name[depth] != ents[i].name[depth])
+        break;
+
+    indent(f, level);
+    if (ents[i].name[depth] == 0) {
+      // sorted, so only one can end here
+      fprintf(f, "case 0:\n");
+      indent(f, level + 1);
+      fprintf(f, "return %d; // %s\n", ents[i].idx, ents[i].name);
+      j = i + 1;
+      continue;
+    }
+
+    fprintf(f, "case '%c':\n", ents[i].name[depth]);
+    gen_node(f, ents + i, j - i, depth + 1, level + 1);
+  }
+  indent(f, level);
+  fprintf(f, "}\n");
+  indent(f, level);
+  fprintf(f, "return -1;\n");
+}
+
+static void gen_func(FILE *f, const char *func, const char *names[],
+  int cnt)
+{
+  struct name_ent *ents;
+  int i;
+
+  ents = malloc(cnt * sizeof(ents[0]));
+  my_assert_not(ents, NULL);
+
+  for (i = 0; i < cnt; i++) {
+    ents[i].name = names[i];
+    ents[i].idx = i;
+  }
+  qsort(ents, cnt, sizeof(ents[0]), cmp_names);
+
+  for (i = 1; i < cnt; i++) {
+    if (!strcmp(ents[i - 1].name, ents[i].name)) {
+      printf("dupe name: '%s'\n", ents[i].name);
+      exit(1);
+    }
+  }
+
+  fprintf(f, "// returns index in the table, -1 if not found\n");
+  fprintf(f, "static int %s(const char *s)\n", func);
+  fprintf(f, "{\n");
+  gen_node(f, ents, cnt, 0, 1);
+  fprintf(f, "}\n\n");
+
+  free(ents);
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fout;
+
+  if (argc != 2) {
+    printf("usage:\n%s <opdec.h>\n", argv[0]);
+    return 1;
+  }
+
+  fout = fopen(argv[1], "w");
+  my_assert_not(fout, NULL);
+
+  fprintf(fout, "// generated by mkopdec from x86_ops.h, do not edit\n\n");
+  gen_func(fout, "opdec_prefix", prefix_names, ARRAY_SIZE(prefix_names));
+  gen_func(fout, "opdec_op", op_names, ARRAY_SIZE(op_names));
+  gen_func(fout, "opdec_reg", reg_names, ARRAY_SIZE(reg_names));
+  fprintf(fout, "// vim:ts=2:shiftwidth=2:expandtab\n");
+
+  fclose(fout);
+  return 0;
+}
+
+// vim:ts=2:shiftwidth=2:expandtab
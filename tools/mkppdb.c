@@ -0,0 +1,86 @@
+/*
+ * ia32rtools
+ * (C) notaz, 2013,2014
+ *
+ * This work is licensed under the terms of 3-clause BSD license.
+ * See COPYING file in the top-level directory.
+ */
+
+// compiles a header and everything it //#include's to <.h>.ppdb,
+// which protoparse.h users then map instead of reading the headers.
+// All protos are parsed, so that errors show up here, and names
+// declared again differently are reported.
+// Optional symbols are looked up and printed, for checking.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "my_assert.h"
+#include "my_str.h"
+#include "my_mem.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+#define IS(w, y) !strcmp(w, y)
+#define IS_START(w, y) !strncmp(w, y, strlen(y))
+
+#include "protoparse.h"
+
+int main(int argc, char *argv[])
+{
+  const struct parsed_proto *pp;
+  char db_path[512];
+  char buf[256];
+  FILE *fhdr;
+  int arg = 1;
+  int bad = 0;
+  int ret;
+  int i;
+
+  if (arg + 1 < argc && IS(argv[arg], "-j")) {
+    pp_jobs = atoi(argv[arg + 1]);
+    arg += 2;
+  }
+  if (arg >= argc) {
+    printf("usage:\n%s [-j <threads>] <.h> [sym ...]\n", argv[0]);
+    return 1;
+  }
+
+  hdrfn = argv[arg++];
+  fhdr = fopen(hdrfn, "r");
+  my_assert_not(fhdr, NULL);
+
+  snprintf(db_path, sizeof(db_path), "%s.ppdb", hdrfn);
+  ret = ppdb_open(db_path);
+  if (ret <= 0) {
+    // a stale database gets rewritten here
+    build_pp_cache(fhdr);
+
+    // users only parse what they look up, check everything
+    for (i = 0; i < pp_db.rec_cnt; i++)
+      if (ppdb_parsed(i) == &pp_bad)
+        bad = 1;
+    if (bad)
+      return 1;
+    ppdb_check_dupes();
+
+    if (ret == 0 && ppdb_write(db_path) != 0)
+      return 1;
+  }
+
+  ret = 0;
+  for (i = arg; i < argc; i++) {
+    pp = proto_parse(fhdr, argv[i], 0);
+    if (pp == NULL) {
+      ret = 1;
+      continue;
+    }
+    pp_print(buf, sizeof(buf), pp);
+    printf("%s\n", buf);
+  }
+
+  fclose(fhdr);
+  return ret;
+}
+
+// vim:ts=2:shiftwidth=2:expandtab
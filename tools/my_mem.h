@@ -0,0 +1,230 @@
+// tracked allocations: live/peak bytes and counts per call site,
+// summed per subsystem, mem_report() prints them.
+// Blocks carry a small header, so memory from mem_*alloc() must be
+// released with mem_free() (and plain malloc'd memory must not be).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum mem_sub {
+	MEM_MISC,
+	MEM_PROTO,	// header parsing, proto db and cache
+	MEM_IR,		// ops, arenas, per function data
+	MEM_LABELS,
+	MEM_CHUNKS,
+	MEM_SYMS,	// interned names, symbol and rename lists
+	MEM_OUTPUT,
+	MEM_SUB_CNT
+};
+
+static const char *mem_sub_names[MEM_SUB_CNT] = {
+	"misc", "proto", "ir", "labels", "chunks", "syms", "output",
+};
+
+struct mem_site {
+	const char *file;
+	int line;
+	enum mem_sub sub;
+	int registered;
+	struct mem_site *next;
+	long long bytes, count;	// live
+	long long peak;
+	long long allocs;	// all time
+};
+
+// 16 bytes on 64bit, keeps malloc's alignment
+struct mem_hdr {
+	struct mem_site *site;
+	size_t size;
+};
+
+static struct {
+	struct mem_site *sites;
+	long long bytes[MEM_SUB_CNT];
+	long long peak[MEM_SUB_CNT];
+	long long bytes_all, peak_all;
+} mem_stats;
+
+#define MEM_SITE(sub) ({ \
+	static struct mem_site mem_site_ = { __FILE__, __LINE__, sub }; \
+	&mem_site_; \
+})
+
+#define mem_malloc(sub, size) \
+	mem_malloc_(MEM_SITE(sub), size)
+#define mem_calloc(sub, n, size) \
+	mem_calloc_(MEM_SITE(sub), n, size)
+#define mem_realloc(sub, p, size) \
+	mem_realloc_(MEM_SITE(sub), p, size)
+#define mem_strdup(sub, s) \
+	mem_strdup_(MEM_SITE(sub), s)
+#define mem_strndup(sub, s, n) \
+	mem_strndup_(MEM_SITE(sub), s, n)
+
+static inline void mem_peak_(long long *peak, long long v)
+{
+	long long old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+	while (v > old && !__atomic_compare_exchange_n(peak, &old, v, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static inline void mem_account_(struct mem_site *site, long long size,
+	int count)
+{
+	long long v;
+	int zero = 0;
+
+	if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE)
+	    && __atomic_compare_exchange_n(&site->registered, &zero, 1, 0,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		site->next = __atomic_load_n(&mem_stats.sites, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&mem_stats.sites, &site->next,
+				site, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	v = __atomic_add_fetch(&site->bytes, size, __ATOMIC_RELAXED);
+	mem_peak_(&site->peak, v);
+	__atomic_add_fetch(&site->count, count, __ATOMIC_RELAXED);
+	if (count > 0)
+		__atomic_add_fetch(&site->allocs, 1, __ATOMIC_RELAXED);
+
+	v = __atomic_add_fetch(&mem_stats.bytes[site->sub], size,
+		__ATOMIC_RELAXED);
+	mem_peak_(&mem_stats.peak[site->sub], v);
+	v = __atomic_add_fetch(&mem_stats.bytes_all, size, __ATOMIC_RELAXED);
+	mem_peak_(&mem_stats.peak_all, v);
+}
+
+static inline void *mem_malloc_(struct mem_site *site, size_t size)
+{
+	struct mem_hdr *h = malloc(sizeof(*h) + size);
+
+	if (h == NULL)
+		return NULL;
+	h->site = site;
+	h->size = size;
+	mem_account_(site, size, 1);
+	return h + 1;
+}
+
+static inline void *mem_calloc_(struct mem_site *site, size_t n,
+	size_t size)
+{
+	void *p;
+
+	if (size != 0 && n > ((size_t)-1 - sizeof(struct mem_hdr)) / size)
+		return NULL;
+	p = mem_malloc_(site, n * size);
+	if (p != NULL)
+		memset(p, 0, n * size);
+	return p;
+}
+
+static inline void mem_free(void *p)
+{
+	struct mem_hdr *h;
+
+	if (p == NULL)
+		return;
+	h = (struct mem_hdr *)p - 1;
+	mem_account_(h->site, -(long long)h->size, -1);
+	free(h);
+}
+
+// a moved block is charged to the realloc site
+static inline void *mem_realloc_(struct mem_site *site, void *p,
+	size_t size)
+{
+	struct mem_hdr *h, *oh;
+
+	if (p == NULL)
+		return mem_malloc_(site, size);
+
+	oh = (struct mem_hdr *)p - 1;
+	h = realloc(oh, sizeof(*h) + size);
+	if (h == NULL)
+		return NULL;
+	mem_account_(h->site, -(long long)h->size, -1);
+	h->site = site;
+	h->size = size;
+	mem_account_(site, size, 1);
+	return h + 1;
+}
+
+static inline char *mem_strndup_(struct mem_site *site, const char *s,
+	size_t n)
+{
+	size_t len = strnlen(s, n);
+	char *p = mem_malloc_(site, len + 1);
+
+	if (p != NULL) {
+		memcpy(p, s, len);
+		p[len] = 0;
+	}
+	return p;
+}
+
+static inline char *mem_strdup_(struct mem_site *site, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = mem_malloc_(site, len);
+
+	return p != NULL ? memcpy(p, s, len) : NULL;
+}
+
+static inline int mem_cmp_sites_(const void *p1, const void *p2)
+{
+	const struct mem_site *s1 = *(struct mem_site * const *)p1;
+	const struct mem_site *s2 = *(struct mem_site * const *)p2;
+
+	if (s1->peak != s2->peak)
+		return s1->peak < s2->peak ? 1 : -1;
+	if (s1->sub != s2->sub)
+		return s1->sub - s2->sub;
+	return s1->line - s2->line;
+}
+
+// subsystem totals, then sites by peak bytes; 'live' at exit is
+// what was never freed
+static inline void mem_report(FILE *f)
+{
+	struct mem_site **sites, *s;
+	const char *file;
+	int i, cnt = 0;
+
+	fprintf(f, "%-12s %10s %8s\n", "memory, kB:", "live", "peak");
+	for (i = 0; i < MEM_SUB_CNT; i++) {
+		if (mem_stats.peak[i] == 0)
+			continue;
+		fprintf(f, "  %-10s %10lld %8lld\n", mem_sub_names[i],
+			mem_stats.bytes[i] >> 10, mem_stats.peak[i] >> 10);
+	}
+	fprintf(f, "  %-10s %10lld %8lld\n", "all",
+		mem_stats.bytes_all >> 10, mem_stats.peak_all >> 10);
+
+	for (s = mem_stats.sites; s != NULL; s = s->next)
+		cnt++;
+	sites = malloc(cnt * sizeof(sites[0]) + 1);
+	if (sites == NULL)
+		return;
+	for (i = 0, s = mem_stats.sites; s != NULL; s = s->next)
+		sites[i++] = s;
+	qsort(sites, cnt, sizeof(sites[0]), mem_cmp_sites_);
+
+	fprintf(f, "%-24s %-7s %10s %8s %10s %10s\n", "site", "subsys",
+		"live kB", "peak kB", "live", "allocs");
+	for (i = 0; i < cnt; i++) {
+		s = sites[i];
+		file = strrchr(s->file, '/');
+		file = file ? file + 1 : s->file;
+		fprintf(f, "%16s:%-7d %-7s %10lld %8lld %10lld %10lld\n",
+			file, s->line, mem_sub_names[s->sub], s->bytes >> 10,
+			s->peak >> 10, s->count, s->allocs);
+	}
+	free(sites);
+}
@@ -0,0 +1,819 @@
+// generated by mkopdec from x86_ops.h, do not edit
+
+// returns index in the table, -1 if not found
+static int opdec_prefix(const char *s)
+{
+  switch (s[0]) {
+  case 'l':
+    if (!strcmp(s + 1, "ock"))
+      return 5; // lock
+    return -1;
+  case 'r':
+    if (strncmp(s + 1, "ep", 2))
+      return -1;
+    switch (s[3]) {
+    case 0:
+      return 0; // rep
+    case 'e':
+      if (s[4] == 0)
+        return 1; // repe
+      return -1;
+    case 'n':
+      switch (s[4]) {
+      case 'e':
+        if (s[5] == 0)
+          return 3; // repne
+        return -1;
+      case 'z':
+        if (s[5] == 0)
+          return 4; // repnz
+        return -1;
+      }
+      return -1;
+    case 'z':
+      if (s[4] == 0)
+        return 2; // repz
+      return -1;
+    }
+    return -1;
+  }
+  return -1;
+}
+
+// returns index in the table, -1 if not found
+static int opdec_op(const char *s)
+{
+  switch (s[0]) {
+  case 'a':
+    switch (s[1]) {
+    case 'd':
+      switch (s[2]) {
+      case 'c':
+        if (s[3] == 0)
+          return 42; // adc
+        return -1;
+      case 'd':
+        if (s[3] == 0)
+          return 28; // add
+        return -1;
+      }
+      return -1;
+    case 'n':
+      if (!strcmp(s + 2, "d"))
+        return 30; // and
+      return -1;
+    }
+    return -1;
+  case 'b':
+    if (!strcmp(s + 1, "sf"))
+      return 44; // bsf
+    return -1;
+  case 'c':
+    switch (s[1]) {
+    case 'a':
+      if (!strcmp(s + 2, "ll"))
+        return 55; // call
+      return -1;
+    case 'd':
+      if (!strcmp(s + 2, "q"))
+        return 10; // cdq
+      return -1;
+    case 'l':
+      if (!strcmp(s + 2, "d"))
+        return 27; // cld
+      return -1;
+    case 'm':
+      if (strncmp(s + 2, "p", 1))
+        return -1;
+      switch (s[3]) {
+      case 0:
+        return 53; // cmp
+      case 's':
+        switch (s[4]) {
+        case 'b':
+          if (s[5] == 0)
+            return 20; // cmpsb
+          return -1;
+        case 'd':
+          if (s[5] == 0)
+            return 22; // cmpsd
+          return -1;
+        case 'w':
+          if (s[5] == 0)
+            return 21; // cmpsw
+          return -1;
+        }
+        return -1;
+      }
+      return -1;
+    }
+    return -1;
+  case 'd':
+    switch (s[1]) {
+    case 'e':
+      if (!strcmp(s + 2, "c"))
+        return 46; // dec
+      return -1;
+    case 'i':
+      if (!strcmp(s + 2, "v"))
+        return 50; // div
+      return -1;
+    }
+    return -1;
+  case 'i':
+    switch (s[1]) {
+    case 'd':
+      if (!strcmp(s + 2, "iv"))
+        return 51; // idiv
+      return -1;
+    case 'm':
+      if (!strcmp(s + 2, "ul"))
+        return 49; // imul
+      return -1;
+    case 'n':
+      if (!strcmp(s + 2, "c"))
+        return 45; // inc
+      return -1;
+    }
+    return -1;
+  case 'j':
+    switch (s[1]) {
+    case 'a':
+      switch (s[2]) {
+      case 0:
+        return 71; // ja
+      case 'e':
+        if (s[3] == 0)
+          return 64; // jae
+        return -1;
+      }
+      return -1;
+    case 'b':
+      switch (s[2]) {
+      case 0:
+        return 61; // jb
+      case 'e':
+        if (s[3] == 0)
+          return 69; // jbe
+        return -1;
+      }
+      return -1;
+    case 'c':
+      if (s[2] == 0)
+        return 60; // jc
+      return -1;
+    case 'e':
+      switch (s[2]) {
+      case 0:
+        return 66; // je
+      case 'c':
+        if (!strcmp(s + 3, "xz"))
+          return 57; // jecxz
+        return -1;
+      }
+      return -1;
+    case 'g':
+      switch (s[2]) {
+      case 0:
+        return 85; // jg
+      case 'e':
+        if (s[3] == 0)
+          return 81; // jge
+        return -1;
+      }
+      return -1;
+    case 'l':
+      switch (s[2]) {
+      case 0:
+        return 79; // jl
+      case 'e':
+        if (s[3] == 0)
+          return 83; // jle
+        return -1;
+      }
+      return -1;
+    case 'm':
+      if (!strcmp(s + 2, "p"))
+        return 56; // jmp
+      return -1;
+    case 'n':
+      switch (s[2]) {
+      case 'a':
+        if (s[3] == 0)
+          return 70; // jna
+        return -1;
+      case 'b':
+        switch (s[3]) {
+        case 0:
+          return 63; // jnb
+        case 'e':
+          if (s[4] == 0)
+            return 72; // jnbe
+          return -1;
+        }
+        return -1;
+      case 'c':
+        if (s[3] == 0)
+          return 62; // jnc
+        return -1;
+      case 'e':
+        if (s[3] == 0)
+          return 68; // jne
+        return -1;
+      case 'g':
+        switch (s[3]) {
+        case 0:
+          return 84; // jng
+        case 'e':
+          if (s[4] == 0)
+            return 80; // jnge
+          return -1;
+        }
+        return -1;
+      case 'l':
+        switch (s[3]) {
+        case 0:
+          return 82; // jnl
+        case 'e':
+          if (s[4] == 0)
+            return 86; // jnle
+          return -1;
+        }
+        return -1;
+      case 'o':
+        if (s[3] == 0)
+          return 59; // jno
+        return -1;
+      case 'p':
+        if (s[3] == 0)
+          return 77; // jnp
+        return -1;
+      case 's':
+        if (s[3] == 0)
+          return 74; // jns
+        return -1;
+      case 'z':
+        if (s[3] == 0)
+          return 67; // jnz
+        return -1;
+      }
+      return -1;
+    case 'o':
+      if (s[2] == 0)
+        return 58; // jo
+      return -1;
+    case 'p':
+      switch (s[2]) {
+      case 0:
+        return 75; // jp
+      case 'e':
+        if (s[3] == 0)
+          return 76; // jpe
+        return -1;
+      case 'o':
+        if (s[3] == 0)
+          return 78; // jpo
+        return -1;
+      }
+      return -1;
+    case 's':
+      if (s[2] == 0)
+        return 73; // js
+      return -1;
+    case 'z':
+      if (s[2] == 0)
+        return 65; // jz
+      return -1;
+    }
+    return -1;
+  case 'l':
+    switch (s[1]) {
+    case 'e':
+      if (strncmp(s + 2, "a", 1))
+        return -1;
+      switch (s[3]) {
+      case 0:
+        return 5; // lea
+      case 'v':
+        if (!strcmp(s + 4, "e"))
+          return 3; // leave
+        return -1;
+      }
+      return -1;
+    case 'o':
+      if (strncmp(s + 2, "ds", 2))
+        return -1;
+      switch (s[4]) {
+      case 'b':
+        if (s[5] == 0)
+          return 11; // lodsb
+        return -1;
+      case 'd':
+        if (s[5] == 0)
+          return 13; // lodsd
+        return -1;
+      case 'w':
+        if (s[5] == 0)
+          return 12; // lodsw
+        return -1;
+      }
+      return -1;
+    }
+    return -1;
+  case 'm':
+    switch (s[1]) {
+    case 'o':
+      if (strncmp(s + 2, "v", 1))
+        return -1;
+      switch (s[3]) {
+      case 0:
+        return 4; // mov
+      case 's':
+        switch (s[4]) {
+        case 'b':
+          if (s[5] == 0)
+            return 17; // movsb
+          return -1;
+        case 'd':
+          if (s[5] == 0)
+            return 19; // movsd
+          return -1;
+        case 'w':
+          if (s[5] == 0)
+            return 18; // movsw
+          return -1;
+        case 'x':
+          if (s[5] == 0)
+            return 7; // movsx
+          return -1;
+        }
+        return -1;
+      case 'z':
+        if (!strcmp(s + 4, "x"))
+          return 6; // movzx
+        return -1;
+      }
+      return -1;
+    case 'u':
+      if (!strcmp(s + 2, "l"))
+        return 48; // mul
+      return -1;
+    }
+    return -1;
+  case 'n':
+    switch (s[1]) {
+    case 'e':
+      if (!strcmp(s + 2, "g"))
+        return 47; // neg
+      return -1;
+    case 'o':
+      switch (s[2]) {
+      case 'p':
+        if (s[3] == 0)
+          return 0; // nop
+        return -1;
+      case 't':
+        if (s[3] == 0)
+          return 9; // not
+        return -1;
+      }
+      return -1;
+    }
+    return -1;
+  case 'o':
+    if (!strcmp(s + 1, "r"))
+      return 31; // or
+    return -1;
+  case 'p':
+    switch (s[1]) {
+    case 'o':
+      if (!strcmp(s + 2, "p"))
+        return 2; // pop
+      return -1;
+    case 'u':
+      if (!strcmp(s + 2, "sh"))
+        return 1; // push
+      return -1;
+    }
+    return -1;
+  case 'r':
+    switch (s[1]) {
+    case 'c':
+      switch (s[2]) {
+      case 'l':
+        if (s[3] == 0)
+          return 40; // rcl
+        return -1;
+      case 'r':
+        if (s[3] == 0)
+          return 41; // rcr
+        return -1;
+      }
+      return -1;
+    case 'e':
+      if (!strcmp(s + 2, "tn"))
+        return 54; // retn
+      return -1;
+    case 'o':
+      switch (s[2]) {
+      case 'l':
+        if (s[3] == 0)
+          return 38; // rol
+        return -1;
+      case 'r':
+        if (s[3] == 0)
+          return 39; // ror
+        return -1;
+      }
+      return -1;
+    }
+    return -1;
+  case 's':
+    switch (s[1]) {
+    case 'a':
+      switch (s[2]) {
+      case 'l':
+        if (s[3] == 0)
+          return 35; // sal
+        return -1;
+      case 'r':
+        if (s[3] == 0)
+          return 36; // sar
+        return -1;
+      }
+      return -1;
+    case 'b':
+      if (!strcmp(s + 2, "b"))
+        return 43; // sbb
+      return -1;
+    case 'c':
+      if (strncmp(s + 2, "as", 2))
+        return -1;
+      switch (s[4]) {
+      case 'b':
+        if (s[5] == 0)
+          return 23; // scasb
+        return -1;
+      case 'd':
+        if (s[5] == 0)
+          return 25; // scasd
+        return -1;
+      case 'w':
+        if (s[5] == 0)
+          return 24; // scasw
+        return -1;
+      }
+      return -1;
+    case 'e':
+      if (strncmp(s + 2, "t", 1))
+        return -1;
+      switch (s[3]) {
+      case 'a':
+        switch (s[4]) {
+        case 0:
+          return 100; // seta
+        case 'e':
+          if (s[5] == 0)
+            return 92; // setae
+          return -1;
+        }
+        return -1;
+      case 'b':
+        switch (s[4]) {
+        case 0:
+          return 90; // setb
+        case 'e':
+          if (s[5] == 0)
+            return 98; // setbe
+          return -1;
+        }
+        return -1;
+      case 'c':
+        if (s[4] == 0)
+          return 89; // setc
+        return -1;
+      case 'e':
+        if (s[4] == 0)
+          return 95; // sete
+        return -1;
+      case 'g':
+        switch (s[4]) {
+        case 0:
+          return 114; // setg
+        case 'e':
+          if (s[5] == 0)
+            return 110; // setge
+          return -1;
+        }
+        return -1;
+      case 'l':
+        switch (s[4]) {
+        case 0:
+          return 108; // setl
+        case 'e':
+          if (s[5] == 0)
+            return 112; // setle
+          return -1;
+        }
+        return -1;
+      case 'n':
+        switch (s[4]) {
+        case 'a':
+          if (s[5] == 0)
+            return 99; // setna
+          return -1;
+        case 'b':
+          switch (s[5]) {
+          case 0:
+            return 93; // setnb
+          case 'e':
+            if (s[6] == 0)
+              return 101; // setnbe
+            return -1;
+          }
+          return -1;
+        case 'c':
+          if (s[5] == 0)
+            return 91; // setnc
+          return -1;
+        case 'e':
+          if (s[5] == 0)
+            return 97; // setne
+          return -1;
+        case 'g':
+          switch (s[5]) {
+          case 0:
+            return 113; // setng
+          case 'e':
+            if (s[6] == 0)
+              return 109; // setnge
+            return -1;
+          }
+          return -1;
+        case 'l':
+          switch (s[5]) {
+          case 0:
+            return 111; // setnl
+          case 'e':
+            if (s[6] == 0)
+              return 115; // setnle
+            return -1;
+          }
+          return -1;
+        case 'o':
+          if (s[5] == 0)
+            return 88; // setno
+          return -1;
+        case 'p':
+          if (s[5] == 0)
+            return 106; // setnp
+          return -1;
+        case 's':
+          if (s[5] == 0)
+            return 103; // setns
+          return -1;
+        case 'z':
+          if (s[5] == 0)
+            return 96; // setnz
+          return -1;
+        }
+        return -1;
+      case 'o':
+        if (s[4] == 0)
+          return 87; // seto
+        return -1;
+      case 'p':
+        switch (s[4]) {
+        case 0:
+          return 104; // setp
+        case 'e':
+          if (s[5] == 0)
+            return 105; // setpe
+          return -1;
+        case 'o':
+          if (s[5] == 0)
+            return 107; // setpo
+          return -1;
+        }
+        return -1;
+      case 's':
+        if (s[4] == 0)
+          return 102; // sets
+        return -1;
+      case 'z':
+        if (s[4] == 0)
+          return 94; // setz
+        return -1;
+      }
+      return -1;
+    case 'h':
+      switch (s[2]) {
+      case 'l':
+        if (s[3] == 0)
+          return 33; // shl
+        return -1;
+      case 'r':
+        switch (s[3]) {
+        case 0:
+          return 34; // shr
+        case 'd':
+          if (s[4] == 0)
+            return 37; // shrd
+          return -1;
+        }
+        return -1;
+      }
+      return -1;
+    case 't':
+      switch (s[2]) {
+      case 'd':
+        if (s[3] == 0)
+          return 26; // std
+        return -1;
+      case 'o':
+        if (strncmp(s + 3, "s", 1))
+          return -1;
+        switch (s[4]) {
+        case 'b':
+          if (s[5] == 0)
+            return 14; // stosb
+          return -1;
+        case 'd':
+          if (s[5] == 0)
+            return 16; // stosd
+          return -1;
+        case 'w':
+          if (s[5] == 0)
+            return 15; // stosw
+          return -1;
+        }
+        return -1;
+      }
+      return -1;
+    case 'u':
+      if (!strcmp(s + 2, "b"))
+        return 29; // sub
+      return -1;
+    }
+    return -1;
+  case 't':
+    if (!strcmp(s + 1, "est"))
+      return 52; // test
+    return -1;
+  case 'x':
+    switch (s[1]) {
+    case 'c':
+      if (!strcmp(s + 2, "hg"))
+        return 8; // xchg
+      return -1;
+    case 'o':
+      if (!strcmp(s + 2, "r"))
+        return 32; // xor
+      return -1;
+    }
+    return -1;
+  }
+  return -1;
+}
+
+// returns index in the table, -1 if not found
+static int opdec_reg(const char *s)
+{
+  switch (s[0]) {
+  case 'a':
+    switch (s[1]) {
+    case 'h':
+      if (s[2] == 0)
+        return 16; // ah
+      return -1;
+    case 'l':
+      if (s[2] == 0)
+        return 20; // al
+      return -1;
+    case 'x':
+      if (s[2] == 0)
+        return 8; // ax
+      return -1;
+    }
+    return -1;
+  case 'b':
+    switch (s[1]) {
+    case 'h':
+      if (s[2] == 0)
+        return 17; // bh
+      return -1;
+    case 'l':
+      if (s[2] == 0)
+        return 21; // bl
+      return -1;
+    case 'p':
+      if (s[2] == 0)
+        return 14; // bp
+      return -1;
+    case 'x':
+      if (s[2] == 0)
+        return 9; // bx
+      return -1;
+    }
+    return -1;
+  case 'c':
+    switch (s[1]) {
+    case 'h':
+      if (s[2] == 0)
+        return 18; // ch
+      return -1;
+    case 'l':
+      if (s[2] == 0)
+        return 22; // cl
+      return -1;
+    case 'x':
+      if (s[2] == 0)
+        return 10; // cx
+      return -1;
+    }
+    return -1;
+  case 'd':
+    switch (s[1]) {
+    case 'h':
+      if (s[2] == 0)
+        return 19; // dh
+      return -1;
+    case 'i':
+      if (s[2] == 0)
+        return 13; // di
+      return -1;
+    case 'l':
+      if (s[2] == 0)
+        return 23; // dl
+      return -1;
+    case 'x':
+      if (s[2] == 0)
+        return 11; // dx
+      return -1;
+    }
+    return -1;
+  case 'e':
+    switch (s[1]) {
+    case 'a':
+      if (!strcmp(s + 2, "x"))
+        return 0; // eax
+      return -1;
+    case 'b':
+      switch (s[2]) {
+      case 'p':
+        if (s[3] == 0)
+          return 6; // ebp
+        return -1;
+      case 'x':
+        if (s[3] == 0)
+          return 1; // ebx
+        return -1;
+      }
+      return -1;
+    case 'c':
+      if (!strcmp(s + 2, "x"))
+        return 2; // ecx
+      return -1;
+    case 'd':
+      switch (s[2]) {
+      case 'i':
+        if (s[3] == 0)
+          return 5; // edi
+        return -1;
+      case 'x':
+        if (s[3] == 0)
+          return 3; // edx
+        return -1;
+      }
+      return -1;
+    case 's':
+      switch (s[2]) {
+      case 'i':
+        if (s[3] == 0)
+          return 4; // esi
+        return -1;
+      case 'p':
+        if (s[3] == 0)
+          return 7; // esp
+        return -1;
+      }
+      return -1;
+    }
+    return -1;
+  case 's':
+    switch (s[1]) {
+    case 'i':
+      if (s[2] == 0)
+        return 12; // si
+      return -1;
+    case 'p':
+      if (s[2] == 0)
+        return 15; // sp
+      return -1;
+    }
+    return -1;
+  }
+  return -1;
+}
+
+// vim:ts=2:shiftwidth=2:expandtab
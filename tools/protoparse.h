@@ -6,6 +6,25 @@
  * See COPYING file in the top-level directory.
  */
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// where messages go, users may override
+#ifndef pp_msgf
+#define pp_msgf stdout
+#endif
+
+// header reading threads collect messages of their own,
+// printed later in include order
+static __thread FILE *pp_hf_msgf;
+#define pp_msgout (pp_hf_msgf != NULL ? pp_hf_msgf : pp_msgf)
+
+// users may also define pp_lookup_hook(name, len, pp)
+// to see every proto_parse() result
+
 struct parsed_proto;
 
 struct parsed_type {
@@ -21,16 +40,15 @@ struct parsed_proto_arg {
 	char *reg;
 	struct parsed_type type;
 	struct parsed_proto *fptr;
-	void *datap;
 };
 
 struct parsed_proto {
-	char name[256];
+	char *name;
 	union {
 		struct parsed_type ret_type;
 		struct parsed_type type;
 	};
-	struct parsed_proto_arg arg[16];
+	struct parsed_proto_arg *arg; // argc of them
 	int argc;
 	int argc_stack;
 	int argc_reg;
@@ -46,88 +64,20 @@ struct parsed_proto {
 	unsigned int is_arg:1;        // declared in some func arg
 	unsigned int has_structarg:1;
 	unsigned int has_retreg:1;
+	unsigned int src_hash;        // of the header line, header protos only
 };
 
 static const char *hdrfn;
-static int hdrfline = 0;
+// where the proto being parsed comes from, for messages
+static __thread const char *pp_srcfn;
+static __thread int hdrfline = 0;
+static int pp_jobs = 1; // header reading threads, users may set
 
 static void pp_copy_arg(struct parsed_proto_arg *d,
 	const struct parsed_proto_arg *s);
 
-static int b_pp_c_handler(char *proto, const char *fname, int is_oslib);
-
-static int do_protostrs(FILE *fhdr, const char *fname)
-{
-	const char *finc_name;
-	const char *hdrfn_saved;
-	char protostr[256];
-	char path[256];
-	char fname_inc[256];
-	int is_oslib;
-	FILE *finc;
-	int line = 0;
-	int ret;
-	char *p;
-
-	hdrfn_saved = hdrfn;
-	hdrfn = fname;
-
-	is_oslib = strstr(fname, "stdc.hlist")
-		 || strstr(fname, "win32.hlist");
-
-	while (fgets(protostr, sizeof(protostr), fhdr))
-	{
-		line++;
-		if (strncmp(protostr, "//#include ", 11) == 0) {
-			finc_name = protostr + 11;
-			p = strpbrk(finc_name, "\r\n ");
-			if (p != NULL)
-				*p = 0;
-
-			path[0] = 0;
-			p = strrchr(hdrfn_saved, '/');
-			if (p) {
-				memcpy(path, hdrfn_saved,
-					p - hdrfn_saved + 1);
-				path[p - hdrfn_saved + 1] = 0;
-			}
-			snprintf(fname_inc, sizeof(fname_inc), "%s%s", 
-				path, finc_name);
-			finc = fopen(fname_inc, "r");
-			if (finc == NULL) {
-				printf("%s:%d: can't open '%s'\n",
-					fname_inc, line, finc_name);
-				continue;
-			}
-			ret = do_protostrs(finc, finc_name);
-			fclose(finc);
-			if (ret < 0)
-				break;
-			continue;
-		}
-		if (strncmp(sskip(protostr), "//", 2) == 0)
-			continue;
-
-		p = protostr + strlen(protostr);
-		for (p--; p >= protostr && my_isblank(*p); --p)
-			*p = 0;
-		if (p < protostr)
-			continue;
-
-		hdrfline = line;
-
-		ret = b_pp_c_handler(protostr, hdrfn, is_oslib);
-		if (ret < 0)
-			break;
-	}
-
-	hdrfn = hdrfn_saved;
-
-	if (feof(fhdr))
-		return 0;
-
-	return -1;
-}
+static inline void proto_release(struct parsed_proto *pp);
+struct parsed_proto *proto_clone(const struct parsed_proto *pp_c);
 
 static int get_regparm(char *dst, size_t dlen, char *p, int *retreg)
 {
@@ -292,7 +242,7 @@ static int check_type(const char *name, struct parsed_type *type)
 	}
 
 	ret = n1 - name;
-	type->name = strndup(name, ret);
+	type->name = mem_strndup(MEM_PROTO, name, ret);
 	if (IS(type->name, "__VALIST") || IS(type->name, "va_list"))
 		type->is_va_list = 1;
 	if (IS(type->name, "VOID"))
@@ -328,21 +278,42 @@ static int check_struct_arg(struct parsed_proto_arg *arg)
 	return 0;
 }
 
-static int parse_protostr(char *protostr, struct parsed_proto *pp)
+// cleared pp->arg[i], growing the array as needed
+static struct parsed_proto_arg *pp_arg_slot(struct parsed_proto *pp,
+	int i, int *alloc)
+{
+	if (i >= *alloc) {
+		*alloc = *alloc * 2 + 8;
+		pp->arg = mem_realloc(MEM_PROTO, pp->arg,
+			*alloc * sizeof(pp->arg[0]));
+		my_assert_not(pp->arg, NULL);
+	}
+	memset(&pp->arg[i], 0, sizeof(pp->arg[i]));
+	// cover every slot, a failed parse is released by argc
+	if (i >= pp->argc)
+		pp->argc = i + 1;
+	return &pp->arg[i];
+}
+
+// name_only: stop once the name is known, rest is left unparsed
+static int do_parse_protostr(char *protostr, struct parsed_proto *pp,
+	int name_only)
 {
 	struct parsed_proto_arg *arg;
 	char regparm[16];
 	char buf[256];
 	char cconv[32];
+	int arg_alloc = 0;
 	int is_retreg;
 	int xarg = 0;
+	int a;
 	char *p, *p1;
 	int i, l;
 	int ret;
 
 	p = sskip(protostr);
 	if (p[0] == '/' && p[1] == '/') {
-		printf("%s:%d: commented out?\n", hdrfn, hdrfline);
+		fprintf(pp_msgout, "%s:%d: commented out?\n", pp_srcfn, hdrfline);
 		p = sskip(p + 2);
 	}
 
@@ -366,8 +337,8 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 
 	ret = check_type(p, &pp->ret_type);
 	if (ret <= 0) {
-		printf("%s:%d:%zd: unhandled return in '%s'\n",
-			hdrfn, hdrfline, (p - protostr) + 1, protostr);
+		fprintf(pp_msgout, "%s:%d:%zd: unhandled return in '%s'\n",
+			pp_srcfn, hdrfline, (p - protostr) + 1, protostr);
 		return -1;
 	}
 	p = sskip(p + ret);
@@ -381,11 +352,11 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 		p = next_idt(buf, sizeof(buf), p);
 		p = sskip(p);
 		if (buf[0] == 0) {
-			printf("%s:%d:%zd: var name missing\n",
-				hdrfn, hdrfline, (p - protostr) + 1);
+			fprintf(pp_msgout, "%s:%d:%zd: var name missing\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1);
 			return -1;
 		}
-		strcpy(pp->name, buf);
+		pp->name = mem_strdup(MEM_PROTO, buf);
 
 		p1 = strchr(p, ']');
 		if (p1 != NULL) {
@@ -405,8 +376,8 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 	p = next_word(cconv, sizeof(cconv), p);
 	p = sskip(p);
 	if (cconv[0] == 0) {
-		printf("%s:%d:%zd: cconv missing\n",
-			hdrfn, hdrfline, (p - protostr) + 1);
+		fprintf(pp_msgout, "%s:%d:%zd: cconv missing\n",
+			pp_srcfn, hdrfline, (p - protostr) + 1);
 		return -1;
 	}
 	if      (IS(cconv, "__cdecl"))
@@ -430,15 +401,15 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 	else if (IS(cconv, "WINAPI"))
 		pp->is_stdcall = 1;
 	else {
-		printf("%s:%d:%zd: unhandled cconv: '%s'\n",
-			hdrfn, hdrfline, (p - protostr) + 1, cconv);
+		fprintf(pp_msgout, "%s:%d:%zd: unhandled cconv: '%s'\n",
+			pp_srcfn, hdrfline, (p - protostr) + 1, cconv);
 		return -1;
 	}
 
 	if (pp->is_fptr) {
 		if (*p != '*') {
-			printf("%s:%d:%zd: '*' expected\n",
-				hdrfn, hdrfline, (p - protostr) + 1);
+			fprintf(pp_msgout, "%s:%d:%zd: '*' expected\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1);
 			return -1;
 		}
 		p++;
@@ -451,19 +422,21 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 	p = next_idt(buf, sizeof(buf), p);
 	p = sskip(p);
 	if (buf[0] == 0) {
-		//printf("%s:%d:%zd: func name missing\n",
-		//	hdrfn, hdrfline, (p - protostr) + 1);
+		//fprintf(pp_msgout, "%s:%d:%zd: func name missing\n",
+		//	pp_srcfn, hdrfline, (p - protostr) + 1);
 		//return -1;
 	}
-	strcpy(pp->name, buf);
+	pp->name = mem_strdup(MEM_PROTO, buf);
+	if (name_only)
+		return p - protostr;
 
 	ret = get_regparm(regparm, sizeof(regparm), p, &is_retreg);
 	if (ret > 0) {
 		if (!IS(regparm, "eax") && !IS(regparm, "ax")
 		 && !IS(regparm, "al") && !IS(regparm, "edx:eax"))
 		{
-			printf("%s:%d:%zd: bad regparm: %s\n",
-				hdrfn, hdrfline, (p - protostr) + 1, regparm);
+			fprintf(pp_msgout, "%s:%d:%zd: bad regparm: %s\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1, regparm);
 			return -1;
 		}
 		p += ret;
@@ -476,23 +449,23 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 			pp->ret_type.is_array = 1;
 			p = strchr(p + 1, ']');
 			if (p == NULL) {
-				printf("%s:%d:%zd: ']' expected\n",
-				 hdrfn, hdrfline, (p - protostr) + 1);
+				fprintf(pp_msgout, "%s:%d:%zd: ']' expected\n",
+				 pp_srcfn, hdrfline, (p - protostr) + 1);
 				return -1;
 			}
 			p = sskip(p + 1);
 		}
 		if (*p != ')') {
-			printf("%s:%d:%zd: ')' expected\n",
-				hdrfn, hdrfline, (p - protostr) + 1);
+			fprintf(pp_msgout, "%s:%d:%zd: ')' expected\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1);
 			return -1;
 		}
 		p = sskip(p + 1);
 	}
 
 	if (*p != '(') {
-		printf("%s:%d:%zd: '(' expected, got '%c'\n",
-				hdrfn, hdrfline, (p - protostr) + 1, *p);
+		fprintf(pp_msgout, "%s:%d:%zd: '(' expected, got '%c'\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1, *p);
 		return -1;
 	}
 	p++;
@@ -511,8 +484,8 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 		}
 		if (xarg > 0) {
 			if (*p != ',') {
-				printf("%s:%d:%zd: ',' expected\n",
-				 hdrfn, hdrfline, (p - protostr) + 1);
+				fprintf(pp_msgout, "%s:%d:%zd: ',' expected\n",
+				 pp_srcfn, hdrfline, (p - protostr) + 1);
 				return -1;
 			}
 			p = sskip(p + 1);
@@ -525,38 +498,41 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 				p++;
 				break;
 			}
-			printf("%s:%d:%zd: ')' expected\n",
-				hdrfn, hdrfline, (p - protostr) + 1);
+			fprintf(pp_msgout, "%s:%d:%zd: ')' expected\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1);
 			return -1;
 		}
 
-		arg = &pp->arg[xarg];
+		a = xarg;
+		arg = pp_arg_slot(pp, xarg, &arg_alloc);
 		xarg++;
 
 		p1 = p;
 		ret = check_type(p, &arg->type);
 		if (ret <= 0) {
-			printf("%s:%d:%zd: unhandled type for arg%d\n",
-				hdrfn, hdrfline, (p - protostr) + 1, xarg);
+			fprintf(pp_msgout, "%s:%d:%zd: unhandled type for arg%d\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1, xarg);
 			return -1;
 		}
 		p = sskip(p + ret);
 
 		if (*p == '(') {
 			// func ptr
-			arg->fptr = calloc(1, sizeof(*arg->fptr));
-			ret = parse_protostr(p1, arg->fptr);
+			arg->fptr = mem_calloc(MEM_PROTO, 1, sizeof(*arg->fptr));
+			ret = do_parse_protostr(p1, arg->fptr, 0);
 			if (ret < 0) {
-				printf("%s:%d:%zd: funcarg parse failed\n",
-					hdrfn, hdrfline, p1 - protostr);
+				fprintf(pp_msgout, "%s:%d:%zd: funcarg parse failed\n",
+					pp_srcfn, hdrfline, p1 - protostr);
 				return -1;
 			}
 			arg->fptr->is_arg = 1;
 			// we don't use actual names right now..
-			snprintf(arg->fptr->name,
-				sizeof(arg->fptr->name), "a%d", xarg);
+			mem_free(arg->fptr->name);
+			snprintf(buf, sizeof(buf), "a%d", xarg);
+			arg->fptr->name = mem_strdup(MEM_PROTO, buf);
 			// we'll treat it as void * for non-calls
-			arg->type.name = strdup("void *");
+			mem_free(arg->type.name);
+			arg->type.name = mem_strdup(MEM_PROTO, "void *");
 			arg->type.is_ptr = 1;
 
 			p = p1 + ret;
@@ -566,8 +542,8 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 		p = sskip(p);
 #if 0
 		if (buf[0] == 0) {
-			printf("%s:%d:%zd: idt missing for arg%d\n",
-				hdrfn, hdrfline, (p - protostr) + 1, xarg);
+			fprintf(pp_msgout, "%s:%d:%zd: idt missing for arg%d\n",
+				pp_srcfn, hdrfline, (p - protostr) + 1, xarg);
 			return -1;
 		}
 #endif
@@ -578,7 +554,7 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 			p += ret;
 			p = sskip(p);
 
-			arg->reg = strdup(map_reg(regparm));
+			arg->reg = mem_strdup(MEM_PROTO, map_reg(regparm));
 			arg->type.is_retreg = is_retreg;
 			pp->has_retreg |= is_retreg;
 		}
@@ -587,8 +563,10 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 		    || IS(arg->type.name, "double"))
 		{
 			// hack..
-			free(arg->type.name);
-			arg->type.name = strdup("int");
+			mem_free(arg->type.name);
+			arg->type.name = mem_strdup(MEM_PROTO, "int");
+			pp_arg_slot(pp, xarg, &arg_alloc);
+			arg = &pp->arg[a];
 			pp_copy_arg(&pp->arg[xarg], arg);
 			xarg++;
 		}
@@ -597,29 +575,38 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 		if (ret > 0) {
 			pp->has_structarg = 1;
 			arg->type.is_struct = 1;
-			free(arg->type.name);
-			arg->type.name = strdup("int");
+			mem_free(arg->type.name);
+			arg->type.name = mem_strdup(MEM_PROTO, "int");
 			for (l = 0; l < ret; l++) {
+				pp_arg_slot(pp, xarg, &arg_alloc);
+				arg = &pp->arg[a];
 				pp_copy_arg(&pp->arg[xarg], arg);
 				xarg++;
 			}
 		}
 	}
 
+	// exact size from now on
+	if (xarg > 0 && xarg < arg_alloc) {
+		pp->arg = mem_realloc(MEM_PROTO, pp->arg,
+			xarg * sizeof(pp->arg[0]));
+		my_assert_not(pp->arg, NULL);
+	}
+
 	if (xarg > 0 && (IS(cconv, "__fastcall") || IS(cconv, "__thiscall"))) {
 		if (pp->arg[0].reg != NULL) {
-			printf("%s:%d: %s with arg1 spec %s?\n",
-				hdrfn, hdrfline, cconv, pp->arg[0].reg);
+			fprintf(pp_msgout, "%s:%d: %s with arg1 spec %s?\n",
+				pp_srcfn, hdrfline, cconv, pp->arg[0].reg);
 		}
-		pp->arg[0].reg = strdup("ecx");
+		pp->arg[0].reg = mem_strdup(MEM_PROTO, "ecx");
 	}
 
 	if (xarg > 1 && IS(cconv, "__fastcall")) {
 		if (pp->arg[1].reg != NULL) {
-			printf("%s:%d: %s with arg2 spec %s?\n",
-				hdrfn, hdrfline, cconv, pp->arg[1].reg);
+			fprintf(pp_msgout, "%s:%d: %s with arg2 spec %s?\n",
+				pp_srcfn, hdrfline, cconv, pp->arg[1].reg);
 		}
-		pp->arg[1].reg = strdup("edx");
+		pp->arg[1].reg = mem_strdup(MEM_PROTO, "edx");
 	}
 
 	pp->argc = xarg;
@@ -644,86 +631,924 @@ static int parse_protostr(char *protostr, struct parsed_proto *pp)
 	}
 
 	if (pp->is_vararg && (pp->is_stdcall || pp->is_fastcall)) {
-		printf("%s:%d: vararg %s?\n", hdrfn, hdrfline, cconv);
+		fprintf(pp_msgout, "%s:%d: vararg %s?\n", pp_srcfn, hdrfline, cconv);
 		return -1;
 	}
 
 	return p - protostr;
 }
 
-static int pp_name_cmp(const void *p1, const void *p2)
+static int parse_protostr(char *protostr, struct parsed_proto *pp)
+{
+	return do_parse_protostr(protostr, pp, 0);
+}
+
+// header database: name and text of every proto, which header file
+// and line it came from, and a name hash index.  Built from the
+// headers, or mapped from <header>.ppdb written by mkppdb.  Reading
+// the headers only gets the names, protos are fully parsed when
+// first looked up.  A stale database (some header changed) is
+// rebuilt in place.
+#define PPDB_MAGIC   0x42445050 // "PPDB"
+#define PPDB_VERSION 2
+
+struct ppdb_hdr {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int file_cnt;
+	unsigned int rec_cnt;
+	unsigned int idx_size;        // power of 2
+	unsigned int pool_size;
+};
+
+struct ppdb_file {
+	unsigned int path;            // pool offsets, path is relative
+	                              // to the top header's dir
+	unsigned int name;
+	long long mtime_s;
+	long long mtime_ns;
+	long long size;
+	unsigned long long hash;      // of contents
+};
+
+struct ppdb_rec {
+	unsigned int name;            // pool offsets
+	unsigned int text;
+	unsigned int file;
+	unsigned int line;
+	unsigned int src_hash;
+	unsigned int is_oslib;
+};
+
+// file layout: hdr, files, recs, idx (rec + 1, 0 is empty), pool
+static struct {
+	struct ppdb_file *files;
+	struct ppdb_rec *recs;
+	unsigned int *idx;
+	char *pool;
+	unsigned int file_cnt, file_alloc;
+	unsigned int rec_cnt, rec_alloc;
+	unsigned int idx_size;
+	unsigned int pool_size, pool_alloc;
+	struct parsed_proto **parsed;
+	void *map;                    // if mapped, all above is read-only
+	size_t map_size;
+} pp_db;
+
+
+static unsigned long long pp_hash64(unsigned long long h,
+	const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	return h;
+}
+
+#define PP_HASH64_INIT 0xcbf29ce484222325ull
+
+static unsigned int pp_name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *name != 0; name++)
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	return h;
+}
+
+static unsigned int ppdb_add_str(const char *s)
+{
+	unsigned int ret = pp_db.pool_size;
+	size_t l = strlen(s) + 1;
+
+	if (pp_db.pool_size + l > pp_db.pool_alloc) {
+		pp_db.pool_alloc = pp_db.pool_alloc * 2 + l + 64 * 1024;
+		pp_db.pool = mem_realloc(MEM_PROTO, pp_db.pool,
+				pp_db.pool_alloc);
+		my_assert_not(pp_db.pool, NULL);
+	}
+	memcpy(pp_db.pool + pp_db.pool_size, s, l);
+	pp_db.pool_size += l;
+	return ret;
+}
+
+// header reading: each file is read once, even when //#include'd
+// again, by pp_jobs threads.  Each file gets a list of its records,
+// includes and messages, and the lists are merged in include order,
+// so the result is the same whichever thread was faster.
+enum pp_hitem_type {
+	PPHI_REC,
+	PPHI_INC,
+	PPHI_MSG,
+	PPHI_ERR,                     // reading stops here
+};
+
+struct pp_hitem {
+	enum pp_hitem_type type;
+	int line;
+	int file;                     // PPHI_INC
+	unsigned int src_hash;
+	char *name;
+	char *text;                   // proto or message
+};
+
+struct pp_hfile {
+	char *path;                   // opened as
+	char *name;                   // as //#include'd, for messages
+	const char *inc_base;         // includes are relative to its dir
+	FILE *f;
+	int close_f;
+	int is_oslib;
+	struct ppdb_file st;          // stat and hash, no names
+	struct pp_hitem *items;
+	int item_cnt, item_alloc;
+};
+
+static struct {
+	struct pp_hfile **files;
+	int cnt, alloc;
+	int next;                     // first one not being read yet
+	int busy;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} pp_hf = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+// returns file index, an already known file is not read again
+static int pp_hfile_add(FILE *f, const char *path, const char *name,
+	const char *inc_base, int close_f)
+{
+	struct pp_hfile *hf;
+	int i;
+
+	pthread_mutex_lock(&pp_hf.lock);
+	for (i = 0; i < pp_hf.cnt; i++) {
+		hf = pp_hf.files[i];
+		if (IS(hf->path, path) && IS(hf->name, name))
+			break;
+	}
+	if (i < pp_hf.cnt) {
+		pthread_mutex_unlock(&pp_hf.lock);
+		if (close_f)
+			fclose(f);
+		return i;
+	}
+
+	if (pp_hf.cnt >= pp_hf.alloc) {
+		pp_hf.alloc = pp_hf.alloc * 2 + 8;
+		pp_hf.files = mem_realloc(MEM_PROTO, pp_hf.files,
+				pp_hf.alloc * sizeof(pp_hf.files[0]));
+		my_assert_not(pp_hf.files, NULL);
+	}
+	hf = mem_calloc(MEM_PROTO, 1, sizeof(*hf));
+	my_assert_not(hf, NULL);
+	hf->path = mem_strdup(MEM_PROTO, path);
+	hf->name = mem_strdup(MEM_PROTO, name);
+	my_assert_not(hf->path, NULL);
+	my_assert_not(hf->name, NULL);
+	hf->inc_base = inc_base;
+	hf->f = f;
+	hf->close_f = close_f;
+	hf->is_oslib = strstr(name, "stdc.hlist")
+		    || strstr(name, "win32.hlist");
+	pp_hf.files[pp_hf.cnt] = hf;
+	i = pp_hf.cnt++;
+	pthread_cond_broadcast(&pp_hf.cond);
+	pthread_mutex_unlock(&pp_hf.lock);
+
+	return i;
+}
+
+static struct pp_hitem *pp_hitem_add(struct pp_hfile *hf,
+	enum pp_hitem_type type, int line)
+{
+	struct pp_hitem *it;
+
+	if (hf->item_cnt >= hf->item_alloc) {
+		hf->item_alloc = hf->item_alloc * 2 + 64;
+		hf->items = mem_realloc(MEM_PROTO, hf->items,
+				hf->item_alloc * sizeof(hf->items[0]));
+		my_assert_not(hf->items, NULL);
+	}
+	it = &hf->items[hf->item_cnt++];
+	memset(it, 0, sizeof(*it));
+	it->type = type;
+	it->line = line;
+	return it;
+}
+
+static void pp_hfile_read(struct pp_hfile *hf)
+{
+	const char *finc_name;
+	struct parsed_proto pp;
+	struct pp_hitem *it;
+	char protostr[256];
+	char text[256];
+	char path[256];
+	char fname_inc[256];
+	unsigned int h;
+	size_t msg_size = 0;
+	size_t msg_done = 0;
+	char *msg_buf = NULL;
+	struct stat st;
+	FILE *finc;
+	int line = 0;
+	int ret = 0;
+	char *p;
+
+	pp_hf_msgf = open_memstream(&msg_buf, &msg_size);
+	my_assert_not(pp_hf_msgf, NULL);
+	pp_srcfn = hf->name;
+
+	hf->st.hash = PP_HASH64_INIT;
+	if (fstat(fileno(hf->f), &st) == 0) {
+		hf->st.mtime_s = st.st_mtim.tv_sec;
+		hf->st.mtime_ns = st.st_mtim.tv_nsec;
+		hf->st.size = st.st_size;
+	}
+
+	while (fgets(protostr, sizeof(protostr), hf->f))
+	{
+		hf->st.hash = pp_hash64(hf->st.hash, protostr,
+				strlen(protostr));
+		line++;
+		if (strncmp(protostr, "//#include ", 11) == 0) {
+			finc_name = protostr + 11;
+			p = strpbrk(finc_name, "\r\n ");
+			if (p != NULL)
+				*p = 0;
+
+			path[0] = 0;
+			p = strrchr(hf->inc_base, '/');
+			if (p) {
+				memcpy(path, hf->inc_base,
+					p - hf->inc_base + 1);
+				path[p - hf->inc_base + 1] = 0;
+			}
+			snprintf(fname_inc, sizeof(fname_inc), "%s%s", 
+				path, finc_name);
+			finc = fopen(fname_inc, "r");
+			if (finc == NULL) {
+				fprintf(pp_msgout, "%s:%d: can't open '%s'\n",
+					fname_inc, line, finc_name);
+			}
+			else {
+				it = pp_hitem_add(hf, PPHI_INC, line);
+				it->file = pp_hfile_add(finc, fname_inc,
+						finc_name, hf->name, 1);
+			}
+		}
+		else if (strncmp(sskip(protostr), "//", 2) != 0) {
+			p = protostr + strlen(protostr);
+			for (p--; p >= protostr && my_isblank(*p); --p)
+				*p = 0;
+			if (p < protostr)
+				continue;
+
+			h = 2166136261u;
+			for (p = protostr; *p != 0; p++)
+				h = (h ^ (unsigned char)*p) * 16777619u;
+			h = (h ^ hf->is_oslib) * 16777619u;
+
+			// only the name for now, parsing modifies the text
+			snprintf(text, sizeof(text), "%s", protostr);
+			hdrfline = line;
+			memset(&pp, 0, sizeof(pp));
+			ret = do_parse_protostr(protostr, &pp, 1);
+			if (ret >= 0) {
+				it = pp_hitem_add(hf, PPHI_REC, line);
+				it->name = pp.name;
+				it->text = mem_strdup(MEM_PROTO, text);
+				my_assert_not(it->text, NULL);
+				it->src_hash = h;
+			}
+			else
+				mem_free(pp.name);
+			mem_free(pp.ret_type.name);
+		}
+
+		fflush(pp_hf_msgf);
+		if (msg_size > msg_done) {
+			it = pp_hitem_add(hf, PPHI_MSG, line);
+			it->text = mem_strndup(MEM_PROTO, msg_buf + msg_done,
+					msg_size - msg_done);
+			my_assert_not(it->text, NULL);
+			msg_done = msg_size;
+		}
+		if (ret < 0)
+			break;
+	}
+
+	if (!feof(hf->f))
+		pp_hitem_add(hf, PPHI_ERR, line);
+	if (hf->close_f)
+		fclose(hf->f);
+	hf->f = NULL;
+
+	fclose(pp_hf_msgf);
+	pp_hf_msgf = NULL;
+	free(msg_buf);
+}
+
+static void *pp_hfile_worker(void *arg)
+{
+	struct pp_hfile *hf;
+
+	pthread_mutex_lock(&pp_hf.lock);
+	for (;;) {
+		if (pp_hf.next < pp_hf.cnt) {
+			hf = pp_hf.files[pp_hf.next++];
+			pp_hf.busy++;
+			pthread_mutex_unlock(&pp_hf.lock);
+
+			pp_hfile_read(hf);
+
+			pthread_mutex_lock(&pp_hf.lock);
+			pp_hf.busy--;
+			pthread_cond_broadcast(&pp_hf.cond);
+			continue;
+		}
+		if (pp_hf.busy == 0)
+			break;
+		pthread_cond_wait(&pp_hf.cond, &pp_hf.lock);
+	}
+	pthread_mutex_unlock(&pp_hf.lock);
+
+	return NULL;
+}
+
+// the path a header is stored with, relative to the top header's
+// dir, so that it's the same file whatever dir the tool runs in
+static char *ppdb_rel_path(const char *path)
+{
+	char *top, *real, *ret, *p;
+	size_t b, i, up = 0;
+
+	p = strrchr(hdrfn, '/');
+	if (p == NULL)
+		top = realpath(".", NULL);
+	else if (p == hdrfn)
+		top = realpath("/", NULL);
+	else {
+		top = mem_strndup(MEM_PROTO, hdrfn, p - hdrfn);
+		my_assert_not(top, NULL);
+		p = top;
+		top = realpath(p, NULL);
+		mem_free(p);
+	}
+	real = realpath(path, NULL);
+	if (top == NULL || real == NULL) {
+		free(top);
+		free(real);
+		ret = mem_strdup(MEM_PROTO, path);
+		my_assert_not(ret, NULL);
+		return ret;
+	}
+
+	// common dirs, then a ../ for each top dir left
+	b = 0;
+	for (i = 0; real[i] != 0 && real[i] == top[i]; i++)
+		if (real[i] == '/')
+			b = i + 1;
+	if (top[i] == 0 && real[i] == '/')
+		b = i + 1;
+	for (i = b; i < strlen(top); i++)
+		if (top[i] == '/' || top[i + 1] == 0)
+			up++;
+
+	ret = mem_malloc(MEM_PROTO, up * 3 + strlen(real + b) + 1);
+	my_assert_not(ret, NULL);
+	for (i = 0; i < up; i++)
+		memcpy(ret + i * 3, "../", 3);
+	strcpy(ret + up * 3, real + b);
+
+	free(top);
+	free(real);
+	return ret;
+}
+
+static int ppdb_add_file(const struct pp_hfile *hf, const char *path)
+{
+	struct ppdb_file *pf;
+
+	if (pp_db.file_cnt >= pp_db.file_alloc) {
+		pp_db.file_alloc = pp_db.file_alloc * 2 + 8;
+		pp_db.files = mem_realloc(MEM_PROTO, pp_db.files,
+				pp_db.file_alloc * sizeof(pp_db.files[0]));
+		my_assert_not(pp_db.files, NULL);
+	}
+	pf = &pp_db.files[pp_db.file_cnt];
+	*pf = hf->st;
+	pf->path = ppdb_add_str(path);
+	pf->name = ppdb_add_str(hf->name);
+	return pp_db.file_cnt++;
+}
+
+static void ppdb_add_rec(int file, const struct pp_hitem *it,
+	int is_oslib)
 {
-	const struct parsed_proto *pp1 = p1, *pp2 = p2;
-	return strcmp(pp1->name, pp2->name);
+	struct ppdb_rec *rec;
+
+	if (pp_db.rec_cnt >= pp_db.rec_alloc) {
+		pp_db.rec_alloc = pp_db.rec_alloc * 2 + 64;
+		pp_db.recs = mem_realloc(MEM_PROTO, pp_db.recs, pp_db.rec_alloc
+				* sizeof(pp_db.recs[0]));
+		my_assert_not(pp_db.recs, NULL);
+	}
+	rec = &pp_db.recs[pp_db.rec_cnt++];
+	rec->name = ppdb_add_str(it->name);
+	rec->text = ppdb_add_str(it->text);
+	rec->file = file;
+	rec->line = it->line;
+	rec->src_hash = it->src_hash;
+	rec->is_oslib = is_oslib;
 }
 
-static struct parsed_proto *pp_cache;
-static int pp_cache_size;
-static int pp_cache_alloc;
+// depth first, as if //#include's were expanded in place,
+// a file already merged (by path) is skipped
+static int pp_hfile_merge(int i)
+{
+	const struct pp_hfile *hf = pp_hf.files[i];
+	const struct pp_hitem *it;
+	char *path;
+	int file;
+	int j;
+
+	path = ppdb_rel_path(hf->path);
+	for (j = 0; j < pp_db.file_cnt; j++)
+		if (IS(pp_db.pool + pp_db.files[j].path, path))
+			break;
+	if (j < pp_db.file_cnt) {
+		mem_free(path);
+		return 0;
+	}
+
+	file = ppdb_add_file(hf, path);
+	mem_free(path);
+	for (j = 0; j < hf->item_cnt; j++) {
+		it = &hf->items[j];
+		switch (it->type) {
+		case PPHI_REC:
+			ppdb_add_rec(file, it, hf->is_oslib);
+			break;
+		case PPHI_INC:
+			if (pp_hfile_merge(it->file) < 0)
+				return -1;
+			break;
+		case PPHI_MSG:
+			fputs(it->text, pp_msgf);
+			break;
+		case PPHI_ERR:
+			return -1;
+		}
+	}
+
+	return 0;
+}
 
-static int b_pp_c_handler(char *proto, const char *fname, int is_oslib)
+// reads hdrfn and everything it includes into pp_db
+static int pp_read_headers(FILE *fhdr)
 {
+	pthread_t *threads = NULL;
+	struct pp_hfile *hf;
+	int i, j, n = 0;
 	int ret;
 
-	if (pp_cache_size >= pp_cache_alloc) {
-		pp_cache_alloc = pp_cache_alloc * 2 + 64;
-		pp_cache = realloc(pp_cache, pp_cache_alloc
-				* sizeof(pp_cache[0]));
-		my_assert_not(pp_cache, NULL);
-		memset(pp_cache + pp_cache_size, 0,
-			(pp_cache_alloc - pp_cache_size)
-			 * sizeof(pp_cache[0]));
+	pp_hfile_add(fhdr, hdrfn, hdrfn, hdrfn, 0);
+
+	if (pp_jobs > 1) {
+		threads = mem_calloc(MEM_PROTO, pp_jobs - 1, sizeof(threads[0]));
+		my_assert_not(threads, NULL);
+		for (n = 0; n < pp_jobs - 1; n++)
+			if (pthread_create(&threads[n], NULL,
+					pp_hfile_worker, NULL) != 0)
+				break;
+	}
+	pp_hfile_worker(NULL);
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	mem_free(threads);
+
+	ret = pp_hfile_merge(0);
+
+	for (i = 0; i < pp_hf.cnt; i++) {
+		hf = pp_hf.files[i];
+		for (j = 0; j < hf->item_cnt; j++) {
+			mem_free(hf->items[j].name);
+			mem_free(hf->items[j].text);
+		}
+		mem_free(hf->items);
+		mem_free(hf->path);
+		mem_free(hf->name);
+		mem_free(hf);
+	}
+	mem_free(pp_hf.files);
+	pp_hf.files = NULL;
+	pp_hf.cnt = pp_hf.alloc = pp_hf.next = 0;
+
+	return ret;
+}
+
+// name index over recs, of duplicate names the first one is used
+static void ppdb_build_idx(void)
+{
+	unsigned int h, i, j;
+
+	pp_db.idx_size = 64;
+	while (pp_db.idx_size < pp_db.rec_cnt * 2)
+		pp_db.idx_size *= 2;
+	pp_db.idx = mem_calloc(MEM_PROTO, pp_db.idx_size, sizeof(pp_db.idx[0]));
+	my_assert_not(pp_db.idx, NULL);
+
+	for (i = 0; i < pp_db.rec_cnt; i++) {
+		h = pp_name_hash(pp_db.pool + pp_db.recs[i].name);
+		for (; ; h++) {
+			j = pp_db.idx[h & (pp_db.idx_size - 1)];
+			if (j == 0 || IS(pp_db.pool + pp_db.recs[j - 1].name,
+					 pp_db.pool + pp_db.recs[i].name))
+				break;
+		}
+		if (j == 0)
+			pp_db.idx[h & (pp_db.idx_size - 1)] = i + 1;
+	}
+}
+
+// reports names declared again differently, in header order,
+// returns their count
+static inline int ppdb_check_dupes(void)
+{
+	const struct ppdb_rec *rec, *first;
+	unsigned int h, i, j;
+	int cnt = 0;
+
+	for (i = 0; i < pp_db.rec_cnt; i++) {
+		rec = &pp_db.recs[i];
+		h = pp_name_hash(pp_db.pool + rec->name);
+		for (; ; h++) {
+			j = pp_db.idx[h & (pp_db.idx_size - 1)];
+			if (IS(pp_db.pool + pp_db.recs[j - 1].name,
+			       pp_db.pool + rec->name))
+				break;
+		}
+		first = &pp_db.recs[j - 1];
+		if (first == rec || IS(pp_db.pool + first->text,
+				       pp_db.pool + rec->text))
+			continue;
+
+		fprintf(pp_msgf, "%s:%d: '%s' differs from %s:%d, ignored\n",
+			pp_db.pool + pp_db.files[rec->file].name, rec->line,
+			pp_db.pool + rec->name,
+			pp_db.pool + pp_db.files[first->file].name, first->line);
+		cnt++;
 	}
 
-	ret = parse_protostr(proto, &pp_cache[pp_cache_size]);
-	if (ret < 0)
+	return cnt;
+}
+
+// 1 if the header is the same as when the database was written
+static int ppdb_file_fresh(const struct ppdb_file *pf)
+{
+	unsigned long long h = PP_HASH64_INIT;
+	const char *name = pp_db.pool + pf->path;
+	char path[512];
+	char buf[4096];
+	struct stat st;
+	const char *p;
+	int len = 0;
+	size_t n;
+	FILE *f;
+
+	// relative to the top header's dir, see ppdb_rel_path()
+	p = strrchr(hdrfn, '/');
+	if (p != NULL && name[0] != '/')
+		len = p - hdrfn + 1;
+	if (snprintf(path, sizeof(path), "%.*s%s", len, hdrfn, name)
+	    >= sizeof(path))
+		return 0;
+
+	if (stat(path, &st) != 0)
+		return 0;
+	if (st.st_size != pf->size)
+		return 0;
+	if (st.st_mtim.tv_sec == pf->mtime_s
+	    && st.st_mtim.tv_nsec == pf->mtime_ns)
+		return 1;
+
+	// touched, check contents
+	f = fopen(path, "rb");
+	if (f == NULL)
+		return 0;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		h = pp_hash64(h, buf, n);
+	fclose(f);
+
+	return h == pf->hash;
+}
+
+// 0 if the mapped database points outside itself
+static int ppdb_map_valid(void)
+{
+	const struct ppdb_file *pf;
+	const struct ppdb_rec *rec;
+	unsigned int i, empty = 0;
+
+	// every string must end inside the pool
+	if (pp_db.pool_size > 0 && pp_db.pool[pp_db.pool_size - 1] != 0)
+		return 0;
+	for (i = 0; i < pp_db.file_cnt; i++) {
+		pf = &pp_db.files[i];
+		if (pf->path >= pp_db.pool_size || pf->name >= pp_db.pool_size)
+			return 0;
+	}
+	for (i = 0; i < pp_db.rec_cnt; i++) {
+		rec = &pp_db.recs[i];
+		if (rec->name >= pp_db.pool_size
+		    || rec->text >= pp_db.pool_size
+		    || rec->file >= pp_db.file_cnt)
+			return 0;
+	}
+
+	// lookups stop at an empty slot
+	for (i = 0; i < pp_db.idx_size; i++) {
+		if (pp_db.idx[i] > pp_db.rec_cnt)
+			return 0;
+		if (pp_db.idx[i] == 0)
+			empty++;
+	}
+	return empty > 0;
+}
+
+// 1 if mapped, 0 if there is no database, -1 if it must be rebuilt
+static int ppdb_open(const char *path)
+{
+	const struct ppdb_hdr *hdr;
+	struct stat st;
+	size_t size;
+	char *p;
+	int fd;
+	int i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
 		return -1;
 
-	pp_cache[pp_cache_size].is_oslib = is_oslib;
-	pp_cache_size++;
-	return 0;
+	hdr = (void *)p;
+	size = sizeof(*hdr)
+		+ (size_t)hdr->file_cnt * sizeof(pp_db.files[0])
+		+ (size_t)hdr->rec_cnt * sizeof(pp_db.recs[0])
+		+ (size_t)hdr->idx_size * sizeof(pp_db.idx[0])
+		+ hdr->pool_size;
+	if (hdr->magic != PPDB_MAGIC || hdr->version != PPDB_VERSION
+	    || size != st.st_size || hdr->idx_size == 0
+	    || (hdr->idx_size & (hdr->idx_size - 1)) != 0)
+	{
+		fprintf(pp_msgf, "%s: bad header database, rebuilding\n",
+			path);
+		munmap(p, st.st_size);
+		return -1;
+	}
+
+	pp_db.map = p;
+	pp_db.map_size = st.st_size;
+	pp_db.file_cnt = hdr->file_cnt;
+	pp_db.rec_cnt = hdr->rec_cnt;
+	pp_db.idx_size = hdr->idx_size;
+	pp_db.pool_size = hdr->pool_size;
+	p += sizeof(*hdr);
+	pp_db.files = (void *)p;
+	p += pp_db.file_cnt * sizeof(pp_db.files[0]);
+	pp_db.recs = (void *)p;
+	p += pp_db.rec_cnt * sizeof(pp_db.recs[0]);
+	pp_db.idx = (void *)p;
+	p += pp_db.idx_size * sizeof(pp_db.idx[0]);
+	pp_db.pool = p;
+
+	if (!ppdb_map_valid()) {
+		fprintf(pp_msgf, "%s: bad header database, rebuilding\n",
+			path);
+		munmap(pp_db.map, pp_db.map_size);
+		memset(&pp_db, 0, sizeof(pp_db));
+		return -1;
+	}
+
+	for (i = 0; i < pp_db.file_cnt; i++) {
+		if (!ppdb_file_fresh(&pp_db.files[i])) {
+			munmap(pp_db.map, pp_db.map_size);
+			memset(&pp_db, 0, sizeof(pp_db));
+			return -1;
+		}
+	}
+
+	pp_db.parsed = mem_calloc(MEM_PROTO, pp_db.rec_cnt,
+			sizeof(pp_db.parsed[0]));
+	my_assert_not(pp_db.parsed, NULL);
+	return 1;
+}
+
+static int ppdb_write(const char *path)
+{
+	struct ppdb_hdr hdr;
+	char tmp[512];
+	int ret = 0;
+	FILE *f;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid())
+	    >= sizeof(tmp))
+	{
+		fprintf(pp_msgf, "%s: path too long\n", path);
+		return -1;
+	}
+	f = fopen(tmp, "wb");
+	if (f == NULL) {
+		fprintf(pp_msgf, "%s: can't write\n", tmp);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PPDB_MAGIC;
+	hdr.version = PPDB_VERSION;
+	hdr.file_cnt = pp_db.file_cnt;
+	hdr.rec_cnt = pp_db.rec_cnt;
+	hdr.idx_size = pp_db.idx_size;
+	hdr.pool_size = pp_db.pool_size;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+	    || fwrite(pp_db.files, sizeof(pp_db.files[0]),
+		      pp_db.file_cnt, f) != pp_db.file_cnt
+	    || fwrite(pp_db.recs, sizeof(pp_db.recs[0]),
+		      pp_db.rec_cnt, f) != pp_db.rec_cnt
+	    || fwrite(pp_db.idx, sizeof(pp_db.idx[0]),
+		      pp_db.idx_size, f) != pp_db.idx_size
+	    || fwrite(pp_db.pool, 1, pp_db.pool_size, f) != pp_db.pool_size)
+		ret = -1;
+	if (fclose(f) != 0)
+		ret = -1;
+
+	if (ret == 0)
+		ret = rename(tmp, path);
+	if (ret != 0) {
+		fprintf(pp_msgf, "%s: write failed\n", path);
+		unlink(tmp);
+	}
+	return ret;
+}
+
+// lookup key: symbol without leading '_' and '@n' suffix
+struct pp_key {
+	const char *name;  // not terminated at len when there was '@'
+	int len;
+	unsigned int hash;
+};
+
+static void pp_key_init(struct pp_key *k, const char *sym)
+{
+	unsigned int h = 2166136261u;
+	const char *p;
+
+	if (sym[0] == '_') // && strncmp(fname, "stdc", 4) == 0)
+		sym++;
+
+	for (p = sym; *p != 0 && *p != '@'; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+
+	k->name = sym;
+	k->len = p - sym;
+	k->hash = h;
 }
 
 static void build_pp_cache(FILE *fhdr)
 {
+	char db_path[512];
+	int have_db;
 	long pos;
 	int ret;
 
+	// no database next to a header with too long a path
+	if (snprintf(db_path, sizeof(db_path), "%s.ppdb", hdrfn)
+	    >= sizeof(db_path))
+		have_db = 0;
+	else
+		have_db = ppdb_open(db_path);
+	if (have_db > 0)
+		return;
+
 	pos = ftell(fhdr);
 	rewind(fhdr);
 
-	ret = do_protostrs(fhdr, hdrfn);
+	ret = pp_read_headers(fhdr);
 	if (ret < 0)
 		exit(1);
 
-	qsort(pp_cache, pp_cache_size, sizeof(pp_cache[0]), pp_name_cmp);
 	fseek(fhdr, pos, SEEK_SET);
+
+	ppdb_build_idx();
+	pp_db.parsed = mem_calloc(MEM_PROTO, pp_db.rec_cnt + 1,
+			sizeof(pp_db.parsed[0]));
+	my_assert_not(pp_db.parsed, NULL);
+
+	if (have_db < 0)
+		ppdb_write(db_path);
 }
 
-static const struct parsed_proto *proto_parse(FILE *fhdr, const char *sym,
-	int quiet)
+// stands in for records that failed to parse, see proto_found()
+static const struct parsed_proto pp_bad;
+
+// parse a record on first use, -j safe;
+// &pp_bad if it doesn't parse, the error is reported only once
+static const struct parsed_proto *ppdb_parsed(unsigned int i)
 {
-	const struct parsed_proto *pp_ret;
-	struct parsed_proto pp_search;
-	char *p;
+	const struct ppdb_rec *rec = &pp_db.recs[i];
+	struct parsed_proto *pp, *old = NULL;
+	char text[256];
 
-	if (pp_cache == NULL)
-		build_pp_cache(fhdr);
+	pp = __atomic_load_n(&pp_db.parsed[i], __ATOMIC_ACQUIRE);
+	if (pp != NULL)
+		return pp;
 
-	if (sym[0] == '_') // && strncmp(fname, "stdc", 4) == 0)
-		sym++;
+	pp = mem_calloc(MEM_PROTO, 1, sizeof(*pp));
+	my_assert_not(pp, NULL);
+	snprintf(text, sizeof(text), "%s", pp_db.pool + rec->text);
+	pp_srcfn = pp_db.pool + pp_db.files[rec->file].name;
+	hdrfline = rec->line;
+	if (parse_protostr(text, pp) < 0) {
+		proto_release(pp);
+		pp = (struct parsed_proto *)&pp_bad;
+	}
+	else {
+		pp->is_oslib = rec->is_oslib;
+		pp->src_hash = rec->src_hash;
+	}
 
-	strcpy(pp_search.name, sym);
-	p = strchr(pp_search.name, '@');
-	if (p != NULL)
-		*p = 0;
+	if (!__atomic_compare_exchange_n(&pp_db.parsed[i], &old, pp, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		// another thread was faster
+		if (pp != &pp_bad)
+			proto_release(pp);
+		pp = old;
+	}
+	return pp;
+}
+
+// k must come from pp_key_init(), cache must be built;
+// &pp_bad is only for proto_found() to see
+static const struct parsed_proto *pp_find(const struct pp_key *k)
+{
+	const char *name;
+	unsigned int h, i;
+
+	for (h = k->hash; ; h++) {
+		i = pp_db.idx[h & (pp_db.idx_size - 1)];
+		if (i == 0)
+			return NULL;
+		name = pp_db.pool + pp_db.recs[i - 1].name;
+		if (!strncmp(name, k->name, k->len) && name[k->len] == 0)
+			return ppdb_parsed(i - 1);
+	}
+}
 
-	pp_ret = bsearch(&pp_search, pp_cache, pp_cache_size,
-			sizeof(pp_cache[0]), pp_name_cmp);
-	if (pp_ret == NULL && !quiet)
-		printf("%s: sym '%s' is missing\n", hdrfn, sym);
+// the proto_parse() part after the lookup, for users
+// that keep keys and results of their own
+static const struct parsed_proto *proto_found(const struct pp_key *k,
+	const struct parsed_proto *pp, int quiet)
+{
+	if (pp == &pp_bad) {
+		// a broken header is an error even where missing is fine
+		fprintf(pp_msgf, "%s: sym '%s' has a bad prototype\n",
+			hdrfn, k->name);
+		pp = NULL;
+	}
+	else if (pp == NULL && !quiet)
+		fprintf(pp_msgf, "%s: sym '%s' is missing\n", hdrfn, k->name);
 
-	return pp_ret;
+#ifdef pp_lookup_hook
+	pp_lookup_hook(k->name, k->len, pp);
+#endif
+	return pp;
+}
+
+static const struct parsed_proto *proto_parse(FILE *fhdr, const char *sym,
+	int quiet)
+{
+	struct pp_key k;
+
+	if (pp_db.idx == NULL)
+		build_pp_cache(fhdr);
+
+	pp_key_init(&k, sym);
+	return proto_found(&k, pp_find(&k), quiet);
 }
 
 static void pp_copy_arg(struct parsed_proto_arg *d,
@@ -732,17 +1557,16 @@ static void pp_copy_arg(struct parsed_proto_arg *d,
 	memcpy(d, s, sizeof(*d));
 
 	if (s->reg != NULL) {
-		d->reg = strdup(s->reg);
+		d->reg = mem_strdup(MEM_PROTO, s->reg);
 		my_assert_not(d->reg, NULL);
 	}
 	if (s->type.name != NULL) {
-		d->type.name = strdup(s->type.name);
+		d->type.name = mem_strdup(MEM_PROTO, s->type.name);
 		my_assert_not(d->type.name, NULL);
 	}
 	if (s->fptr != NULL) {
-		d->fptr = malloc(sizeof(*d->fptr));
+		d->fptr = proto_clone(s->fptr);
 		my_assert_not(d->fptr, NULL);
-		memcpy(d->fptr, s->fptr, sizeof(*d->fptr));
 	}
 }
 
@@ -751,15 +1575,21 @@ struct parsed_proto *proto_clone(const struct parsed_proto *pp_c)
 	struct parsed_proto *pp;
 	int i;
 
-	pp = malloc(sizeof(*pp));
+	pp = mem_malloc(MEM_PROTO, sizeof(*pp));
 	my_assert_not(pp, NULL);
 	memcpy(pp, pp_c, sizeof(*pp)); // lazy..
 
 	// do the actual deep copy..
+	if (pp_c->name != NULL)
+		pp->name = mem_strdup(MEM_PROTO, pp_c->name);
+	if (pp_c->argc > 0) {
+		pp->arg = mem_malloc(MEM_PROTO, pp_c->argc * sizeof(pp->arg[0]));
+		my_assert_not(pp->arg, NULL);
+	}
 	for (i = 0; i < pp_c->argc; i++)
 		pp_copy_arg(&pp->arg[i], &pp_c->arg[i]);
 	if (pp_c->ret_type.name != NULL)
-		pp->ret_type.name = strdup(pp_c->ret_type.name);
+		pp->ret_type.name = mem_strdup(MEM_PROTO, pp_c->ret_type.name);
 
 	return pp;
 }
@@ -816,13 +1646,15 @@ static inline void proto_release(struct parsed_proto *pp)
 
 	for (i = 0; i < pp->argc; i++) {
 		if (pp->arg[i].reg != NULL)
-			free(pp->arg[i].reg);
+			mem_free(pp->arg[i].reg);
 		if (pp->arg[i].type.name != NULL)
-			free(pp->arg[i].type.name);
+			mem_free(pp->arg[i].type.name);
 		if (pp->arg[i].fptr != NULL)
-			free(pp->arg[i].fptr);
+			proto_release(pp->arg[i].fptr);
 	}
 	if (pp->ret_type.name != NULL)
-		free(pp->ret_type.name);
-	free(pp);
+		mem_free(pp->ret_type.name);
+	mem_free(pp->name);
+	mem_free(pp->arg);
+	mem_free(pp);
 }
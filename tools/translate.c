@@ -10,28 +10,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "my_assert.h"
 #include "my_str.h"
+#include "my_mem.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #define IS(w, y) !strcmp(w, y)
 #define IS_START(w, y) !strncmp(w, y, strlen(y))
 
+// diagnostics, per thread so that -j output can be kept in order
+static __thread FILE *g_msgf;
+#define pp_msgf g_msgf
+
+// -c: protos a function uses are part of its cache entry,
+// -T: lookups are counted
+struct parsed_proto;
+static void note_proto_lookup(const char *name, int len,
+  const struct parsed_proto *pp);
+#define pp_lookup_hook note_proto_lookup
+
 #include "protoparse.h"
 
 static const char *asmfn;
-static int asmln;
+static __thread int asmln;
 static FILE *g_fhdr;
 
+// error text, printed by err_exit(), kept for the -k summary
+static __thread char g_err_msg[4096];
+static void err_exit(void) __attribute__((noreturn));
+
 #define anote(fmt, ...) \
-	printf("%s:%d: note: " fmt, asmfn, asmln, ##__VA_ARGS__)
+	fprintf(g_msgf, "%s:%d: note: " fmt, asmfn, asmln, ##__VA_ARGS__)
 #define awarn(fmt, ...) \
-	printf("%s:%d: warning: " fmt, asmfn, asmln, ##__VA_ARGS__)
+	fprintf(g_msgf, "%s:%d: warning: " fmt, asmfn, asmln, ##__VA_ARGS__)
 #define aerr(fmt, ...) do { \
-	printf("%s:%d: error: " fmt, asmfn, asmln, ##__VA_ARGS__); \
-  fcloseall(); \
-	exit(1); \
+	snprintf(g_err_msg, sizeof(g_err_msg), "%s:%d: error: " fmt, \
+		asmfn, asmln, ##__VA_ARGS__); \
+	err_exit(); \
 } while (0)
 
 #include "masm_tools.h"
@@ -55,6 +80,7 @@ enum op_flags {
   OPF_32BIT  = (1 << 15), /* 32bit division */
   OPF_LOCK   = (1 << 16), /* op has lock prefix */
   OPF_VAPUSH = (1 << 17), /* vararg ptr push (as call arg) */
+  OPF_PPOWN  = (1 << 18), /* call: pp is our own, not shared */
 };
 
 enum op_op {
@@ -141,7 +167,7 @@ struct parsed_opr {
   const struct parsed_proto *pp; // for OPT_LABEL
   int reg;
   unsigned int val;
-  char name[112];
+  const char *name; // interned, same name - same pointer
 };
 
 struct parsed_op {
@@ -154,13 +180,15 @@ struct parsed_op {
   unsigned char p_argnum; // push: altered before call arg #
   unsigned char p_argpass;// push: arg of host func
   unsigned char pad[3];
-  int regmask_src;        // all referensed regs
+  int regmask_src;        // all referensed regs, but plain written dst
   int regmask_dst;
   int pfomask;            // flagop: parsed_flag_op that can't be delayed
   int cc_scratch;         // scratch storage during analysis
   int bt_i;               // branch target for branches
   struct parsed_data *btj;// branch targets for jumptables
-  struct parsed_proto *pp;// parsed_proto for OP_CALL
+  const struct parsed_proto *pp; // for OP_CALL, see call_pp_mut()
+  struct parsed_op **arg_ops;     // OP_CALL: pushes of pp stack args
+  int arg_ops_alloc;
   void *datap;
   int asmln;
 };
@@ -196,6 +224,34 @@ struct label_ref {
   struct label_ref *next;
 };
 
+// basic block, ops [start, end); built after pass2,
+// block indices are in op order
+struct bblock {
+  int start;
+  int end;
+  int *succ;        // branch targets (in scan order), then fallthrough
+  int succ_cnt;
+  int *pred;        // branch sources (in label ref order), then fallthrough
+  int pred_cnt;
+  int jpred_cnt;    // branch sources only
+  unsigned int ft:1;      // entered by falling in (or function entry)
+  unsigned int ft_succ:1; // last succ is the fallthrough
+  int rpo;          // index in func_ctx.rpo, -1 if unreachable
+  int scratch;      // scan marks, see scan_for_pop()
+  int scratch_i;    // .. and collect_call_args_walks()
+};
+
+// a pending backward walk of collect_call_args_walks()
+struct arg_walk {
+  int from;         // op the walk started at
+  int j;            // op to continue from
+  int arg;
+  unsigned int need_op_saving:1;
+  unsigned int may_reuse:1;
+  unsigned int main:1; // its arg count is the result
+  unsigned int resume:1; // j was checked, go on from j - 1
+};
+
 enum ida_func_attr {
   IDAFA_BP_FRAME = (1 << 0),
   IDAFA_LIB_FUNC = (1 << 1),
@@ -205,43 +261,410 @@ enum ida_func_attr {
   IDAFA_FPD      = (1 << 5),
 };
 
-#define MAX_OPS 4096
-
-static struct parsed_op ops[MAX_OPS];
-static struct parsed_equ *g_eqs;
-static int g_eqcnt;
-static char g_labels[MAX_OPS][48];
-static struct label_ref g_label_refs[MAX_OPS];
-static const struct parsed_proto *g_func_pp;
-static struct parsed_data *g_func_pd;
-static int g_func_pd_cnt;
-static char g_func[256];
-static char g_comment[256];
-static int g_bp_frame;
-static int g_sp_frame;
-static int g_stack_frame_used;
-static int g_stack_fsz;
-static int g_ida_func_attr;
+#define HASH64_INIT 0xcbf29ce484222325ull
+
+// label name -> ops index, open addressing,
+// entries from older generations are free
+struct label_idx_ent {
+  int i;
+  int gen;
+};
+
+struct pp_dep {
+  char *name;
+  unsigned int hash;  // 0 if missing
+};
+
+// per-function allocations, all dropped at once when the
+// function is done; blocks are kept for the next one
+struct arena_blk {
+  struct arena_blk *next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+struct arena {
+  struct arena_blk *first;
+  struct arena_blk *cur;
+};
+
+// generated C, appended to while a function is done
+// and written out whole; kept for the next function
+struct outbuf {
+  char *buf;
+  size_t len;
+  size_t size;
+};
+
+// -T: where a function's time goes, and how often
+// the recursive scans run
+enum tm_phase {
+  TM_PARSE,
+  TM_PASS1,
+  TM_PASS2,
+  TM_PASS3,
+  TM_PASS4,
+  TM_OUT,
+  TM_PHASES
+};
+
+enum tm_count {
+  TMC_SCAN_POP,
+  TMC_CALL_ARGS,
+  TMC_FLAG_SET,
+  TMC_PROTO,
+  TM_COUNTS
+};
+
+struct func_tm {
+  unsigned long long ns[TM_PHASES];
+  unsigned long long cnt[TM_COUNTS];
+};
+
+// per-function state, filled by the main loop and then
+// consumed by gen_func(), maybe on a worker thread (-j)
+struct func_ctx {
+  struct parsed_op *ops;
+  char (*labels)[48];
+  struct label_ref *label_refs;
+  int op_alloc;
+  struct label_idx_ent *label_idx;
+  int label_idx_size;
+  int label_idx_gen;
+  int label_idx_cnt;
+  struct arena arena;
+  struct parsed_equ *eqs;
+  int eqcnt;
+  int eq_alloc;
+  struct parsed_data *func_pd;
+  int func_pd_cnt;
+  int func_pd_alloc;
+  // CFG, in the arena
+  struct bblock *bbs;
+  int bb_cnt;
+  int *op_bb;       // op -> block
+  int *rpo;         // reachable blocks, reverse postorder
+  int rpo_cnt;
+  int *exits;       // blocks without successors
+  int exit_cnt;
+  // register dataflow, per op, see solve_regs()
+  unsigned char *live_in;
+  int (*rdef)[8];
+  // reaching flag setters, see solve_flags()
+  unsigned long long *fs_in; // per block, fs_words each
+  int fs_words;
+  int *fs_op;       // setter bit -> op
+  int *fs_prev;     // op -> last setter before it in the block
+  unsigned char *fs_br; // per block: flags may come via a jump
+  // stack depth, see solve_esp()
+  int *esp_in;      // per op, bytes pushed since the frame was set up
+  struct arg_walk *arg_walks; // collect_call_args_walks() stack
+  char func[256];
+  int ida_func_attr;
+  int opcnt;
+  int asmln;
+
+  // output, and with -j diagnostics, in memory until written in order
+  struct outbuf out;
+  FILE *msg;
+  char *msg_buf;
+  size_t msg_size;
+  int gen;      // has a function for gen_func()
+  int failed;
+  char *err_msg;
+  int done;
+
+  // -c: what the output depends on
+  unsigned long long asm_hash;
+  struct pp_dep *pp_deps;
+  int pp_dep_cnt;
+  int pp_dep_alloc;
+  int ln_used;  // output has asm line numbers in it
+
+  struct func_tm tm;
+};
+
+static __thread struct func_ctx *g_ctx;
+// g_ctx arrays, used everywhere
+static __thread struct parsed_op *ops;
+static __thread char (*g_labels)[48];
+static __thread struct label_ref *g_label_refs;
+// gen_func() CFG, from g_ctx
+static __thread struct bblock *g_bbs;
+static __thread int *g_op_bb;
+
+// gen_func() scratch
+static __thread const struct parsed_proto *g_func_pp;
+static __thread char g_comment[256];
+static __thread size_t g_opr_bufsz;
+static __thread int g_bp_frame;
+static __thread int g_sp_frame;
+static __thread int g_stack_frame_used;
+static __thread int g_stack_fsz;
+
 static int g_allow_regfunc;
+
+static int g_timing;
+static __thread unsigned long long g_tm_last;
+
+static unsigned long long tm_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void tm_start(void)
+{
+  if (g_timing)
+    g_tm_last = tm_now();
+}
+
+// time since the last mark (or start) goes to phase p
+static void tm_mark(enum tm_phase p)
+{
+  unsigned long long now;
+
+  if (!g_timing)
+    return;
+
+  now = tm_now();
+  g_ctx->tm.ns[p] += now - g_tm_last;
+  g_tm_last = now;
+}
+
+static void ob_reserve(struct outbuf *ob, size_t n)
+{
+  if (ob->len + n <= ob->size)
+    return;
+  ob->size = ob->size * 2 + n + 4096;
+  ob->buf = mem_realloc(MEM_OUTPUT, ob->buf, ob->size);
+  my_assert_not(ob->buf, NULL);
+}
+
+static void ob_printf(struct outbuf *ob, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void ob_printf(struct outbuf *ob, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  ob_reserve(ob, 256); // usually enough for one pass
+  va_start(ap, fmt);
+  n = vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+  va_end(ap);
+  my_assert(n >= 0, 1);
+  if (ob->len + n >= ob->size) {
+    ob_reserve(ob, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+    va_end(ap);
+  }
+  ob->len += n;
+}
+
+static void ob_flush(struct outbuf *ob, FILE *f)
+{
+  if (ob->len > 0)
+    fwrite(ob->buf, 1, ob->len, f);
+  ob->len = 0;
+}
+
+static void *arena_alloc(struct arena *a, size_t size)
+{
+  struct arena_blk *b = a->cur;
+  size_t bsize;
+  void *ret;
+
+  size = (size + 15) & ~15;
+  if (b != NULL && b->used + size <= b->size)
+    goto out;
+
+  // next one, if it was allocated for an earlier function
+  if (b != NULL && b->next != NULL && size <= b->next->size) {
+    b = b->next;
+    b->used = 0;
+    goto out;
+  }
+
+  bsize = 64 * 1024 - sizeof(*b);
+  if (bsize < size)
+    bsize = size;
+  b = mem_malloc(MEM_IR, sizeof(*b) + bsize);
+  my_assert_not(b, NULL);
+  b->size = bsize;
+  b->used = 0;
+  if (a->cur == NULL) {
+    b->next = NULL;
+    a->first = b;
+  }
+  else {
+    b->next = a->cur->next;
+    a->cur->next = b;
+  }
+
+out:
+  a->cur = b;
+  ret = b->data + b->used;
+  b->used += size;
+  return ret;
+}
+
+static void arena_reset(struct arena *a)
+{
+  a->cur = a->first;
+  if (a->cur != NULL)
+    a->cur->used = 0;
+}
+
+// allocations that live until the function is done
+static void *fzalloc(size_t size)
+{
+  void *p = arena_alloc(&g_ctx->arena, size);
+  memset(p, 0, size);
+  return p;
+}
+
+static char *fstrdup(const char *s)
+{
+  size_t len = strlen(s) + 1;
+  return memcpy(arena_alloc(&g_ctx->arena, len), s, len);
+}
+
+// scratch for an operand's C text, sized in gen_func()
+// from the longest operand name
+static char *opr_buf(void)
+{
+  return arena_alloc(&g_ctx->arena, g_opr_bufsz);
+}
+
+// formatted into the arena, for expressions of any length
+static char *fsprintf(const char *fmt, ...)
+  __attribute__((format(printf, 1, 2)));
+
+static char *fsprintf(const char *fmt, ...)
+{
+  va_list ap;
+  char *p;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  my_assert(n >= 0, 1);
+  p = arena_alloc(&g_ctx->arena, n + 1);
+  va_start(ap, fmt);
+  vsnprintf(p, n + 1, fmt, ap);
+  va_end(ap);
+  return p;
+}
+
+static struct parsed_proto *fproto_clone(const struct parsed_proto *pp_c)
+{
+  struct parsed_proto *pp;
+  struct parsed_proto_arg *arg;
+  int i;
+
+  pp = arena_alloc(&g_ctx->arena, sizeof(*pp));
+  memcpy(pp, pp_c, sizeof(*pp));
+  if (pp->name != NULL)
+    pp->name = fstrdup(pp->name);
+  if (pp->argc > 0) {
+    pp->arg = arena_alloc(&g_ctx->arena, pp->argc * sizeof(pp->arg[0]));
+    memcpy(pp->arg, pp_c->arg, pp->argc * sizeof(pp->arg[0]));
+  }
+
+  for (i = 0; i < pp->argc; i++) {
+    arg = &pp->arg[i];
+    if (arg->reg != NULL)
+      arg->reg = fstrdup(arg->reg);
+    if (arg->type.name != NULL)
+      arg->type.name = fstrdup(arg->type.name);
+    if (arg->fptr != NULL)
+      arg->fptr = fproto_clone(arg->fptr);
+  }
+  if (pp->ret_type.name != NULL)
+    pp->ret_type.name = fstrdup(pp->ret_type.name);
+
+  return pp;
+}
+
+// call ops share protos with the header cache until one has to be
+// changed, then that call gets a copy of its own.  Strings stay
+// shared, they are replaced, never modified in place.
+static struct parsed_proto *call_pp_mut(struct parsed_op *po)
+{
+  struct parsed_proto *pp;
+
+  if (po->flags & OPF_PPOWN)
+    return (struct parsed_proto *)po->pp;
+
+  pp = arena_alloc(&g_ctx->arena, sizeof(*pp));
+  memcpy(pp, po->pp, sizeof(*pp));
+  if (pp->argc > 0) {
+    pp->arg = arena_alloc(&g_ctx->arena, pp->argc * sizeof(pp->arg[0]));
+    memcpy(pp->arg, po->pp->arg, pp->argc * sizeof(pp->arg[0]));
+  }
+  po->pp = pp;
+  po->flags |= OPF_PPOWN;
+  return pp;
+}
+
+static void call_arg_op_set(struct parsed_op *po, int arg,
+  struct parsed_op *op)
+{
+  struct parsed_op **arg_ops;
+  int alloc;
+
+  if (arg >= po->arg_ops_alloc) {
+    alloc = po->arg_ops_alloc * 2 + 8;
+    if (alloc <= arg)
+      alloc = arg + 1;
+    arg_ops = fzalloc(alloc * sizeof(arg_ops[0]));
+    if (po->arg_ops_alloc > 0)
+      memcpy(arg_ops, po->arg_ops,
+        po->arg_ops_alloc * sizeof(arg_ops[0]));
+    po->arg_ops = arg_ops;
+    po->arg_ops_alloc = alloc;
+  }
+  po->arg_ops[arg] = op;
+}
+
+static struct parsed_op *call_arg_op(const struct parsed_op *po, int arg)
+{
+  if (arg >= po->arg_ops_alloc)
+    return NULL;
+  return po->arg_ops[arg];
+}
 #define ferr(op_, fmt, ...) do { \
-  printf("%s:%d: error: [%s] '%s': " fmt, asmfn, (op_)->asmln, g_func, \
-    dump_op(op_), ##__VA_ARGS__); \
-  fcloseall(); \
-  exit(1); \
+  snprintf(g_err_msg, sizeof(g_err_msg), "%s:%d: error: [%s] '%s': " fmt, \
+    asmfn, (op_)->asmln, g_ctx->func, dump_op(op_), ##__VA_ARGS__); \
+  err_exit(); \
 } while (0)
 #define fnote(op_, fmt, ...) \
-  printf("%s:%d: note: [%s] '%s': " fmt, asmfn, (op_)->asmln, g_func, \
-    dump_op(op_), ##__VA_ARGS__)
+  fprintf(g_msgf, "%s:%d: note: [%s] '%s': " fmt, asmfn, (op_)->asmln, \
+    g_ctx->func, dump_op(op_), ##__VA_ARGS__)
 
 #define MAX_REGS 8
 
 const char *regs_r32[] = { "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp" };
-const char *regs_r16[] = { "ax", "bx", "cx", "dx", "si", "di", "bp", "sp" };
-const char *regs_r8l[] = { "al", "bl", "cl", "dl" };
-const char *regs_r8h[] = { "ah", "bh", "ch", "dh" };
 
 enum x86_regs { xUNSPEC = -1, xAX, xBX, xCX, xDX, xSI, xDI, xBP, xSP };
 
+static const struct {
+  const char *name;
+  enum x86_regs reg;
+  enum opr_lenmod lmod;
+} reg_table[] = {
+#define REG(name, reg, lmod) { name, reg, lmod },
+#include "x86_ops.h"
+};
+
+#include "opdec.h"
+
 // possible basic comparison types (without inversion)
 enum parsed_flag_op {
   PFO_O,  // 0 OF=1
@@ -294,43 +717,32 @@ static int check_segment_prefix(const char *s)
 
 static int parse_reg(enum opr_lenmod *reg_lmod, const char *s)
 {
-  int reg;
+  int i;
 
-  reg = char_array_i(regs_r32, ARRAY_SIZE(regs_r32), s);
-  if (reg >= 0) {
-    *reg_lmod = OPLM_DWORD;
-    return reg;
-  }
-  reg = char_array_i(regs_r16, ARRAY_SIZE(regs_r16), s);
-  if (reg >= 0) {
-    *reg_lmod = OPLM_WORD;
-    return reg;
-  }
-  reg = char_array_i(regs_r8h, ARRAY_SIZE(regs_r8h), s);
-  if (reg >= 0) {
-    *reg_lmod = OPLM_BYTE;
-    return reg;
-  }
-  reg = char_array_i(regs_r8l, ARRAY_SIZE(regs_r8l), s);
-  if (reg >= 0) {
-    *reg_lmod = OPLM_BYTE;
-    return reg;
-  }
+  i = opdec_reg(s);
+  if (i < 0)
+    return -1;
 
-  return -1;
+  *reg_lmod = reg_table[i].lmod;
+  return reg_table[i].reg;
 }
 
-static int parse_indmode(char *name, int *regmask, int need_c_cvt)
+// with cvt, also returns the address with numbers
+// in C form, in a buffer to mem_free()
+static int parse_indmode(const char *name, int *regmask, char **cvt)
 {
   enum opr_lenmod lmod;
-  char cvtbuf[256];
-  char *d = cvtbuf;
-  char *s = name;
-  char w[64];
+  const char *s = name;
+  char *cvtbuf, *d;
+  size_t size;
   long number;
-  int reg;
+  int reg, len;
   int c = 0;
 
+  // a number at most doubles ("10" -> "0x0a")
+  size = strlen(name) * 2 + 32;
+  cvtbuf = d = mem_malloc(MEM_MISC, size);
+  my_assert_not(cvtbuf, NULL);
   *d = 0;
 
   while (*s != 0) {
@@ -347,32 +759,34 @@ static int parse_indmode(char *name, int *regmask, int need_c_cvt)
     if (check_segment_prefix(s))
       s += 3;
 
-    s = next_idt(w, sizeof(w), s);
-    if (w[0] == 0)
+    for (len = 0; s[len] != 0 && !my_isblank(s[len])
+         && !my_issep(s[len]); len++)
+      ;
+    if (len == 0)
       break;
+    memcpy(d, s, len);
+    d[len] = 0;
+    s += len;
     c++;
 
-    reg = parse_reg(&lmod, w);
+    reg = parse_reg(&lmod, d);
     if (reg >= 0) {
       *regmask |= 1 << reg;
-      goto pass;
+      continue;
     }
 
-    if ('0' <= w[0] && w[0] <= '9') {
-      number = parse_number(w);
-      printf_number(d, sizeof(cvtbuf) - (d - cvtbuf), number);
-      continue;
+    if ('0' <= d[0] && d[0] <= '9') {
+      number = parse_number(d);
+      printf_number(d, size - (d - cvtbuf), number);
     }
 
     // probably some label/identifier - pass
-
-pass:
-    snprintf(d, sizeof(cvtbuf) - (d - cvtbuf), "%s", w);
   }
 
-  if (need_c_cvt)
-    strcpy(name, cvtbuf);
-
+  if (cvt != NULL)
+    *cvt = cvtbuf;
+  else
+    mem_free(cvtbuf);
   return c;
 }
 
@@ -586,17 +1000,112 @@ static void setup_reg_opr(struct parsed_opr *opr, int reg, enum opr_lenmod lmod,
 static struct parsed_equ *equ_find(struct parsed_op *po, const char *name,
   int *extra_offs);
 
+static unsigned int label_hash(const char *name)
+{
+  unsigned int h = 2166136261u;
+
+  for (; *name != 0; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+
+  return h;
+}
+
+// operand name strings, one copy of each.  Only the parser (main
+// thread) adds, the strings never move, so gen_func() on workers can
+// use them freely.  Each also remembers its header proto, looked up
+// once when interned.
+struct sym_ent {
+  struct pp_key key;
+  const struct parsed_proto *pp;
+  char name[];
+};
+
+static struct {
+  const char **tab;   // open addressing, ->name of sym_ent
+  int size;
+  int cnt;
+  char *pool;
+  size_t pool_left;
+} g_syms;
+
+static const char *sym_intern(const char *name)
+{
+  struct sym_ent *se;
+  unsigned int h, i;
+  const char **tab;
+  size_t len;
+  int size;
+  char *p;
+
+  if (g_syms.cnt >= g_syms.size / 2) {
+    size = g_syms.size ? g_syms.size * 2 : 4096;
+    tab = mem_calloc(MEM_SYMS, size, sizeof(tab[0]));
+    my_assert_not(tab, NULL);
+    for (i = 0; i < g_syms.size; i++) {
+      if (g_syms.tab[i] == NULL)
+        continue;
+      h = label_hash(g_syms.tab[i]);
+      while (tab[h & (size - 1)] != NULL)
+        h++;
+      tab[h & (size - 1)] = g_syms.tab[i];
+    }
+    mem_free(g_syms.tab);
+    g_syms.tab = tab;
+    g_syms.size = size;
+  }
+
+  for (h = label_hash(name); ; h++) {
+    i = h & (g_syms.size - 1);
+    if (g_syms.tab[i] == NULL)
+      break;
+    if (IS(g_syms.tab[i], name))
+      return g_syms.tab[i];
+  }
+
+  len = sizeof(*se) + strlen(name) + 1;
+  len = (len + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  if (len > g_syms.pool_left) {
+    g_syms.pool_left = 64 * 1024;
+    g_syms.pool = mem_malloc(MEM_SYMS, g_syms.pool_left);
+    my_assert_not(g_syms.pool, NULL);
+  }
+  se = (void *)g_syms.pool;
+  g_syms.pool += len;
+  g_syms.pool_left -= len;
+
+  p = strcpy(se->name, name);
+  pp_key_init(&se->key, p);
+  se->pp = pp_find(&se->key);
+
+  g_syms.tab[i] = p;
+  g_syms.cnt++;
+  return p;
+}
+
+// proto_parse() for sym_intern()ed names
+static const struct parsed_proto *proto_parse_sym(const char *name,
+  int quiet)
+{
+  const struct sym_ent *se;
+
+  se = (const void *)(name - offsetof(struct sym_ent, name));
+  return proto_found(&se->key, se->pp, quiet);
+}
+
+// for operands without a name, set up before any parsing
+static const char *g_sym_empty;
+
 static int parse_operand(struct parsed_opr *opr,
   int *regmask, int *regmask_indirect,
-  char words[16][256], int wordc, int w, unsigned int op_flags)
+  char **words, int wordc, int w, unsigned int op_flags)
 {
   const struct parsed_proto *pp;
   enum opr_lenmod tmplmod;
   unsigned long number;
-  char buf[256];
+  char buf[32];
   int ret, len;
   int wordc_in;
-  char *p;
+  char *p, *cvt;
   int i;
 
   if (w >= wordc)
@@ -612,7 +1121,6 @@ static int parse_operand(struct parsed_opr *opr,
       break;
     }
   }
-
   wordc_in = wordc - w;
 
   if ((op_flags & OPF_JMP) && wordc_in > 0
@@ -639,7 +1147,7 @@ static int parse_operand(struct parsed_opr *opr,
         opr->had_ds = 1;
         label += 3;
       }
-      strcpy(opr->name, label);
+      opr->name = sym_intern(label);
       return wordc;
     }
   }
@@ -663,8 +1171,8 @@ static int parse_operand(struct parsed_opr *opr,
     if (IS(words[w], "offset")) {
       opr->type = OPT_OFFSET;
       opr->lmod = OPLM_DWORD;
-      strcpy(opr->name, words[w + 1]);
-      pp = proto_parse(g_fhdr, opr->name, 1);
+      opr->name = sym_intern(words[w + 1]);
+      pp = proto_parse_sym(opr->name, 1);
       goto do_label;
     }
     if (IS(words[w], "(offset")) {
@@ -673,7 +1181,7 @@ static int parse_operand(struct parsed_opr *opr,
         aerr("parse of bracketed offset failed\n");
       *p = 0;
       opr->type = OPT_OFFSET;
-      strcpy(opr->name, words[w + 1]);
+      opr->name = sym_intern(words[w + 1]);
       return wordc;
     }
   }
@@ -688,15 +1196,18 @@ static int parse_operand(struct parsed_opr *opr,
     opr->had_ds = 1;
     memmove(words[w], words[w] + 3, strlen(words[w]) - 2);
   }
-  strcpy(opr->name, words[w]);
+  opr->name = sym_intern(words[w]);
 
   if (words[w][0] == '[') {
     opr->type = OPT_REGMEM;
-    ret = sscanf(words[w], "[%[^]]]", opr->name);
-    if (ret != 1)
+    p = words[w] + 1 + strcspn(words[w] + 1, "]");
+    if (p == words[w] + 1)
       aerr("[] parse failure\n");
+    *p = 0;
 
-    parse_indmode(opr->name, regmask_indirect, 1);
+    parse_indmode(words[w] + 1, regmask_indirect, &cvt);
+    opr->name = sym_intern(cvt);
+    mem_free(cvt);
     if (opr->lmod == OPLM_UNSPEC && parse_stack_el(opr->name, NULL, 1))
     {
       // might be an equ
@@ -711,10 +1222,10 @@ static int parse_operand(struct parsed_opr *opr,
     // label[reg] form
     p = strchr(words[w], '[');
     opr->type = OPT_REGMEM;
-    parse_indmode(p, regmask_indirect, 0);
-    strncpy(buf, words[w], p - words[w]);
-    buf[p - words[w]] = 0;
-    pp = proto_parse(g_fhdr, buf, 1);
+    parse_indmode(p, regmask_indirect, NULL);
+    *p = 0;
+    pp = proto_parse(g_fhdr, words[w], 1);
+    *p = '[';
     goto do_label;
   }
   else if (('0' <= words[w][0] && words[w][0] <= '9')
@@ -723,7 +1234,8 @@ static int parse_operand(struct parsed_opr *opr,
     number = parse_number(words[w]);
     opr->type = OPT_CONST;
     opr->val = number;
-    printf_number(opr->name, sizeof(opr->name), number);
+    printf_number(buf, sizeof(buf), number);
+    opr->name = sym_intern(buf);
     return wordc;
   }
 
@@ -735,7 +1247,7 @@ static int parse_operand(struct parsed_opr *opr,
 
   // most likely var in data segment
   opr->type = OPT_LABEL;
-  pp = proto_parse(g_fhdr, opr->name, 0);
+  pp = proto_parse_sym(opr->name, 0);
 
 do_label:
   if (pp != NULL) {
@@ -773,12 +1285,8 @@ static const struct {
   const char *name;
   unsigned int flags;
 } pref_table[] = {
-  { "rep",    OPF_REP },
-  { "repe",   OPF_REP|OPF_REPZ },
-  { "repz",   OPF_REP|OPF_REPZ },
-  { "repne",  OPF_REP|OPF_REPNZ },
-  { "repnz",  OPF_REP|OPF_REPNZ },
-  { "lock",   OPF_LOCK }, // ignored for now..
+#define PREFIX(name, flags) { name, flags },
+#include "x86_ops.h"
 };
 
 #define OPF_CJMP_CC (OPF_JMP|OPF_CJMP|OPF_CC)
@@ -792,125 +1300,12 @@ static const struct {
   unsigned char pfo;
   unsigned char pfo_inv;
 } op_table[] = {
-  { "nop",  OP_NOP,    0, 0, 0 },
-  { "push", OP_PUSH,   1, 1, 0 },
-  { "pop",  OP_POP,    1, 1, OPF_DATA },
-  { "leave",OP_LEAVE,  0, 0, OPF_DATA },
-  { "mov" , OP_MOV,    2, 2, OPF_DATA },
-  { "lea",  OP_LEA,    2, 2, OPF_DATA },
-  { "movzx",OP_MOVZX,  2, 2, OPF_DATA },
-  { "movsx",OP_MOVSX,  2, 2, OPF_DATA },
-  { "xchg", OP_XCHG,   2, 2, OPF_DATA },
-  { "not",  OP_NOT,    1, 1, OPF_DATA },
-  { "cdq",  OP_CDQ,    0, 0, OPF_DATA },
-  { "lodsb",OP_LODS,   0, 0, OPF_DATA },
-  { "lodsw",OP_LODS,   0, 0, OPF_DATA },
-  { "lodsd",OP_LODS,   0, 0, OPF_DATA },
-  { "stosb",OP_STOS,   0, 0, OPF_DATA },
-  { "stosw",OP_STOS,   0, 0, OPF_DATA },
-  { "stosd",OP_STOS,   0, 0, OPF_DATA },
-  { "movsb",OP_MOVS,   0, 0, OPF_DATA },
-  { "movsw",OP_MOVS,   0, 0, OPF_DATA },
-  { "movsd",OP_MOVS,   0, 0, OPF_DATA },
-  { "cmpsb",OP_CMPS,   0, 0, OPF_DATA|OPF_FLAGS },
-  { "cmpsw",OP_CMPS,   0, 0, OPF_DATA|OPF_FLAGS },
-  { "cmpsd",OP_CMPS,   0, 0, OPF_DATA|OPF_FLAGS },
-  { "scasb",OP_SCAS,   0, 0, OPF_DATA|OPF_FLAGS },
-  { "scasw",OP_SCAS,   0, 0, OPF_DATA|OPF_FLAGS },
-  { "scasd",OP_SCAS,   0, 0, OPF_DATA|OPF_FLAGS },
-  { "std",  OP_STD,    0, 0, OPF_DATA }, // special flag
-  { "cld",  OP_CLD,    0, 0, OPF_DATA },
-  { "add",  OP_ADD,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "sub",  OP_SUB,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "and",  OP_AND,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "or",   OP_OR,     2, 2, OPF_DATA|OPF_FLAGS },
-  { "xor",  OP_XOR,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "shl",  OP_SHL,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "shr",  OP_SHR,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "sal",  OP_SHL,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "sar",  OP_SAR,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "shrd", OP_SHRD,   3, 3, OPF_DATA|OPF_FLAGS },
-  { "rol",  OP_ROL,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "ror",  OP_ROR,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "rcl",  OP_RCL,    2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C },
-  { "rcr",  OP_RCR,    2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C },
-  { "adc",  OP_ADC,    2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C },
-  { "sbb",  OP_SBB,    2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C },
-  { "bsf",  OP_BSF,    2, 2, OPF_DATA|OPF_FLAGS },
-  { "inc",  OP_INC,    1, 1, OPF_DATA|OPF_FLAGS },
-  { "dec",  OP_DEC,    1, 1, OPF_DATA|OPF_FLAGS },
-  { "neg",  OP_NEG,    1, 1, OPF_DATA|OPF_FLAGS },
-  { "mul",  OP_MUL,    1, 1, OPF_DATA|OPF_FLAGS },
-  { "imul", OP_IMUL,   1, 3, OPF_DATA|OPF_FLAGS },
-  { "div",  OP_DIV,    1, 1, OPF_DATA|OPF_FLAGS },
-  { "idiv", OP_IDIV,   1, 1, OPF_DATA|OPF_FLAGS },
-  { "test", OP_TEST,   2, 2, OPF_FLAGS },
-  { "cmp",  OP_CMP,    2, 2, OPF_FLAGS },
-  { "retn", OP_RET,    0, 1, OPF_TAIL },
-  { "call", OP_CALL,   1, 1, OPF_JMP|OPF_DATA|OPF_FLAGS },
-  { "jmp",  OP_JMP,    1, 1, OPF_JMP },
-  { "jecxz",OP_JECXZ,  1, 1, OPF_JMP|OPF_CJMP },
-  { "jo",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_O,  0 }, // 70 OF=1
-  { "jno",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_O,  1 }, // 71 OF=0
-  { "jc",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_C,  0 }, // 72 CF=1
-  { "jb",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_C,  0 }, // 72
-  { "jnc",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_C,  1 }, // 73 CF=0
-  { "jnb",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_C,  1 }, // 73
-  { "jae",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_C,  1 }, // 73
-  { "jz",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_Z,  0 }, // 74 ZF=1
-  { "je",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_Z,  0 }, // 74
-  { "jnz",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_Z,  1 }, // 75 ZF=0
-  { "jne",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_Z,  1 }, // 75
-  { "jbe",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_BE, 0 }, // 76 CF=1||ZF=1
-  { "jna",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_BE, 0 }, // 76
-  { "ja",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_BE, 1 }, // 77 CF=0&&ZF=0
-  { "jnbe", OP_JCC,    1, 1, OPF_CJMP_CC, PFO_BE, 1 }, // 77
-  { "js",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_S,  0 }, // 78 SF=1
-  { "jns",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_S,  1 }, // 79 SF=0
-  { "jp",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_P,  0 }, // 7a PF=1
-  { "jpe",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_P,  0 }, // 7a
-  { "jnp",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_P,  1 }, // 7b PF=0
-  { "jpo",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_P,  1 }, // 7b
-  { "jl",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_L,  0 }, // 7c SF!=OF
-  { "jnge", OP_JCC,    1, 1, OPF_CJMP_CC, PFO_L,  0 }, // 7c
-  { "jge",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_L,  1 }, // 7d SF=OF
-  { "jnl",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_L,  1 }, // 7d
-  { "jle",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_LE, 0 }, // 7e ZF=1||SF!=OF
-  { "jng",  OP_JCC,    1, 1, OPF_CJMP_CC, PFO_LE, 0 }, // 7e
-  { "jg",   OP_JCC,    1, 1, OPF_CJMP_CC, PFO_LE, 1 }, // 7f ZF=0&&SF=OF
-  { "jnle", OP_JCC,    1, 1, OPF_CJMP_CC, PFO_LE, 1 }, // 7f
-  { "seto",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_O,  0 },
-  { "setno",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_O,  1 },
-  { "setc",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_C,  0 },
-  { "setb",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_C,  0 },
-  { "setnc",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_C,  1 },
-  { "setae",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_C,  1 },
-  { "setnb",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_C,  1 },
-  { "setz",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_Z,  0 },
-  { "sete",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_Z,  0 },
-  { "setnz",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_Z,  1 },
-  { "setne",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_Z,  1 },
-  { "setbe",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_BE, 0 },
-  { "setna",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_BE, 0 },
-  { "seta",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_BE, 1 },
-  { "setnbe", OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_BE, 1 },
-  { "sets",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_S,  0 },
-  { "setns",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_S,  1 },
-  { "setp",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_P,  0 },
-  { "setpe",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_P,  0 },
-  { "setnp",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_P,  1 },
-  { "setpo",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_P,  1 },
-  { "setl",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_L,  0 },
-  { "setnge", OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_L,  0 },
-  { "setge",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_L,  1 },
-  { "setnl",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_L,  1 },
-  { "setle",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_LE, 0 },
-  { "setng",  OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_LE, 0 },
-  { "setg",   OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_LE, 1 },
-  { "setnle", OP_SCC,  1, 1, OPF_DATA|OPF_CC, PFO_LE, 1 },
+#define OP(name, op, minopr, maxopr, flags, pfo, pfo_inv) \
+  { name, op, minopr, maxopr, flags, pfo, pfo_inv },
+#include "x86_ops.h"
 };
 
-static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
+static void parse_op(struct parsed_op *op, char **words, int wordc)
 {
   enum opr_lenmod lmod = OPLM_UNSPEC;
   int prefix_flags = 0;
@@ -921,12 +1316,12 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
   int w = 0;
   int i;
 
-  for (i = 0; i < ARRAY_SIZE(pref_table); i++) {
-    if (IS(words[w], pref_table[i].name)) {
-      prefix_flags = pref_table[i].flags;
-      break;
-    }
-  }
+  for (i = 0; i < ARRAY_SIZE(op->operand); i++)
+    op->operand[i].name = g_sym_empty;
+
+  i = opdec_prefix(words[w]);
+  if (i >= 0)
+    prefix_flags = pref_table[i].flags;
 
   if (prefix_flags) {
     if (wordc <= 1)
@@ -935,12 +1330,8 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
   }
 
   op_w = w;
-  for (i = 0; i < ARRAY_SIZE(op_table); i++) {
-    if (IS(words[w], op_table[i].name))
-      break;
-  }
-
-  if (i == ARRAY_SIZE(op_table))
+  i = opdec_op(words[w]);
+  if (i < 0)
     aerr("unhandled op: '%s'\n", words[0]);
   w++;
 
@@ -956,8 +1347,15 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
     w = parse_operand(&op->operand[opr], &regmask, &regmask_ind,
       words, wordc, w, op->flags);
 
-    if (opr == 0 && (op->flags & OPF_DATA))
+    if (opr == 0 && (op->flags & OPF_DATA)) {
       op->regmask_dst = regmask;
+      // whole reg overwritten, old value not read
+      if ((op->op == OP_MOV || op->op == OP_LEA || op->op == OP_MOVZX
+           || op->op == OP_MOVSX || op->op == OP_POP)
+          && op->operand[0].type == OPT_REG
+          && op->operand[0].lmod == OPLM_DWORD)
+        regmask = 0;
+    }
     // for now, mark dst as src too
     op->regmask_src |= regmask | regmask_ind;
   }
@@ -1086,7 +1484,7 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
     if (op->operand[0].type == OPT_REG && op->operand[1].type == OPT_REG
      && op->operand[0].lmod == op->operand[1].lmod
      && op->operand[0].reg == op->operand[1].reg
-     && IS(op->operand[0].name, op->operand[1].name)) // ah, al..
+     && op->operand[0].name == op->operand[1].name) // ah, al..
     {
       op->flags |= OPF_RMD;
       op->regmask_src = op->regmask_dst = 0;
@@ -1116,7 +1514,7 @@ static void parse_op(struct parsed_op *op, char words[16][256], int wordc)
 
 static const char *op_name(struct parsed_op *po)
 {
-  static char buf[16];
+  static __thread char buf[16];
   char *p;
   int i;
 
@@ -1139,7 +1537,7 @@ static const char *op_name(struct parsed_op *po)
 // debug
 static const char *dump_op(struct parsed_op *po)
 {
-  static char out[128];
+  static __thread char out[128];
   char *p = out;
   int i;
 
@@ -1272,7 +1670,7 @@ static const char *opr_reg_p(struct parsed_op *po, struct parsed_opr *popr)
 // cast1 is the "final" cast
 static const char *simplify_cast(const char *cast1, const char *cast2)
 {
-  static char buf[256];
+  static __thread char buf[256];
 
   if (cast1[0] == 0)
     return cast2;
@@ -1335,17 +1733,17 @@ static struct parsed_equ *equ_find(struct parsed_op *po, const char *name,
       ferr(po, "equ parse failed for '%s'\n", name);
   }
 
-  for (i = 0; i < g_eqcnt; i++)
-    if (strncmp(g_eqs[i].name, name, namelen) == 0
-     && g_eqs[i].name[namelen] == 0)
+  for (i = 0; i < g_ctx->eqcnt; i++)
+    if (strncmp(g_ctx->eqs[i].name, name, namelen) == 0
+     && g_ctx->eqs[i].name[namelen] == 0)
       break;
-  if (i >= g_eqcnt) {
+  if (i >= g_ctx->eqcnt) {
     if (po != NULL)
       ferr(po, "unresolved equ name: '%s'\n", name);
     return NULL;
   }
 
-  return &g_eqs[i];
+  return &g_ctx->eqs[i];
 }
 
 static int is_stack_access(struct parsed_op *po,
@@ -1634,7 +2032,7 @@ static const char *check_label_read_ref(struct parsed_op *po,
 {
   const struct parsed_proto *pp;
 
-  pp = proto_parse(g_fhdr, name, 0);
+  pp = proto_parse_sym(name, 0);
   if (pp == NULL)
     ferr(po, "proto_parse failed for ref '%s'\n", name);
 
@@ -1648,11 +2046,9 @@ static char *out_src_opr(char *buf, size_t buf_size,
   struct parsed_op *po, struct parsed_opr *popr, const char *cast,
   int is_lea)
 {
-  char tmp1[256], tmp2[256];
-  char expr[256];
-  const char *name;
-  char *p;
-  int ret;
+  const char *name, *expr, *p, *idx, *end;
+  char tmp1[32];
+  int len;
 
   if (cast == NULL)
     cast = "";
@@ -1690,21 +2086,24 @@ static char *out_src_opr(char *buf, size_t buf_size,
       break;
     }
 
-    strcpy(expr, popr->name);
-    if (strchr(expr, '[')) {
+    expr = popr->name;
+    idx = strchr(expr, '[');
+    if (idx != NULL) {
       // special case: '[' can only be left for label[reg] form
-      ret = sscanf(expr, "%[^[][%[^]]]", tmp1, tmp2);
-      if (ret != 2)
+      end = idx + 1 + strcspn(idx + 1, "]");
+      if (idx == expr || end == idx + 1)
         ferr(po, "parse failure for '%s'\n", expr);
-      if (tmp1[0] == '(') {
+      p = expr;
+      len = idx - expr;
+      if (p[0] == '(') {
         // (off_4FFF50+3)[eax]
-        p = strchr(tmp1 + 1, ')');
-        if (p == NULL || p[1] != 0)
+        if (memchr(p + 1, ')', len - 1) != idx - 1)
           ferr(po, "parse failure (2) for '%s'\n", expr);
-        *p = 0;
-        memmove(tmp1, tmp1 + 1, strlen(tmp1));
+        p++;
+        len -= 2;
       }
-      snprintf(expr, sizeof(expr), "(u32)&%s + %s", tmp1, tmp2);
+      expr = fsprintf("(u32)&%.*s + %.*s", len, p,
+        (int)(end - idx - 1), idx + 1);
     }
 
     // XXX: do we need more parsing?
@@ -1819,9 +2218,11 @@ static char *out_src_opr_u32(char *buf, size_t buf_size,
   return out_src_opr(buf, buf_size, po, popr, NULL, 0);
 }
 
-static void out_test_for_cc(char *buf, size_t buf_size,
-  struct parsed_op *po, enum parsed_flag_op pfo, int is_inv,
-  enum opr_lenmod lmod, const char *expr)
+// the conditions below are built in the arena,
+// operands combined they have no length limit
+static const char *out_test_for_cc(struct parsed_op *po,
+  enum parsed_flag_op pfo, int is_inv, enum opr_lenmod lmod,
+  const char *expr)
 {
   const char *cast, *scast;
 
@@ -1831,31 +2232,29 @@ static void out_test_for_cc(char *buf, size_t buf_size,
   switch (pfo) {
   case PFO_Z:
   case PFO_BE: // CF=1||ZF=1; CF=0
-    snprintf(buf, buf_size, "(%s%s %s 0)",
+    return fsprintf("(%s%s %s 0)",
       cast, expr, is_inv ? "!=" : "==");
-    break;
 
   case PFO_S:
   case PFO_L: // SF!=OF; OF=0
-    snprintf(buf, buf_size, "(%s%s %s 0)",
+    return fsprintf("(%s%s %s 0)",
       scast, expr, is_inv ? ">=" : "<");
-    break;
 
   case PFO_LE: // ZF=1||SF!=OF; OF=0
-    snprintf(buf, buf_size, "(%s%s %s 0)",
+    return fsprintf("(%s%s %s 0)",
       scast, expr, is_inv ? ">" : "<=");
-    break;
 
   default:
     ferr(po, "%s: unhandled parsed_flag_op: %d\n", __func__, pfo);
   }
 }
 
-static void out_cmp_for_cc(char *buf, size_t buf_size,
-  struct parsed_op *po, enum parsed_flag_op pfo, int is_inv)
+static const char *out_cmp_for_cc(struct parsed_op *po,
+  enum parsed_flag_op pfo, int is_inv)
 {
   const char *cast, *scast, *cast_use;
-  char buf1[256], buf2[256];
+  const char *cond = NULL;
+  char *buf1 = opr_buf(), *buf2 = opr_buf();
   enum opr_lenmod lmod;
 
   if (po->operand[0].lmod != po->operand[1].lmod)
@@ -1883,24 +2282,24 @@ static void out_cmp_for_cc(char *buf, size_t buf_size,
     ferr(po, "%s: unhandled parsed_flag_op: %d\n", __func__, pfo);
   }
 
-  out_src_opr(buf1, sizeof(buf1), po, &po->operand[0], cast_use, 0);
-  out_src_opr(buf2, sizeof(buf2), po, &po->operand[1], cast_use, 0);
+  out_src_opr(buf1, g_opr_bufsz, po, &po->operand[0], cast_use, 0);
+  out_src_opr(buf2, g_opr_bufsz, po, &po->operand[1], cast_use, 0);
 
   switch (pfo) {
   case PFO_C:
     // note: must be unsigned compare
-    snprintf(buf, buf_size, "(%s %s %s)",
+    cond = fsprintf("(%s %s %s)",
       buf1, is_inv ? ">=" : "<", buf2);
     break;
 
   case PFO_Z:
-    snprintf(buf, buf_size, "(%s %s %s)",
+    cond = fsprintf("(%s %s %s)",
       buf1, is_inv ? "!=" : "==", buf2);
     break;
 
   case PFO_BE: // !a
     // note: must be unsigned compare
-    snprintf(buf, buf_size, "(%s %s %s)",
+    cond = fsprintf("(%s %s %s)",
       buf1, is_inv ? ">" : "<=", buf2);
 
     // annoying case
@@ -1908,51 +2307,55 @@ static void out_cmp_for_cc(char *buf, size_t buf_size,
       && po->operand[1].type == OPT_CONST
       && po->operand[1].val == 0xff)
     {
-      snprintf(g_comment, sizeof(g_comment), "if %s", buf);
-      snprintf(buf, buf_size, "(0)");
+      snprintf(g_comment, sizeof(g_comment), "if %s", cond);
+      cond = "(0)";
     }
     break;
 
   // note: must be signed compare
   case PFO_S:
-    snprintf(buf, buf_size, "(%s(%s - %s) %s 0)",
+    cond = fsprintf("(%s(%s - %s) %s 0)",
       scast, buf1, buf2, is_inv ? ">=" : "<");
     break;
 
   case PFO_L: // !ge
-    snprintf(buf, buf_size, "(%s %s %s)",
+    cond = fsprintf("(%s %s %s)",
       buf1, is_inv ? ">=" : "<", buf2);
     break;
 
   case PFO_LE:
-    snprintf(buf, buf_size, "(%s %s %s)",
+    cond = fsprintf("(%s %s %s)",
       buf1, is_inv ? ">" : "<=", buf2);
     break;
 
   default:
     break;
   }
+
+  return cond;
 }
 
-static void out_cmp_test(char *buf, size_t buf_size,
-  struct parsed_op *po, enum parsed_flag_op pfo, int is_inv)
+static const char *out_cmp_test(struct parsed_op *po,
+  enum parsed_flag_op pfo, int is_inv)
 {
-  char buf1[256], buf2[256], buf3[256];
+  char *buf1 = opr_buf(), *buf2;
+  const char *expr;
 
   if (po->op == OP_TEST) {
     if (IS(opr_name(po, 0), opr_name(po, 1))) {
-      out_src_opr_u32(buf3, sizeof(buf3), po, &po->operand[0]);
+      expr = out_src_opr_u32(buf1, g_opr_bufsz, po, &po->operand[0]);
     }
     else {
-      out_src_opr_u32(buf1, sizeof(buf1), po, &po->operand[0]);
-      out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]);
-      snprintf(buf3, sizeof(buf3), "(%s & %s)", buf1, buf2);
+      buf2 = opr_buf();
+      out_src_opr_u32(buf1, g_opr_bufsz, po, &po->operand[0]);
+      out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]);
+      expr = fsprintf("(%s & %s)", buf1, buf2);
     }
-    out_test_for_cc(buf, buf_size, po, pfo, is_inv,
-      po->operand[0].lmod, buf3);
+    return out_test_for_cc(po, pfo, is_inv,
+      po->operand[0].lmod, expr);
   }
   else if (po->op == OP_CMP) {
-    out_cmp_for_cc(buf, buf_size, po, pfo, is_inv);
+    return out_cmp_for_cc(po, pfo, is_inv);
   }
   else
     ferr(po, "%s: unhandled op: %d\n", __func__, po->op);
@@ -2027,121 +2430,388 @@ static void op_set_clear_flag(struct parsed_op *po,
   || ((ops[_i].flags & (OPF_JMP|OPF_CJMP|OPF_RMD)) == OPF_JMP \
       && ops[_i].op != OP_CALL))
 
-static int scan_for_pop(int i, int opcnt, const char *reg,
-  int magic, int depth, int *maxdepth, int do_flags)
+// ends a basic block: branch (not removed), ret or tail call
+#define BB_END(_i) ((ops[_i].flags & OPF_TAIL) \
+  || ((ops[_i].flags & (OPF_JMP|OPF_RMD)) == OPF_JMP \
+      && ops[_i].op != OP_CALL))
+
+// blocks start at op 0, at referenced labels and after block ends;
+// preds/succs are ordered the way the op scans used to follow labels
+static void build_cfg(int opcnt)
 {
-  const struct parsed_proto *pp;
   struct parsed_op *po;
-  int ret = 0;
-  int j;
-
-  for (; i < opcnt; i++) {
-    po = &ops[i];
-    if (po->cc_scratch == magic)
-      break; // already checked
-    po->cc_scratch = magic;
-
-    if (po->flags & OPF_TAIL) {
-      if (po->op == OP_CALL) {
-        pp = proto_parse(g_fhdr, po->operand[0].name, 0);
-        if (pp != NULL && pp->is_noreturn)
-          // no stack cleanup for noreturn
-          return ret;
-      }
-      return -1; // deadend
-    }
+  struct bblock *bbs, *bb;
+  struct label_ref *lr;
+  int *op_bb, *stack, *next;
+  int b, i, j, n, sp, cnt = 0;
 
-    if ((po->flags & OPF_RMD)
-        || (po->op == OP_PUSH && po->p_argnum != 0)) // arg push
-      continue;
+  op_bb = fzalloc((opcnt + 1) * sizeof(op_bb[0]));
+  for (i = 0; i < opcnt; i++) {
+    if (i == 0 || g_label_refs[i].i != -1 || BB_END(i - 1))
+      cnt++;
+    op_bb[i] = cnt - 1;
+  }
 
-    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++) {
-          ret |= scan_for_pop(po->btj->d[j].bt_i, opcnt, reg, magic,
-                   depth, maxdepth, do_flags);
-          if (ret < 0)
-            return ret; // dead end
-        }
-        return ret;
-      }
+  bbs = fzalloc((cnt + 1) * sizeof(bbs[0]));
+  for (i = 0; i < opcnt; i++) {
+    bb = &bbs[op_bb[i]];
+    if (i == 0 || op_bb[i - 1] != op_bb[i])
+      bb->start = i;
+    bb->end = i + 1;
+  }
 
-      if (po->bt_i < 0) {
-        ferr(po, "dead branch\n");
-        return -1;
-      }
+  for (b = 0; b < cnt; b++) {
+    bb = &bbs[b];
+    po = &ops[bb->end - 1];
+    bb->rpo = -1;
 
-      if (po->flags & OPF_CJMP) {
-        ret |= scan_for_pop(po->bt_i, opcnt, reg, magic,
-                 depth, maxdepth, do_flags);
-        if (ret < 0)
-          return ret; // dead end
+    if (po->flags & OPF_TAIL)
+      ; // ret or tail call
+    else if (BB_END(bb->end - 1)) {
+      if (po->btj != NULL) {
+        bb->succ = fzalloc(po->btj->count * sizeof(bb->succ[0]));
+        for (j = 0; j < po->btj->count; j++)
+          if (po->btj->d[j].bt_i >= 0)
+            bb->succ[bb->succ_cnt++] = op_bb[po->btj->d[j].bt_i];
       }
       else {
-        i = po->bt_i - 1;
+        if (po->bt_i < 0)
+          ferr(po, "dead branch\n");
+        bb->succ = fzalloc(2 * sizeof(bb->succ[0]));
+        bb->succ[bb->succ_cnt++] = op_bb[po->bt_i];
+        if ((po->flags & OPF_CJMP) && bb->end < opcnt) {
+          bb->succ[bb->succ_cnt++] = b + 1;
+          bb->ft_succ = 1;
+        }
       }
-      continue;
     }
+    else if (bb->end < opcnt) {
+      bb->succ = fzalloc(sizeof(bb->succ[0]));
+      bb->succ[bb->succ_cnt++] = b + 1;
+      bb->ft_succ = 1;
+    }
+
+    i = bb->start;
+    bb->ft = i == 0 || !LAST_OP(i - 1);
+    n = bb->ft;
+    if (g_label_refs[i].i != -1)
+      for (lr = &g_label_refs[i]; lr != NULL; lr = lr->next)
+        n++;
+    bb->pred = fzalloc(n * sizeof(bb->pred[0]));
+    if (g_label_refs[i].i != -1)
+      for (lr = &g_label_refs[i]; lr != NULL; lr = lr->next)
+        bb->pred[bb->pred_cnt++] = op_bb[lr->i];
+    bb->jpred_cnt = bb->pred_cnt;
+    if (bb->ft && i > 0)
+      bb->pred[bb->pred_cnt++] = b - 1;
+  }
 
-    if ((po->op == OP_POP || po->op == OP_PUSH)
-        && po->operand[0].type == OPT_REG
-        && IS(po->operand[0].name, reg))
-    {
-      if (po->op == OP_PUSH && !(po->flags & OPF_FARG)) {
-        depth++;
-        if (depth > *maxdepth)
-          *maxdepth = depth;
-        if (do_flags)
-          op_set_clear_flag(po, OPF_RSAVE, OPF_RMD);
-      }
-      else if (po->op == OP_POP) {
-        if (depth == 0) {
-          if (do_flags)
-            op_set_clear_flag(po, OPF_RMD, OPF_RSAVE);
-          return 1;
-        }
-        else {
-          depth--;
-          if (depth < 0) // should not happen
-            ferr(po, "fail with depth\n");
-          if (do_flags)
-            op_set_clear_flag(po, OPF_RSAVE, OPF_RMD);
-        }
+  // reverse postorder, depth first from the entry
+  g_ctx->rpo = fzalloc((cnt + 1) * sizeof(g_ctx->rpo[0]));
+  stack = fzalloc((cnt + 1) * sizeof(stack[0]));
+  next = fzalloc((cnt + 1) * sizeof(next[0]));
+  n = cnt;
+  sp = 0;
+  if (cnt > 0) {
+    stack[sp++] = 0;
+    bbs[0].rpo = 0;
+  }
+  while (sp > 0) {
+    bb = &bbs[stack[sp - 1]];
+    if (next[sp - 1] < bb->succ_cnt) {
+      b = bb->succ[next[sp - 1]++];
+      if (bbs[b].rpo == -1) {
+        bbs[b].rpo = 0;
+        next[sp] = 0;
+        stack[sp++] = b;
       }
+      continue;
     }
+    g_ctx->rpo[--n] = stack[--sp];
   }
+  g_ctx->rpo += n;
+  g_ctx->rpo_cnt = cnt - n;
+  for (i = 0; i < g_ctx->rpo_cnt; i++)
+    bbs[g_ctx->rpo[i]].rpo = i;
+
+  g_ctx->exits = fzalloc((cnt + 1) * sizeof(g_ctx->exits[0]));
+  for (b = 0; b < cnt; b++)
+    if (bbs[b].succ_cnt == 0)
+      g_ctx->exits[g_ctx->exit_cnt++] = b;
+
+  g_ctx->bbs = g_bbs = bbs;
+  g_ctx->bb_cnt = cnt;
+  g_ctx->op_bb = g_op_bb = op_bb;
+}
 
-  return ret;
+// rdef values besides op indices
+#define RDEF_NONE  -1 // not reached (yet)
+#define RDEF_ENTRY -2 // function input
+#define RDEF_MANY  -3 // several defs meet
+#define RDEF_MANY_ENTRY -4 // several, function input among them
+
+static int rdef_meet(int a, int b)
+{
+  if (a == RDEF_NONE || a == b)
+    return b;
+  if (b == RDEF_NONE)
+    return a;
+  if (a == RDEF_ENTRY || a == RDEF_MANY_ENTRY
+   || b == RDEF_ENTRY || b == RDEF_MANY_ENTRY)
+    return RDEF_MANY_ENTRY;
+  return RDEF_MANY;
 }
 
-// scan for pop starting from 'ret' op (all paths)
-static int scan_for_pop_ret(int i, int opcnt, const char *reg,
-  int flag_set)
+// regs read/written by an op, as the C output sees it:
+// removed ops do nothing, calls read their reg args and the
+// pushes they took over, and trash eax, ecx, edx;
+// a push is only a read if it saves a call arg
+static void op_regs(const struct parsed_op *po, int *use, int *def)
 {
-  int found = 0;
-  int j;
+  const struct parsed_proto *pp;
+  const struct parsed_op *po_arg;
+  int arg, reg;
 
-  for (; i < opcnt; i++) {
-    if (!(ops[i].flags & OPF_TAIL))
-      continue;
+  *use = *def = 0;
+  if (po->flags & OPF_RMD)
+    return;
 
-    for (j = i - 1; j >= 0; j--) {
-      if (ops[j].flags & OPF_RMD)
+  *use = po->regmask_src;
+  *def = po->regmask_dst;
+  if (po->op == OP_CALL) {
+    pp = po->pp;
+    for (arg = 0; pp != NULL && arg < pp->argc; arg++) {
+      if (pp->arg[arg].reg == NULL) {
+        po_arg = call_arg_op(po, arg);
+        if (po_arg != NULL && (po_arg->flags & OPF_RMD))
+          *use |= po_arg->regmask_src;
         continue;
-      if (ops[j].flags & OPF_JMP)
-        return -1;
-
-      if (ops[j].op == OP_POP && ops[j].operand[0].type == OPT_REG
-          && IS(ops[j].operand[0].name, reg))
-      {
-        found = 1;
-        ops[j].flags |= flag_set;
-        break;
       }
-
-      if (g_labels[j][0] != 0)
-        return -1;
+      reg = char_array_i(regs_r32, ARRAY_SIZE(regs_r32), pp->arg[arg].reg);
+      if (reg >= 0)
+        *use |= 1 << reg;
+    }
+    *def |= (1 << xAX) | (1 << xCX) | (1 << xDX);
+  }
+  else if (po->op == OP_PUSH && po->p_argnum == 0)
+    *use = 0; // reg save or stack space
+  else if (po->op == OP_XOR && po->operand[0].type == OPT_REG
+    && IS(po->operand[0].name, po->operand[1].name))
+    *use = 0; // output as '= 0'
+}
+
+// liveness (backward) and reaching defs (forward) of the 8 regs
+// over the CFG, per op:
+// - live_in: regs that may be read from this op on before set
+// - rdef: the op whose reg value reaches this op, or RDEF_*
+static void solve_regs(int opcnt)
+{
+  struct parsed_op *ops_ = ops;
+  struct bblock *bbs = g_bbs, *bb;
+  unsigned char *use, *def, *b_use, *b_def, *b_live, *live_in;
+  int (*b_in)[8], (*b_out)[8], (*b_gen)[8], (*rdef)[8];
+  int bb_cnt = g_ctx->bb_cnt;
+  int rpo_cnt = g_ctx->rpo_cnt;
+  const int *rpo = g_ctx->rpo;
+  int cur[8];
+  int b, i, j, n, m, u, d, live, changed;
+
+  use = fzalloc(opcnt * 2 + bb_cnt * 3 + 1);
+  def = use + opcnt;
+  b_use = def + opcnt;
+  b_def = b_use + bb_cnt;
+  b_live = b_def + bb_cnt;
+  b_in = fzalloc((bb_cnt + 1) * 3 * sizeof(b_in[0]));
+  b_out = b_in + bb_cnt + 1;
+  b_gen = b_out + bb_cnt + 1;
+
+  for (b = 0; b < bb_cnt; b++) {
+    bb = &bbs[b];
+    for (j = 0; j < 8; j++)
+      b_gen[b][j] = b_in[b][j] = b_out[b][j] = RDEF_NONE;
+    for (i = bb->start; i < bb->end; i++) {
+      op_regs(&ops_[i], &u, &d);
+      use[i] = u;
+      def[i] = d;
+      b_use[b] |= u & ~b_def[b];
+      b_def[b] |= d;
+      for (m = d; m != 0; m &= m - 1)
+        b_gen[b][__builtin_ctz(m)] = i;
+    }
+  }
+
+  // reverse op order is close enough to postorder
+  do {
+    changed = 0;
+    for (b = bb_cnt - 1; b >= 0; b--) {
+      bb = &bbs[b];
+      for (live = 0, j = 0; j < bb->succ_cnt; j++)
+        live |= b_live[bb->succ[j]];
+      live = b_use[b] | (live & ~b_def[b]);
+      if (live != b_live[b]) {
+        b_live[b] = live;
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  // a reg value is either unique or many, so this settles fast
+  do {
+    changed = 0;
+    for (n = 0; n < rpo_cnt; n++) {
+      b = rpo[n];
+      bb = &bbs[b];
+      for (j = 0; j < 8; j++)
+        cur[j] = b == 0 ? RDEF_ENTRY : RDEF_NONE;
+      for (i = 0; i < bb->pred_cnt; i++) {
+        d = bb->pred[i];
+        for (j = 0; j < 8; j++)
+          cur[j] = rdef_meet(cur[j], b_out[d][j]);
+      }
+      if (memcmp(cur, b_in[b], sizeof(cur))) {
+        memcpy(b_in[b], cur, sizeof(cur));
+        for (j = 0; j < 8; j++)
+          b_out[b][j] = b_gen[b][j] != RDEF_NONE ? b_gen[b][j] : cur[j];
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  live_in = arena_alloc(&g_ctx->arena, opcnt + 1);
+  rdef = arena_alloc(&g_ctx->arena, (opcnt + 1) * sizeof(rdef[0]));
+  for (b = 0; b < bb_cnt; b++) {
+    bb = &bbs[b];
+    for (live = 0, j = 0; j < bb->succ_cnt; j++)
+      live |= b_live[bb->succ[j]];
+    for (i = bb->end - 1; i >= bb->start; i--) {
+      live = use[i] | (live & ~def[i]);
+      live_in[i] = live;
+    }
+
+    memcpy(cur, b_in[b], sizeof(cur));
+    for (i = bb->start; i < bb->end; i++) {
+      memcpy(rdef[i], cur, sizeof(cur));
+      for (m = def[i]; m != 0; m &= m - 1)
+        cur[__builtin_ctz(m)] = i;
+    }
+  }
+  g_ctx->live_in = live_in;
+  g_ctx->rdef = rdef;
+}
+
+// blocks are marked as visited from scratch_i on, entry is only
+// ever mid-block for the first one
+static int scan_for_pop(int i, int opcnt, const char *reg,
+  int magic, int depth, int *maxdepth, int do_flags)
+{
+  const struct parsed_proto *pp;
+  struct parsed_op *po;
+  struct bblock *bb;
+  int ret = 0;
+  int end, j;
+
+  g_ctx->tm.cnt[TMC_SCAN_POP]++;
+
+  while (i < opcnt) {
+    bb = &g_bbs[g_op_bb[i]];
+    end = bb->end;
+    if (bb->scratch == magic) {
+      if (i >= bb->scratch_i)
+        break; // already checked
+      end = bb->scratch_i;
+    }
+    bb->scratch = magic;
+    bb->scratch_i = i;
+
+    for (; i < end; i++) {
+      po = &ops[i];
+      if (po->flags & OPF_TAIL) {
+        if (po->op == OP_CALL) {
+          pp = proto_parse_sym(po->operand[0].name, 0);
+          if (pp != NULL && pp->is_noreturn)
+            // no stack cleanup for noreturn
+            return ret;
+        }
+        return -1; // deadend
+      }
+
+      if ((po->flags & OPF_RMD)
+          || (po->op == OP_PUSH && po->p_argnum != 0)) // arg push
+        continue;
+
+      if ((po->op == OP_POP || po->op == OP_PUSH)
+          && po->operand[0].type == OPT_REG
+          && po->operand[0].name == reg)
+      {
+        if (po->op == OP_PUSH && !(po->flags & OPF_FARG)) {
+          depth++;
+          if (depth > *maxdepth)
+            *maxdepth = depth;
+          if (do_flags)
+            op_set_clear_flag(po, OPF_RSAVE, OPF_RMD);
+        }
+        else if (po->op == OP_POP) {
+          if (depth == 0) {
+            if (do_flags)
+              op_set_clear_flag(po, OPF_RMD, OPF_RSAVE);
+            return 1;
+          }
+          else {
+            depth--;
+            if (depth < 0) // should not happen
+              ferr(po, "fail with depth\n");
+            if (do_flags)
+              op_set_clear_flag(po, OPF_RSAVE, OPF_RMD);
+          }
+        }
+      }
+    }
+    if (end != bb->end)
+      break; // reached the checked part
+
+    // branch targets first, then the last succ
+    // (fallthrough or the only target)
+    for (j = 0; j < bb->succ_cnt - 1; j++) {
+      ret |= scan_for_pop(g_bbs[bb->succ[j]].start, opcnt, reg, magic,
+               depth, maxdepth, do_flags);
+      if (ret < 0)
+        return ret; // dead end
+    }
+    if (bb->succ_cnt == 0)
+      break;
+    i = g_bbs[bb->succ[j]].start;
+  }
+
+  return ret;
+}
+
+// scan for pop starting from 'ret' op (all paths)
+static int scan_for_pop_ret(int i, int opcnt, const char *reg,
+  int flag_set)
+{
+  int found = 0;
+  int j;
+
+  for (; i < opcnt; i++) {
+    if (!(ops[i].flags & OPF_TAIL))
+      continue;
+
+    for (j = i - 1; j >= 0; j--) {
+      if (ops[j].flags & OPF_RMD)
+        continue;
+      if (ops[j].flags & OPF_JMP)
+        return -1;
+
+      if (ops[j].op == OP_POP && ops[j].operand[0].type == OPT_REG
+          && ops[j].operand[0].name == reg)
+      {
+        found = 1;
+        ops[j].flags |= flag_set;
+        break;
+      }
+
+      if (g_labels[j][0] != 0)
+        return -1;
     }
   }
 
@@ -2151,6 +2821,7 @@ static int scan_for_pop_ret(int i, int opcnt, const char *reg,
 static void scan_propagate_df(int i, int opcnt)
 {
   struct parsed_op *po = &ops[i];
+  struct bblock *bb;
   int j;
 
   for (; i < opcnt; i++) {
@@ -2163,22 +2834,24 @@ static void scan_propagate_df(int i, int opcnt)
       ferr(po, "call with DF set?\n");
 
     if (po->flags & OPF_JMP) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++)
-          scan_propagate_df(po->btj->d[j].bt_i, opcnt);
+      if (po->bt_i < 0 && po->btj == NULL) {
+        ferr(po, "dead branch\n");
         return;
       }
 
-      if (po->bt_i < 0) {
-        ferr(po, "dead branch\n");
+      // block end, targets from the CFG
+      bb = &g_bbs[g_op_bb[i]];
+      if (po->btj != NULL) {
+        // jumptable
+        for (j = 0; j < bb->succ_cnt; j++)
+          scan_propagate_df(g_bbs[bb->succ[j]].start, opcnt);
         return;
       }
 
       if (po->flags & OPF_CJMP)
-        scan_propagate_df(po->bt_i, opcnt);
+        scan_propagate_df(g_bbs[bb->succ[0]].start, opcnt);
       else
-        i = po->bt_i - 1;
+        i = g_bbs[bb->succ[0]].start - 1;
       continue;
     }
 
@@ -2220,7 +2893,7 @@ static int is_opr_modified(const struct parsed_opr *opr,
     }
   }
 
-  return IS(po->operand[0].name, opr->name);
+  return po->operand[0].name == opr->name;
 }
 
 // is any operand of parsed_op 'po_test' modified by parsed_op 'po'?
@@ -2250,7 +2923,7 @@ static int is_any_opr_modified(const struct parsed_op *po_test,
     return 1;
 
   for (i = 0; i < po_test->operand_cnt; i++)
-    if (IS(po_test->operand[i].name, po->operand[0].name))
+    if (po_test->operand[i].name == po->operand[0].name)
       return 1;
 
   return 0;
@@ -2283,145 +2956,314 @@ static int scan_for_mod_opr0(struct parsed_op *po_test,
   return -1;
 }
 
-static int scan_for_flag_set(int i, int magic, int *branched,
-  int *setters, int *setter_cnt)
-{
-  struct label_ref *lr;
-  int ret;
+// the last op of a block's j-th pred
+#define BB_PRED_OP(_bb, _j) (g_bbs[(_bb)->pred[_j]].end - 1)
 
-  while (i >= 0) {
-    if (ops[i].cc_scratch == magic) {
-      ferr(&ops[i], "%s looped\n", __func__);
-      return -1;
+// flag setters reaching each block, forward over the CFG.
+// Any OPF_FLAGS op (calls included) sets all the flags, so one
+// set serves every flag. Bit 0 stands for the function entry,
+// setters are numbered from 1 in op order.
+static void solve_flags(int opcnt)
+{
+  struct parsed_op *ops_ = ops;
+  struct bblock *bbs = g_bbs, *bb;
+  unsigned long long *in, *set, *set_p, v;
+  unsigned char *br;
+  int bb_cnt = g_ctx->bb_cnt;
+  int *fs_op, *fs_prev, *last;
+  int b, i, j, p, w, words, cnt, changed;
+
+  fs_prev = arena_alloc(&g_ctx->arena, (opcnt + 1) * sizeof(fs_prev[0]));
+  fs_op = arena_alloc(&g_ctx->arena, (opcnt + 1) * sizeof(fs_op[0]));
+  last = arena_alloc(&g_ctx->arena, (bb_cnt + 1) * sizeof(last[0]));
+  cnt = 1;
+  for (b = 0; b < bb_cnt; b++) {
+    bb = &bbs[b];
+    last[b] = -1;
+    for (i = bb->start; i < bb->end; i++) {
+      fs_prev[i] = last[b];
+      if (ops_[i].flags & OPF_FLAGS) {
+        fs_op[cnt++] = i;
+        last[b] = cnt - 1;
+      }
     }
-    ops[i].cc_scratch = magic;
-
-    if (g_labels[i][0] != 0) {
-      *branched = 1;
-
-      lr = &g_label_refs[i];
-      for (; lr->next; lr = lr->next) {
-        ret = scan_for_flag_set(lr->i, magic,
-                branched, setters, setter_cnt);
-        if (ret < 0)
-          return ret;
+  }
+  for (i = 0; i < opcnt; i++)
+    if (fs_prev[i] >= 0)
+      fs_prev[i] = fs_op[fs_prev[i]];
+
+  words = (cnt + 63) / 64;
+  in = fzalloc((bb_cnt + 1) * words * sizeof(in[0]));
+  br = fzalloc(bb_cnt + 1);
+
+  // sets only grow, so or-ing straight into them is enough
+  in[0] = 1;
+  do {
+    changed = 0;
+    for (b = 0; b < bb_cnt; b++) {
+      bb = &bbs[b];
+      set = in + b * words;
+      v = br[b] | (bb->jpred_cnt > 0);
+      for (j = 0; j < bb->pred_cnt; j++) {
+        p = bb->pred[j];
+        if (last[p] >= 0) {
+          w = last[p] / 64;
+          if (!(set[w] & (1ull << (last[p] % 64)))) {
+            set[w] |= 1ull << (last[p] % 64);
+            changed = 1;
+          }
+          continue;
+        }
+        set_p = in + p * words;
+        for (w = 0; w < words; w++) {
+          if (set_p[w] & ~set[w]) {
+            set[w] |= set_p[w];
+            changed = 1;
+          }
+        }
+        v |= br[p];
       }
-
-      if (i > 0 && LAST_OP(i - 1)) {
-        i = lr->i;
-        continue;
+      if (v != br[b]) {
+        br[b] = v;
+        changed = 1;
       }
-      ret = scan_for_flag_set(lr->i, magic,
-              branched, setters, setter_cnt);
-      if (ret < 0)
-        return ret;
     }
-    i--;
+  } while (changed);
+
+  g_ctx->fs_in = in;
+  g_ctx->fs_words = words;
+  g_ctx->fs_op = fs_op;
+  g_ctx->fs_prev = fs_prev;
+  g_ctx->fs_br = br;
+}
+
+// flag setters reaching op i, in op order;
+// *branched if they may come through a jump target,
+// -1 if there is a path without one
+static int scan_for_flag_set(int i, int *branched,
+  int *setters, int setter_max, int *setter_cnt)
+{
+  const unsigned long long *set;
+  unsigned long long v;
+  int b, w, n;
+
+  g_ctx->tm.cnt[TMC_FLAG_SET]++;
+
+  if (g_ctx->fs_prev[i] >= 0) {
+    setters[(*setter_cnt)++] = g_ctx->fs_prev[i];
+    return 0;
+  }
+
+  b = g_op_bb[i];
+  *branched = g_ctx->fs_br[b];
+  set = g_ctx->fs_in + b * g_ctx->fs_words;
+  if (set[0] & 1)
+    return -1;
 
-    if (ops[i].flags & OPF_FLAGS) {
-      setters[*setter_cnt] = i;
+  for (w = 0; w < g_ctx->fs_words; w++) {
+    for (v = set[w]; v != 0; v &= v - 1) {
+      n = w * 64 + __builtin_ctzll(v);
+      if (*setter_cnt < setter_max)
+        setters[*setter_cnt] = g_ctx->fs_op[n];
       (*setter_cnt)++;
-      return 0;
     }
-
-    if ((ops[i].flags & (OPF_JMP|OPF_CJMP)) == OPF_JMP)
-      return -1;
   }
 
-  return -1;
+  return 0;
 }
 
-// scan back for cdq, if anything modifies edx, fail
+// the cdq that edx at op i comes from (on all paths), or -1
 static int scan_for_cdq_edx(int i)
 {
-  while (i >= 0) {
-    if (g_labels[i][0] != 0) {
-      if (g_label_refs[i].next != NULL)
-        return -1;
-      if (i > 0 && LAST_OP(i - 1)) {
-        i = g_label_refs[i].i;
-        continue;
-      }
-      return -1;
-    }
-    i--;
-
-    if (ops[i].op == OP_CDQ)
-      return i;
+  int d = g_ctx->rdef[i][xDX];
 
-    if (ops[i].regmask_dst & (1 << xDX))
-      return -1;
-  }
+  if (d >= 0 && ops[d].op == OP_CDQ)
+    return d;
 
   return -1;
 }
 
+// the 'xor reg, reg' that reg at op i comes from, or -1
 static int scan_for_reg_clear(int i, int reg)
 {
-  while (i >= 0) {
-    if (g_labels[i][0] != 0) {
-      if (g_label_refs[i].next != NULL)
-        return -1;
-      if (i > 0 && LAST_OP(i - 1)) {
-        i = g_label_refs[i].i;
-        continue;
-      }
-      return -1;
-    }
-    i--;
+  int d = g_ctx->rdef[i][reg];
 
-    if (ops[i].op == OP_XOR
-     && ops[i].operand[0].lmod == OPLM_DWORD
-     && ops[i].operand[0].reg == ops[i].operand[1].reg
-     && ops[i].operand[0].reg == reg)
-      return i;
+  if (d >= 0 && ops[d].op == OP_XOR
+   && ops[d].operand[0].lmod == OPLM_DWORD
+   && ops[d].operand[0].reg == ops[d].operand[1].reg
+   && ops[d].operand[0].reg == reg)
+    return d;
 
-    if (ops[i].regmask_dst & (1 << reg))
-      return -1;
+  return -1;
+}
+
+#define ESP_UNK 0x40000000 // not reached (yet)
+#define ESP_ANY 0x40000001 // paths merge at different depths
+
+// stack depth after op po, d before it
+static int esp_after_op(struct parsed_op *po, int d)
+{
+  // frame teardown, removed by pass1 or not
+  if (po->op == OP_LEAVE)
+    return 0;
+  if (po->op == OP_MOV
+      && po->operand[0].type == OPT_REG && po->operand[0].reg == xSP
+      && po->operand[1].type == OPT_REG && po->operand[1].reg == xBP)
+    return 0;
+
+  if ((po->flags & OPF_RMD) || d == ESP_ANY)
+    return d;
+
+  switch (po->op) {
+  case OP_PUSH:
+    return d + lmod_bytes(po, po->operand[0].lmod);
+  case OP_POP:
+    return d - lmod_bytes(po, po->operand[0].lmod);
+  case OP_ADD:
+  case OP_SUB:
+    if (po->operand[0].type != OPT_REG || po->operand[0].reg != xSP
+        || po->operand[1].type != OPT_CONST)
+      break;
+    if (po->op == OP_ADD)
+      return d - po->operand[1].val;
+    return d + po->operand[1].val;
+  case OP_CALL:
+    if (po->pp != NULL && po->pp->is_stdcall)
+      return d - po->pp->argc_stack * 4;
+    break;
+  default:
+    break;
   }
 
-  return -1;
+  return d;
+}
+
+// stack depth before each op, forward over the CFG. What pass1
+// took as the frame is not counted, so leave/'mov esp, ebp' go
+// back to 0; other esp writes (alignment, alloca) aren't tracked.
+// Where paths merge at different depths (like args left for the
+// epilogue to drop) it's ESP_ANY until the next reset, an error
+// only if find_esp_adjust() needs it. Unreachable blocks get their
+// own, starting from 0.
+static void solve_esp(int opcnt)
+{
+  struct bblock *bbs = g_bbs, *bb;
+  int bb_cnt = g_ctx->bb_cnt;
+  int *in, *esp_in, *done;
+  int b, d, i, j, n, s;
+  int pass = 0, changed;
+
+  in = arena_alloc(&g_ctx->arena, (bb_cnt + 1) * sizeof(in[0]));
+  done = arena_alloc(&g_ctx->arena, (bb_cnt + 1) * sizeof(done[0]));
+  esp_in = arena_alloc(&g_ctx->arena, (opcnt + 1) * sizeof(esp_in[0]));
+  for (b = 0; b < bb_cnt; b++) {
+    in[b] = ESP_UNK;
+    done[b] = 0;
+  }
+  if (bb_cnt > 0)
+    in[0] = 0;
+
+  // RPO has every forward pred done first, so another pass is
+  // only needed when a back edge changes a block's depth
+  do {
+    changed = 0;
+    pass++;
+    for (n = 0; n < g_ctx->rpo_cnt + bb_cnt; n++) {
+      if (n < g_ctx->rpo_cnt)
+        b = g_ctx->rpo[n];
+      else {
+        b = n - g_ctx->rpo_cnt;
+        if (bbs[b].rpo >= 0)
+          continue;
+      }
+      bb = &bbs[b];
+      if (in[b] == ESP_UNK)
+        in[b] = 0;
+      d = in[b];
+      for (i = bb->start; i < bb->end; i++) {
+        esp_in[i] = d;
+        d = esp_after_op(&ops[i], d);
+      }
+      done[b] = pass;
+
+      for (j = 0; j < bb->succ_cnt; j++) {
+        s = bb->succ[j];
+        if (in[s] == d || in[s] == ESP_ANY)
+          continue;
+        in[s] = in[s] == ESP_UNK ? d : ESP_ANY;
+        if (done[s] == pass)
+          changed = 1;
+      }
+    }
+  } while (changed);
+
+  g_ctx->esp_in = esp_in;
+}
+
+static void esp_known(int i)
+{
+  if (g_ctx->esp_in[i] == ESP_ANY)
+    ferr(&ops[i], "stack depth unknown, paths merge "
+      "at different depths\n");
 }
 
-// scan for positive, constant esp adjust
-static int scan_for_esp_adjust(int i, int opcnt, int *adj,
-  int *multipath)
+// the positive, constant esp adjust (or 'pop ecx') after call op i,
+// on the path straight on over cdecl calls; *adj is how much of the
+// stack it takes back, minus what earlier calls have claimed
+static int find_esp_adjust(int i, int opcnt, int *adj, int *multipath)
 {
+  const int *esp_in = g_ctx->esp_in;
   struct parsed_op *po;
-  int first_pop = -1;
+  struct bblock *bb;
+  int d = esp_in[i];
+  int steps = 0;
+  int j, k;
 
   *adj = *multipath = 0;
 
-  for (; i < opcnt; i++) {
-    po = &ops[i];
-
-    if (g_labels[i][0] != 0)
+  for (j = i + 1; j < opcnt; j++) {
+    bb = &g_bbs[g_op_bb[j]];
+    if (j == bb->start && bb->jpred_cnt > 0) {
       *multipath = 1;
+      if (++steps > g_ctx->bb_cnt)
+        break; // jmp loop
+    }
+    po = &ops[j];
 
     if (po->op == OP_ADD && po->operand[0].reg == xSP) {
       if (po->operand[1].type != OPT_CONST)
-        ferr(&ops[i], "non-const esp adjust?\n");
-      *adj += po->operand[1].val;
+        ferr(po, "non-const esp adjust?\n");
+      esp_known(i);
+      esp_known(j);
+      *adj = d - esp_in[j] + po->operand[1].val;
       if (*adj & 3)
-        ferr(&ops[i], "unaligned esp adjust: %x\n", *adj);
-      return i;
-    }
-    else if (po->op == OP_PUSH && !(po->flags & OPF_RMD)) {
-      //if (first_pop == -1)
-      //  first_pop = -2; // none
-      *adj -= lmod_bytes(po, po->operand[0].lmod);
+        ferr(po, "unaligned esp adjust: %x\n", *adj);
+      return j;
     }
     else if (po->op == OP_POP && !(po->flags & OPF_RMD)) {
       // seems like msvc only uses 'pop ecx' for stack realignment..
       if (po->operand[0].type != OPT_REG || po->operand[0].reg != xCX)
         break;
-      if (first_pop == -1 && *adj >= 0)
-        first_pop = i;
-      *adj += lmod_bytes(po, po->operand[0].lmod);
+      esp_known(i);
+      esp_known(j);
+      if (esp_in[j] > d)
+        continue; // some later call's arg
+
+      // probably 'pop ecx' was used..
+      *adj = d - esp_in[j];
+      for (k = j; k < opcnt && ops[k].op == OP_POP; k++) {
+        if (ops[k].operand[0].type != OPT_REG
+            || ops[k].operand[0].reg != xCX)
+          break;
+        if (!(ops[k].flags & OPF_RMD))
+          *adj += lmod_bytes(&ops[k], ops[k].operand[0].lmod);
+      }
+      return j;
     }
     else if (po->flags & (OPF_JMP|OPF_TAIL)) {
       if (po->op == OP_JMP && po->btj == NULL) {
-        i = po->bt_i - 1;
+        if (!(po->flags & OPF_RMD))
+          j = po->bt_i - 1;
         continue;
       }
       if (po->op != OP_CALL)
@@ -2433,43 +3275,36 @@ static int scan_for_esp_adjust(int i, int opcnt, int *adj,
     }
   }
 
-  if (first_pop >= 0) {
-    // probably 'pop ecx' was used..
-    return first_pop;
-  }
-
   return -1;
 }
 
+// block marks as in scan_for_pop()
 static void scan_fwd_set_flags(int i, int opcnt, int magic, int flags)
 {
-  struct parsed_op *po;
-  int j;
-
-  if (i < 0)
-    ferr(ops, "%s: followed bad branch?\n", __func__);
+  struct bblock *bb;
+  int end, j;
+
+  while (i < opcnt) {
+    bb = &g_bbs[g_op_bb[i]];
+    end = bb->end;
+    if (bb->scratch == magic) {
+      if (i >= bb->scratch_i)
+        return;
+      end = bb->scratch_i;
+    }
+    bb->scratch = magic;
+    bb->scratch_i = i;
 
-  for (; i < opcnt; i++) {
-    po = &ops[i];
-    if (po->cc_scratch == magic)
+    for (; i < end; i++)
+      ops[i].flags |= flags;
+    if (end != bb->end)
       return;
-    po->cc_scratch = magic;
-    po->flags |= flags;
-
-    if ((po->flags & OPF_JMP) && po->op != OP_CALL) {
-      if (po->btj != NULL) {
-        // jumptable
-        for (j = 0; j < po->btj->count; j++)
-          scan_fwd_set_flags(po->btj->d[j].bt_i, opcnt, magic, flags);
-        return;
-      }
 
-      scan_fwd_set_flags(po->bt_i, opcnt, magic, flags);
-      if (!(po->flags & OPF_CJMP))
-        return;
-    }
-    if (po->flags & OPF_TAIL)
+    for (j = 0; j < bb->succ_cnt - 1; j++)
+      scan_fwd_set_flags(g_bbs[bb->succ[j]].start, opcnt, magic, flags);
+    if (bb->succ_cnt == 0)
       return;
+    i = g_bbs[bb->succ[j]].start;
   }
 }
 
@@ -2477,10 +3312,9 @@ static const struct parsed_proto *try_recover_pp(
   struct parsed_op *po, const struct parsed_opr *opr, int *search_instead)
 {
   const struct parsed_proto *pp = NULL;
-  char buf[256];
-  char *p;
+  char *buf, *p;
 
-  // maybe an arg of g_func?
+  // maybe an arg of g_ctx->func?
   if (opr->type == OPT_REGMEM && is_stack_access(po, opr))
   {
     char ofs_reg[16] = { 0, };
@@ -2517,13 +3351,13 @@ static const struct parsed_proto *try_recover_pp(
   }
   else if (opr->type == OPT_REGMEM && strchr(opr->name + 1, '[')) {
     // label[index]
-    p = strchr(opr->name + 1, '[');
-    memcpy(buf, opr->name, p - opr->name);
-    buf[p - opr->name] = 0;
+    buf = fstrdup(opr->name);
+    p = strchr(buf + 1, '[');
+    *p = 0;
     pp = proto_parse(g_fhdr, buf, 0);
   }
   else if (opr->type == OPT_OFFSET || opr->type == OPT_LABEL) {
-    pp = proto_parse(g_fhdr, opr->name, 0);
+    pp = proto_parse_sym(opr->name, 0);
     if (pp == NULL)
       ferr(po, "proto_parse failed for icall from '%s'\n", opr->name);
     check_func_pp(po, pp, "reg-fptr ref");
@@ -2537,16 +3371,17 @@ static void scan_for_call_type(int i, const struct parsed_opr *opr,
 {
   const struct parsed_proto *pp = NULL;
   struct parsed_op *po;
-  struct label_ref *lr;
+  struct bblock *bb;
+  int j;
 
   ops[i].cc_scratch = magic;
 
   while (1) {
-    if (g_labels[i][0] != 0) {
-      lr = &g_label_refs[i];
-      for (; lr != NULL; lr = lr->next)
-        scan_for_call_type(lr->i, opr, magic, pp_found, multi);
-      if (i > 0 && LAST_OP(i - 1))
+    bb = &g_bbs[g_op_bb[i]];
+    if (i == bb->start && bb->jpred_cnt > 0) {
+      for (j = 0; j < bb->jpred_cnt; j++)
+        scan_for_call_type(BB_PRED_OP(bb, j), opr, magic, pp_found, multi);
+      if (!bb->ft)
         return;
     }
 
@@ -2643,17 +3478,18 @@ static const struct parsed_proto *resolve_icall(int i, int opcnt,
 static int resolve_origin(int i, const struct parsed_opr *opr,
   int magic, int *op_i)
 {
-  struct label_ref *lr;
+  struct bblock *bb;
   int ret = 0;
+  int j;
 
   ops[i].cc_scratch = magic;
 
   while (1) {
-    if (g_labels[i][0] != 0) {
-      lr = &g_label_refs[i];
-      for (; lr != NULL; lr = lr->next)
-        ret |= resolve_origin(lr->i, opr, magic, op_i);
-      if (i > 0 && LAST_OP(i - 1))
+    bb = &g_bbs[g_op_bb[i]];
+    if (i == bb->start && bb->jpred_cnt > 0) {
+      for (j = 0; j < bb->jpred_cnt; j++)
+        ret |= resolve_origin(BB_PRED_OP(bb, j), opr, magic, op_i);
+      if (!bb->ft)
         return ret;
     }
 
@@ -2701,229 +3537,301 @@ static int try_resolve_const(int i, const struct parsed_opr *opr,
   return -1;
 }
 
-static int collect_call_args_r(struct parsed_op *po, int i,
-  struct parsed_proto *pp, int *regmask, int *save_arg_vars, int arg,
-  int magic, int need_op_saving, int may_reuse)
+// walk back from call op i for the pushes of its stack args.
+// At a jump target the other preds get walks of their own, which
+// run (depth first, in pred order) before this one goes on.
+// Blocks are entered at their last op only (but for the call's
+// own), so marking them there is enough to stop any later walk
+// that gets to one again; it must come with the same arg number.
+// Returns the first walk's arg count, 0 if it stopped on a mark.
+static int collect_call_args_walks(struct parsed_op *po, int i,
+  const struct parsed_proto *pp, int *regmask, int *save_arg_vars,
+  int magic)
 {
-  struct parsed_proto *pp_tmp;
-  struct label_ref *lr;
+  const struct parsed_proto *pp_tmp;
+  struct arg_walk *walks, *w;
+  struct bblock *bb;
   int need_to_save_current;
+  int need_op_saving;
+  int may_reuse;
   int save_args;
-  int ret = 0;
+  int ret = 0, result = 0;
+  int arg, arg0, seen;
+  int first = 1;
+  int resume;
+  int from;
   int reg;
   char buf[32];
-  int j, k;
-
-  if (i < 0) {
-    ferr(po, "dead label encountered\n");
-    return -1;
+  int j, k, n, p, sp;
+
+  walks = g_ctx->arg_walks;
+  if (walks == NULL) {
+    // a block is split once per call, its walk making room for
+    // one per jump pred
+    for (j = n = 0; j < g_ctx->bb_cnt; j++)
+      n += g_bbs[j].jpred_cnt;
+    walks = arena_alloc(&g_ctx->arena, (n + 1) * sizeof(walks[0]));
+    g_ctx->arg_walks = walks;
   }
 
-  for (; arg < pp->argc; arg++)
+  for (arg = 0; arg < pp->argc; arg++)
     if (pp->arg[arg].reg == NULL)
       break;
-  magic = (magic & 0xffffff) | (arg << 24);
-
-  for (j = i; j >= 0 && (arg < pp->argc || pp->is_unresolved); )
-  {
-    if (((ops[j].cc_scratch ^ magic) & 0xffffff) == 0) {
-      if (ops[j].cc_scratch != magic) {
-        ferr(&ops[j], "arg collect hit same path with diff args for %s\n",
-           pp->name);
-        return -1;
-      }
-      // ok: have already been here
-      return 0;
-    }
-    ops[j].cc_scratch = magic;
-
-    if (g_labels[j][0] != 0 && g_label_refs[j].i != -1) {
-      lr = &g_label_refs[j];
-      if (lr->next != NULL)
-        need_op_saving = 1;
-      for (; lr->next; lr = lr->next) {
-        if ((ops[lr->i].flags & (OPF_JMP|OPF_CJMP)) != OPF_JMP)
-          may_reuse = 1;
-        ret = collect_call_args_r(po, lr->i, pp, regmask, save_arg_vars,
-                arg, magic, need_op_saving, may_reuse);
-        if (ret < 0)
-          return ret;
-      }
-
-      if ((ops[lr->i].flags & (OPF_JMP|OPF_CJMP)) != OPF_JMP)
-        may_reuse = 1;
-      if (j > 0 && LAST_OP(j - 1)) {
-        // follow last branch in reverse
-        j = lr->i;
-        continue;
-      }
-      need_op_saving = 1;
-      ret = collect_call_args_r(po, lr->i, pp, regmask, save_arg_vars,
-               arg, magic, need_op_saving, may_reuse);
-      if (ret < 0)
-        return ret;
-    }
-    j--;
-
-    if (ops[j].op == OP_CALL)
+  arg0 = arg;
+
+  w = &walks[0];
+  w->from = w->j = i;
+  w->arg = arg;
+  w->need_op_saving = w->may_reuse = 0;
+  w->main = 1;
+  w->resume = 0;
+  sp = 1;
+  g_ctx->tm.cnt[TMC_CALL_ARGS]++;
+
+  while (sp > 0) {
+    w = &walks[--sp];
+    from = w->from;
+    j = w->j;
+    arg = w->arg;
+    need_op_saving = w->need_op_saving;
+    may_reuse = w->may_reuse;
+    resume = w->resume;
+
+    while (j >= 0 && (arg < pp->argc || pp->is_unresolved))
     {
-      if (pp->is_unresolved)
-        break;
+      if (!resume) {
+        bb = &g_bbs[g_op_bb[j]];
+        seen = -1;
+        if (j == po - ops)
+          seen = first ? -1 : arg0;
+        else if (j == bb->end - 1) {
+          if (bb->scratch == magic)
+            seen = bb->scratch_i;
+          bb->scratch = magic;
+          bb->scratch_i = arg;
+        }
+        first = 0;
 
-      pp_tmp = ops[j].pp;
-      if (pp_tmp == NULL)
-        ferr(po, "arg collect hit unparsed call '%s'\n",
-          ops[j].operand[0].name);
-      if (may_reuse && pp_tmp->argc_stack > 0)
-        ferr(po, "arg collect %d/%d hit '%s' with %d stack args\n",
-          arg, pp->argc, opr_name(&ops[j], 0), pp_tmp->argc_stack);
-    }
-    // esp adjust of 0 means we collected it before
-    else if (ops[j].op == OP_ADD && ops[j].operand[0].reg == xSP
-      && (ops[j].operand[1].type != OPT_CONST
-          || ops[j].operand[1].val != 0))
-    {
-      if (pp->is_unresolved)
-        break;
+        if (seen >= 0) {
+          if (seen != arg) {
+            ferr(&ops[j], "arg collect hit same path with diff args "
+              "for %s\n", pp->name);
+            return -1;
+          }
+          // ok: have already been here
+          goto next_walk;
+        }
 
-      ferr(po, "arg collect %d/%d hit esp adjust of %d\n",
-        arg, pp->argc, ops[j].operand[1].val);
-    }
-    else if (ops[j].op == OP_POP) {
-      if (pp->is_unresolved)
-        break;
+        if (j == bb->start && bb->jpred_cnt > 0) {
+          if (bb->jpred_cnt > 1)
+            need_op_saving = 1;
+
+          // a walk per pred to run before this one goes on,
+          // the first one on top
+          n = bb->jpred_cnt - !bb->ft;
+          for (k = 0; k < bb->jpred_cnt; k++) {
+            p = BB_PRED_OP(bb, k);
+            if ((ops[p].flags & (OPF_JMP|OPF_CJMP)) != OPF_JMP)
+              may_reuse = 1;
+            if (k == n)
+              break;
+            w = &walks[sp + n - k];
+            w->from = w->j = p;
+            w->arg = arg;
+            w->need_op_saving = need_op_saving || k == bb->jpred_cnt - 1;
+            w->may_reuse = may_reuse;
+            w->main = 0;
+            w->resume = 0;
+            g_ctx->tm.cnt[TMC_CALL_ARGS]++;
+          }
 
-      ferr(po, "arg collect %d/%d hit pop\n", arg, pp->argc);
-    }
-    else if (ops[j].flags & OPF_CJMP)
-    {
-      if (pp->is_unresolved)
-        break;
+          // this one goes on from the block above, or else
+          // follows last branch in reverse
+          w = &walks[sp];
+          w->j = bb->ft ? j : BB_PRED_OP(bb, n);
+          w->arg = arg;
+          w->need_op_saving = need_op_saving || bb->ft;
+          w->may_reuse = may_reuse;
+          w->resume = bb->ft;
+          sp += n + 1;
+          goto next_walk;
+        }
+      }
+      resume = 0;
 
-      may_reuse = 1;
-    }
-    else if (ops[j].op == OP_PUSH && !(ops[j].flags & OPF_FARG))
-    {
-      if (pp->is_unresolved && (ops[j].flags & OPF_RMD))
+      j--;
+      if (j < 0)
         break;
 
-      pp->arg[arg].datap = &ops[j];
-      need_to_save_current = 0;
-      save_args = 0;
-      reg = -1;
-      if (ops[j].operand[0].type == OPT_REG)
-        reg = ops[j].operand[0].reg;
+      if (ops[j].op == OP_CALL)
+      {
+        if (pp->is_unresolved)
+          break;
 
-      if (!need_op_saving) {
-        ret = scan_for_mod(&ops[j], j + 1, i, 1);
-        need_to_save_current = (ret >= 0);
+        pp_tmp = ops[j].pp;
+        if (pp_tmp == NULL)
+          ferr(po, "arg collect hit unparsed call '%s'\n",
+            ops[j].operand[0].name);
+        if (may_reuse && pp_tmp->argc_stack > 0)
+          ferr(po, "arg collect %d/%d hit '%s' with %d stack args\n",
+            arg, pp->argc, opr_name(&ops[j], 0), pp_tmp->argc_stack);
       }
-      if (need_op_saving || need_to_save_current) {
-        // mark this push as one that needs operand saving
-        ops[j].flags &= ~OPF_RMD;
-        if (ops[j].p_argnum == 0) {
-          ops[j].p_argnum = arg + 1;
-          save_args |= 1 << arg;
-        }
-        else if (ops[j].p_argnum < arg + 1) {
-          // XXX: might kill valid var..
-          //*save_arg_vars &= ~(1 << (ops[j].p_argnum - 1));
-          ops[j].p_argnum = arg + 1;
-          save_args |= 1 << arg;
-        }
+      // esp adjust of 0 means we collected it before
+      else if (ops[j].op == OP_ADD && ops[j].operand[0].reg == xSP
+        && (ops[j].operand[1].type != OPT_CONST
+            || ops[j].operand[1].val != 0))
+      {
+        if (pp->is_unresolved)
+          break;
+
+        ferr(po, "arg collect %d/%d hit esp adjust of %d\n",
+          arg, pp->argc, ops[j].operand[1].val);
       }
-      else if (ops[j].p_argnum == 0)
-        ops[j].flags |= OPF_RMD;
+      else if (ops[j].op == OP_POP) {
+        if (pp->is_unresolved)
+          break;
 
-      // some PUSHes are reused by different calls on other branches,
-      // but that can't happen if we didn't branch, so they
-      // can be removed from future searches (handles nested calls)
-      if (!may_reuse)
-        ops[j].flags |= OPF_FARG;
+        ferr(po, "arg collect %d/%d hit pop\n", arg, pp->argc);
+      }
+      else if (ops[j].flags & OPF_CJMP)
+      {
+        if (pp->is_unresolved)
+          break;
 
-      ops[j].flags &= ~OPF_RSAVE;
+        may_reuse = 1;
+      }
+      else if (ops[j].op == OP_PUSH && !(ops[j].flags & OPF_FARG))
+      {
+        if (pp->is_unresolved && (ops[j].flags & OPF_RMD))
+          break;
 
-      // check for __VALIST
-      if (!pp->is_unresolved && pp->arg[arg].type.is_va_list) {
-        k = -1;
-        ret = resolve_origin(j, &ops[j].operand[0], magic + 1, &k);
-        if (ret == 1 && k >= 0)
-        {
-          if (ops[k].op == OP_LEA) {
-            snprintf(buf, sizeof(buf), "arg_%X",
-              g_func_pp->argc_stack * 4);
-            if (!g_func_pp->is_vararg
-              || strstr(ops[k].operand[1].name, buf))
-            {
-              ops[k].flags |= OPF_RMD;
-              ops[j].flags |= OPF_RMD | OPF_VAPUSH;
-              save_args &= ~(1 << arg);
-              reg = -1;
-            }
-            else
-              ferr(&ops[j], "lea va_list used, but no vararg?\n");
+        call_arg_op_set(po, arg, &ops[j]);
+        need_to_save_current = 0;
+        save_args = 0;
+        reg = -1;
+        if (ops[j].operand[0].type == OPT_REG)
+          reg = ops[j].operand[0].reg;
+
+        if (!need_op_saving) {
+          ret = scan_for_mod(&ops[j], j + 1, from, 1);
+          need_to_save_current = (ret >= 0);
+        }
+        if (need_op_saving || need_to_save_current) {
+          // mark this push as one that needs operand saving
+          ops[j].flags &= ~OPF_RMD;
+          if (ops[j].p_argnum == 0) {
+            ops[j].p_argnum = arg + 1;
+            save_args |= 1 << arg;
           }
-          // check for va_list from g_func_pp arg too
-          else if (ops[k].op == OP_MOV
-            && is_stack_access(&ops[k], &ops[k].operand[1]))
+          else if (ops[j].p_argnum < arg + 1) {
+            // XXX: might kill valid var..
+            //*save_arg_vars &= ~(1 << (ops[j].p_argnum - 1));
+            ops[j].p_argnum = arg + 1;
+            save_args |= 1 << arg;
+          }
+        }
+        else if (ops[j].p_argnum == 0)
+          ops[j].flags |= OPF_RMD;
+
+        // some PUSHes are reused by different calls on other branches,
+        // but that can't happen if we didn't branch, so they
+        // can be removed from future searches (handles nested calls)
+        if (!may_reuse)
+          ops[j].flags |= OPF_FARG;
+
+        ops[j].flags &= ~OPF_RSAVE;
+
+        // check for __VALIST
+        if (!pp->is_unresolved && pp->arg[arg].type.is_va_list) {
+          k = -1;
+          ret = resolve_origin(j, &ops[j].operand[0],
+            (magic | (arg << 24)) + 1, &k);
+          if (ret == 1 && k >= 0)
           {
-            ret = stack_frame_access(&ops[k], &ops[k].operand[1],
-              buf, sizeof(buf), ops[k].operand[1].name, "", 1, 0);
-            if (ret >= 0) {
-              ops[k].flags |= OPF_RMD;
-              ops[j].flags |= OPF_RMD;
-              ops[j].p_argpass = ret + 1;
-              save_args &= ~(1 << arg);
-              reg = -1;
+            if (ops[k].op == OP_LEA) {
+              snprintf(buf, sizeof(buf), "arg_%X",
+                g_func_pp->argc_stack * 4);
+              if (!g_func_pp->is_vararg
+                || strstr(ops[k].operand[1].name, buf))
+              {
+                ops[k].flags |= OPF_RMD;
+                ops[j].flags |= OPF_RMD | OPF_VAPUSH;
+                save_args &= ~(1 << arg);
+                reg = -1;
+              }
+              else
+                ferr(&ops[j], "lea va_list used, but no vararg?\n");
+            }
+            // check for va_list from g_func_pp arg too
+            else if (ops[k].op == OP_MOV
+              && is_stack_access(&ops[k], &ops[k].operand[1]))
+            {
+              ret = stack_frame_access(&ops[k], &ops[k].operand[1],
+                buf, sizeof(buf), ops[k].operand[1].name, "", 1, 0);
+              if (ret >= 0) {
+                ops[k].flags |= OPF_RMD;
+                ops[j].flags |= OPF_RMD;
+                ops[j].p_argpass = ret + 1;
+                save_args &= ~(1 << arg);
+                reg = -1;
+              }
             }
           }
         }
-      }
 
-      *save_arg_vars |= save_args;
+        *save_arg_vars |= save_args;
 
-      // tracking reg usage
-      if (reg >= 0)
-        *regmask |= 1 << reg;
+        // tracking reg usage
+        if (reg >= 0)
+          *regmask |= 1 << reg;
 
-      arg++;
-      if (!pp->is_unresolved) {
-        // next arg
-        for (; arg < pp->argc; arg++)
-          if (pp->arg[arg].reg == NULL)
-            break;
+        arg++;
+        if (!pp->is_unresolved) {
+          // next arg
+          for (; arg < pp->argc; arg++)
+            if (pp->arg[arg].reg == NULL)
+              break;
+        }
       }
-      magic = (magic & 0xffffff) | (arg << 24);
     }
-  }
 
-  if (arg < pp->argc) {
-    ferr(po, "arg collect failed for '%s': %d/%d\n",
-      pp->name, arg, pp->argc);
-    return -1;
+    if (arg < pp->argc) {
+      ferr(po, "arg collect failed for '%s': %d/%d\n",
+        pp->name, arg, pp->argc);
+      return -1;
+    }
+    if (w->main)
+      result = arg;
+next_walk:
+    ;
   }
 
-  return arg;
+  return result;
 }
 
 static int collect_call_args(struct parsed_op *po, int i,
-  struct parsed_proto *pp, int *regmask, int *save_arg_vars,
-  int magic)
+  int *regmask, int *save_arg_vars, int magic)
 {
+  struct parsed_proto_arg *arg;
+  struct parsed_proto *pp;
   int ret;
   int a;
 
-  ret = collect_call_args_r(po, i, pp, regmask, save_arg_vars,
-          0, magic, 0, 0);
+  ret = collect_call_args_walks(po, i, po->pp, regmask, save_arg_vars,
+          magic);
   if (ret < 0)
     return ret;
 
-  if (pp->is_unresolved) {
+  if (po->pp->is_unresolved) {
+    pp = call_pp_mut(po);
+    arg = fzalloc((pp->argc + ret) * sizeof(arg[0]));
+    memcpy(arg, pp->arg, pp->argc * sizeof(arg[0]));
+    pp->arg = arg;
     pp->argc += ret;
     pp->argc_stack += ret;
     for (a = 0; a < pp->argc; a++)
       if (pp->arg[a].type.name == NULL)
-        pp->arg[a].type.name = strdup("int");
+        pp->arg[a].type.name = fstrdup("int");
   }
 
   return ret;
@@ -2945,24 +3853,95 @@ static int is_like_tailjmp(int j)
   return 0;
 }
 
-static void pp_insert_reg_arg(struct parsed_proto *pp, const char *reg)
+static void pp_insert_reg_arg(struct parsed_op *po, const char *reg)
 {
-  int i;
+  struct parsed_proto *pp = call_pp_mut(po);
+  struct parsed_proto_arg *arg;
+  int i, a;
 
   for (i = 0; i < pp->argc; i++)
     if (pp->arg[i].reg == NULL)
       break;
 
-  if (pp->argc_stack)
-    memmove(&pp->arg[i + 1], &pp->arg[i],
-      sizeof(pp->arg[0]) * pp->argc_stack);
-  memset(&pp->arg[i], 0, sizeof(pp->arg[i]));
-  pp->arg[i].reg = strdup(reg);
-  pp->arg[i].type.name = strdup("int");
+  arg = fzalloc((pp->argc + 1) * sizeof(arg[0]));
+  memcpy(arg, pp->arg, i * sizeof(arg[0]));
+  memcpy(&arg[i + 1], &pp->arg[i], (pp->argc - i) * sizeof(arg[0]));
+  pp->arg = arg;
+
+  // arg pushes move along
+  for (a = pp->argc - 1; a >= i; a--)
+    call_arg_op_set(po, a + 1, call_arg_op(po, a));
+  if (i < po->arg_ops_alloc)
+    po->arg_ops[i] = NULL;
+
+  pp->arg[i].reg = fstrdup(reg);
+  pp->arg[i].type.name = fstrdup("int");
   pp->argc++;
   pp->argc_reg++;
 }
 
+static void label_idx_reset(void)
+{
+  g_ctx->label_idx_gen++;
+  g_ctx->label_idx_cnt = 0;
+}
+
+// entries aren't removed when g_labels[] changes,
+// so each hit is checked against the current name
+static int label_idx_find(const char *name)
+{
+  unsigned int h = label_hash(name);
+  int i;
+
+  for (;; h++) {
+    h &= g_ctx->label_idx_size - 1;
+    if (g_ctx->label_idx[h].gen != g_ctx->label_idx_gen)
+      return -1;
+    i = g_ctx->label_idx[h].i;
+    if (g_labels[i][0] && IS(g_labels[i], name))
+      return i;
+  }
+}
+
+static void label_idx_insert(struct label_idx_ent *tab, int size, int i)
+{
+  unsigned int h = label_hash(g_labels[i]);
+
+  for (;; h++) {
+    h &= size - 1;
+    if (tab[h].gen != g_ctx->label_idx_gen)
+      break;
+  }
+  tab[h].i = i;
+  tab[h].gen = g_ctx->label_idx_gen;
+}
+
+static void label_idx_add(int i)
+{
+  struct label_idx_ent *tab;
+  int size, j;
+
+  // first one wins, like the linear search did
+  if (label_idx_find(g_labels[i]) != -1)
+    return;
+
+  if (g_ctx->label_idx_cnt >= g_ctx->label_idx_size / 2) {
+    size = g_ctx->label_idx_size * 2;
+    tab = mem_calloc(MEM_LABELS, size, sizeof(tab[0]));
+    my_assert_not(tab, NULL);
+    for (j = 0; j < g_ctx->label_idx_size; j++) {
+      if (g_ctx->label_idx[j].gen == g_ctx->label_idx_gen)
+        label_idx_insert(tab, size, g_ctx->label_idx[j].i);
+    }
+    mem_free(g_ctx->label_idx);
+    g_ctx->label_idx = tab;
+    g_ctx->label_idx_size = size;
+  }
+
+  label_idx_insert(g_ctx->label_idx, g_ctx->label_idx_size, i);
+  g_ctx->label_idx_cnt++;
+}
+
 static void add_label_ref(struct label_ref *lr, int op_i)
 {
   struct label_ref *lr_new;
@@ -2972,45 +3951,47 @@ static void add_label_ref(struct label_ref *lr, int op_i)
     return;
   }
 
-  lr_new = calloc(1, sizeof(*lr_new));
+  lr_new = fzalloc(sizeof(*lr_new));
   lr_new->i = op_i;
   lr_new->next = lr->next;
   lr->next = lr_new;
 }
 
-static void output_std_flags(FILE *fout, struct parsed_op *po,
+static void output_std_flags(struct outbuf *ob, struct parsed_op *po,
   int *pfomask, const char *dst_opr_text)
 {
   if (*pfomask & (1 << PFO_Z)) {
-    fprintf(fout, "\n  cond_z = (%s%s == 0);",
+    ob_printf(ob, "\n  cond_z = (%s%s == 0);",
       lmod_cast_u(po, po->operand[0].lmod), dst_opr_text);
     *pfomask &= ~(1 << PFO_Z);
   }
   if (*pfomask & (1 << PFO_S)) {
-    fprintf(fout, "\n  cond_s = (%s%s < 0);",
+    ob_printf(ob, "\n  cond_s = (%s%s < 0);",
       lmod_cast_s(po, po->operand[0].lmod), dst_opr_text);
     *pfomask &= ~(1 << PFO_S);
   }
 }
 
-static void output_pp_attrs(FILE *fout, const struct parsed_proto *pp,
+static void output_pp_attrs(struct outbuf *ob, const struct parsed_proto *pp,
   int is_noreturn)
 {
   if (pp->is_fastcall)
-    fprintf(fout, "__fastcall ");
+    ob_printf(ob, "__fastcall ");
   else if (pp->is_stdcall && pp->argc_reg == 0)
-    fprintf(fout, "__stdcall ");
+    ob_printf(ob, "__stdcall ");
   if (pp->is_noreturn || is_noreturn)
-    fprintf(fout, "noreturn ");
+    ob_printf(ob, "noreturn ");
 }
 
-static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
+static void gen_func(struct outbuf *ob, FILE *fhdr, const char *funcn, int opcnt)
 {
   struct parsed_op *po, *delayed_flag_op = NULL, *tmp_op;
   struct parsed_opr *last_arith_dst = NULL;
-  char buf1[256], buf2[256], buf3[256], cast[64];
-  const struct parsed_proto *pp_c;
-  struct parsed_proto *pp, *pp_tmp;
+  char *buf1, *buf2, *buf3, cast[64];
+  const char *cond;
+  const struct parsed_proto *pp_c, *pp;
+  struct parsed_proto *pp_m, *pp_tmp;
+  struct parsed_proto_arg *parg;
   struct parsed_data *pd;
   const char *tmpname;
   unsigned int uval;
@@ -3036,6 +4017,23 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
 
   g_bp_frame = g_sp_frame = g_stack_fsz = 0;
   g_stack_frame_used = 0;
+  g_comment[0] = 0; // a failed function may have left one
+  tm_start();
+
+  // operand text is the name and a few casts around it
+  for (i = l = 0; i < opcnt; i++) {
+    for (j = 0; j < ops[i].operand_cnt; j++) {
+      if (ops[i].operand[j].name == NULL)
+        continue;
+      ret = strlen(ops[i].operand[j].name);
+      if (ret > l)
+        l = ret;
+    }
+  }
+  g_opr_bufsz = l + 256;
+  buf1 = opr_buf();
+  buf2 = opr_buf();
+  buf3 = opr_buf();
 
   g_func_pp = proto_parse(fhdr, funcn, 0);
   if (g_func_pp == NULL)
@@ -3110,7 +4108,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       {
         ops[j].flags |= OPF_RMD;
       }
-      else if (!(g_ida_func_attr & IDAFA_NORETURN))
+      else if (!(g_ctx->ida_func_attr & IDAFA_NORETURN))
         ferr(&ops[j], "'pop ebp' expected\n");
 
       if (g_stack_fsz != 0) {
@@ -3121,7 +4119,7 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
           ops[j - 1].flags |= OPF_RMD;
         }
         else if (ops[j].op != OP_LEAVE
-          && !(g_ida_func_attr & IDAFA_NORETURN))
+          && !(g_ctx->ida_func_attr & IDAFA_NORETURN))
         {
           ferr(&ops[j - 1], "esp restore expected\n");
         }
@@ -3208,6 +4206,8 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
     }
   }
 
+  tm_mark(TM_PASS1);
+
   // pass2:
   // - parse calls with labels
   // - resolve all branches
@@ -3227,22 +4227,24 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
         tmpname = opr_name(po, 0);
         if (IS_START(tmpname, "loc_"))
           ferr(po, "call to loc_*\n");
-        pp_c = proto_parse(fhdr, tmpname, 0);
-        if (pp_c == NULL)
+        pp = proto_parse_sym(tmpname, 0);
+        if (pp == NULL)
           ferr(po, "proto_parse failed for call '%s'\n", tmpname);
-
-        pp = proto_clone(pp_c);
-        my_assert_not(pp, NULL);
       }
       else if (po->datap != NULL) {
-        pp = calloc(1, sizeof(*pp));
-        my_assert_not(pp, NULL);
+        pp_tmp = mem_calloc(MEM_PROTO, 1, sizeof(*pp_tmp));
+        my_assert_not(pp_tmp, NULL);
 
-        ret = parse_protostr(po->datap, pp);
+        pp_srcfn = asmfn;
+        hdrfline = po->asmln;
+        ret = parse_protostr(po->datap, pp_tmp);
         if (ret < 0)
           ferr(po, "bad protostr supplied: %s\n", (char *)po->datap);
-        free(po->datap);
+        mem_free(po->datap);
         po->datap = NULL;
+        pp = fproto_clone(pp_tmp);
+        proto_release(pp_tmp);
+        po->flags |= OPF_PPOWN;
       }
 
       if (pp != NULL) {
@@ -3266,9 +4268,9 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       strncpy(buf1, po->operand[0].name, ret);
       buf1[ret] = 0;
 
-      for (j = 0, pd = NULL; j < g_func_pd_cnt; j++) {
-        if (IS(g_func_pd[j].label, buf1)) {
-          pd = &g_func_pd[j];
+      for (j = 0, pd = NULL; j < g_ctx->func_pd_cnt; j++) {
+        if (IS(g_ctx->func_pd[j].label, buf1)) {
+          pd = &g_ctx->func_pd[j];
           break;
         }
       }
@@ -3280,12 +4282,10 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
 
       // find all labels, link
       for (j = 0; j < pd->count; j++) {
-        for (l = 0; l < opcnt; l++) {
-          if (g_labels[l][0] && IS(g_labels[l], pd->d[j].u.label)) {
-            add_label_ref(&g_label_refs[l], i);
-            pd->d[j].bt_i = l;
-            break;
-          }
+        l = label_idx_find(pd->d[j].u.label);
+        if (l >= 0 && l < opcnt) {
+          add_label_ref(&g_label_refs[l], i);
+          pd->d[j].bt_i = l;
         }
       }
 
@@ -3293,16 +4293,15 @@ static void gen_func(FILE *fout, FILE *fhdr, const char *funcn, int opcnt)
       continue;
     }
 
-    for (l = 0; l < opcnt; l++) {
-      if (g_labels[l][0] && IS(po->operand[0].name, g_labels[l])) {
-        if (l == i + 1 && po->op == OP_JMP) {
-          // yet another alignment type..
-          po->flags |= OPF_RMD;
-          break;
-        }
+    l = label_idx_find(po->operand[0].name);
+    if (l >= 0 && l < opcnt) {
+      if (l == i + 1 && po->op == OP_JMP) {
+        // yet another alignment type..
+        po->flags |= OPF_RMD;
+      }
+      else {
         add_label_ref(&g_label_refs[l], i);
         po->bt_i = l;
-        break;
       }
     }
 
@@ -3323,9 +4322,46 @@ tailcall:
     i--; // reprocess
   }
 
+  build_cfg(opcnt);
+
+  tm_mark(TM_PASS2);
+
   // pass3:
+  // - resolve indirect calls, stdcall ones move the stack
+  // - track stack depth
   // - remove dead labels
   // - process calls
+  for (i = 0; i < opcnt; i++)
+  {
+    po = &ops[i];
+    if (po->op != OP_CALL || po->pp != NULL || (po->flags & OPF_RMD))
+      continue;
+
+    pp_c = resolve_icall(i, opcnt, &l);
+    if (pp_c == NULL)
+      continue;
+    if (!pp_c->is_func && !pp_c->is_fptr)
+      ferr(po, "call to non-func: %s\n", pp_c->name);
+    po->pp = pp_c;
+    if (l)
+      // not resolved just to single func
+      call_pp_mut(po)->is_fptr = 1;
+
+    switch (po->operand[0].type) {
+    case OPT_REG:
+      // we resolved this call and no longer need the register
+      po->regmask_src &= ~(1 << po->operand[0].reg);
+      break;
+    case OPT_REGMEM:
+      call_pp_mut(po)->is_fptr = 1;
+      break;
+    default:
+      break;
+    }
+  }
+
+  solve_esp(opcnt);
+
   for (i = 0; i < opcnt; i++)
   {
     if (g_labels[i][0] != 0 && g_label_refs[i].i == -1)
@@ -3341,69 +4377,48 @@ tailcall:
       pp = po->pp;
       if (pp == NULL)
       {
-        // indirect call
-        pp_c = resolve_icall(i, opcnt, &l);
-        if (pp_c != NULL) {
-          if (!pp_c->is_func && !pp_c->is_fptr)
-            ferr(po, "call to non-func: %s\n", pp_c->name);
-          pp = proto_clone(pp_c);
-          my_assert_not(pp, NULL);
-          if (l)
-            // not resolved just to single func
-            pp->is_fptr = 1;
-
-          switch (po->operand[0].type) {
-          case OPT_REG:
-            // we resolved this call and no longer need the register
-            po->regmask_src &= ~(1 << po->operand[0].reg);
-            break;
-          case OPT_REGMEM:
-            pp->is_fptr = 1;
-            break;
-          default:
-            break;
-          }
-        }
-        if (pp == NULL) {
-          pp = calloc(1, sizeof(*pp));
-          my_assert_not(pp, NULL);
-          pp->is_fptr = 1;
-          ret = scan_for_esp_adjust(i + 1, opcnt, &j, &l);
-          if (ret < 0) {
-            if (!g_allow_regfunc)
-              ferr(po, "non-__cdecl indirect call unhandled yet\n");
-            pp->is_unresolved = 1;
-            j = 0;
-          }
-          j /= 4;
-          if (j > ARRAY_SIZE(pp->arg))
-            ferr(po, "esp adjust too large: %d\n", j);
-          pp->ret_type.name = strdup("int");
-          pp->argc = pp->argc_stack = j;
-          for (arg = 0; arg < pp->argc; arg++)
-            pp->arg[arg].type.name = strdup("int");
+        // indirect call, no proto found
+        pp_m = fzalloc(sizeof(*pp_m));
+        pp_m->is_fptr = 1;
+        ret = find_esp_adjust(i, opcnt, &j, &l);
+        if (ret < 0) {
+          if (!g_allow_regfunc)
+            ferr(po, "non-__cdecl indirect call unhandled yet\n");
+          pp_m->is_unresolved = 1;
+          j = 0;
         }
-        po->pp = pp;
+        j /= 4;
+        pp_m->name = fstrdup("");
+        pp_m->ret_type.name = fstrdup("int");
+        pp_m->arg = fzalloc(j * sizeof(pp_m->arg[0]));
+        pp_m->argc = pp_m->argc_stack = j;
+        for (arg = 0; arg < pp_m->argc; arg++)
+          pp_m->arg[arg].type.name = fstrdup("int");
+        po->pp = pp_m;
+        po->flags |= OPF_PPOWN;
+        pp = po->pp;
       }
 
       // look for and make use of esp adjust
       ret = -1;
       if (!pp->is_stdcall && pp->argc_stack > 0)
-        ret = scan_for_esp_adjust(i + 1, opcnt, &j, &l);
+        ret = find_esp_adjust(i, opcnt, &j, &l);
       if (ret >= 0) {
         if (pp->is_vararg) {
           if (j / 4 < pp->argc_stack)
             ferr(po, "esp adjust is too small: %x < %x\n",
               j, pp->argc_stack * 4);
           // modify pp to make it have varargs as normal args
-          arg = pp->argc;
-          pp->argc += j / 4 - pp->argc_stack;
-          for (; arg < pp->argc; arg++) {
-            pp->arg[arg].type.name = strdup("int");
-            pp->argc_stack++;
+          pp = pp_m = call_pp_mut(po);
+          arg = pp_m->argc;
+          pp_m->argc += j / 4 - pp_m->argc_stack;
+          parg = fzalloc(pp_m->argc * sizeof(parg[0]));
+          memcpy(parg, pp_m->arg, arg * sizeof(parg[0]));
+          pp_m->arg = parg;
+          for (; arg < pp_m->argc; arg++) {
+            pp_m->arg[arg].type.name = fstrdup("int");
+            pp_m->argc_stack++;
           }
-          if (pp->argc > ARRAY_SIZE(pp->arg))
-            ferr(po, "too many args for '%s'\n", tmpname);
         }
         if (pp->argc_stack != j / 4)
           ferr(po, "stack tracking failed for '%s': %x %x\n",
@@ -3431,7 +4446,7 @@ tailcall:
 
       if (!pp->is_unresolved && !(po->flags & OPF_ATAIL)) {
         // since we know the args, collect them
-        collect_call_args(po, i, pp, &regmask, &save_arg_vars,
+        collect_call_args(po, i, &regmask, &save_arg_vars,
           i + opcnt * 2);
       }
 
@@ -3440,6 +4455,11 @@ tailcall:
     }
   }
 
+  tm_mark(TM_PASS3);
+
+  solve_regs(opcnt);
+  solve_flags(opcnt);
+
   // pass4:
   // - find POPs for PUSHes, rm both
   // - scan for STD/CLD, propagate DF
@@ -3535,8 +4555,8 @@ tailcall:
     {
       int setters[16], cnt = 0, branched = 0;
 
-      ret = scan_for_flag_set(i, i + opcnt * 6,
-              &branched, setters, &cnt);
+      ret = scan_for_flag_set(i, &branched,
+              setters, ARRAY_SIZE(setters), &cnt);
       if (ret < 0 || cnt <= 0)
         ferr(po, "unable to trace flag setter(s)\n");
       if (cnt > ARRAY_SIZE(setters))
@@ -3605,8 +4625,9 @@ tailcall:
 
       if (pp->is_unresolved) {
         int regmask_stack = 0;
-        collect_call_args(po, i, pp, &regmask, &save_arg_vars,
+        collect_call_args(po, i, &regmask, &save_arg_vars,
           i + opcnt * 2);
+        pp = po->pp;
 
         // this is pretty rough guess:
         // see ecx and edx were pushed (and not their saved versions)
@@ -3614,7 +4635,7 @@ tailcall:
           if (pp->arg[arg].reg != NULL)
             continue;
 
-          tmp_op = pp->arg[arg].datap;
+          tmp_op = call_arg_op(po, arg);
           if (tmp_op == NULL)
             ferr(po, "parsed_op missing for arg%d\n", arg);
           if (tmp_op->p_argnum == 0 && tmp_op->operand[0].type == OPT_REG)
@@ -3627,23 +4648,24 @@ tailcall:
           if (pp->argc_stack != 0
            || ((regmask | regmask_arg) & ((1 << xCX)|(1 << xDX))))
           {
-            pp_insert_reg_arg(pp, "ecx");
-            pp->is_fastcall = 1;
+            pp_insert_reg_arg(po, "ecx");
+            call_pp_mut(po)->is_fastcall = 1;
             regmask_init |= 1 << xCX;
             regmask |= 1 << xCX;
           }
           if (pp->argc_stack != 0
            || ((regmask | regmask_arg) & (1 << xDX)))
           {
-            pp_insert_reg_arg(pp, "edx");
+            pp_insert_reg_arg(po, "edx");
             regmask_init |= 1 << xDX;
             regmask |= 1 << xDX;
           }
         }
 
         // note: __cdecl doesn't fall into is_unresolved category
+        pp = po->pp;
         if (pp->argc_stack > 0)
-          pp->is_stdcall = 1;
+          call_pp_mut(po)->is_stdcall = 1;
       }
 
       for (arg = 0; arg < pp->argc; arg++) {
@@ -3652,10 +4674,11 @@ tailcall:
                   ARRAY_SIZE(regs_r32), pp->arg[arg].reg);
           if (reg < 0)
             ferr(ops, "arg '%s' is not a reg?\n", pp->arg[arg].reg);
-          if (!(regmask & (1 << reg))) {
+          // may be passed before set on some path
+          if (g_ctx->rdef[i][reg] == RDEF_ENTRY
+           || g_ctx->rdef[i][reg] == RDEF_MANY_ENTRY)
             regmask_init |= 1 << reg;
-            regmask |= 1 << reg;
-          }
+          regmask |= 1 << reg;
         }
       }
     }
@@ -3670,8 +4693,8 @@ tailcall:
           ferr(po, "%s not declared as fptr when it should be\n",
             po->operand[0].name);
         if (pp_cmp_func(po->operand[0].pp, po->operand[1].pp)) {
-          pp_print(buf1, sizeof(buf1), po->operand[0].pp);
-          pp_print(buf2, sizeof(buf2), po->operand[1].pp);
+          pp_print(buf1, g_opr_bufsz, po->operand[0].pp);
+          pp_print(buf2, g_opr_bufsz, po->operand[1].pp);
           fnote(po, "var:  %s\n", buf1);
           fnote(po, "func: %s\n", buf2);
           ferr(po, "^ mismatch\n");
@@ -3714,57 +4737,59 @@ tailcall:
     }
   }
 
+  tm_mark(TM_PASS4);
+
   // output starts here
 
   // define userstack size
   if (g_func_pp->is_userstack) {
-    fprintf(fout, "#ifndef US_SZ_%s\n", g_func_pp->name);
-    fprintf(fout, "#define US_SZ_%s USERSTACK_SIZE\n", g_func_pp->name);
-    fprintf(fout, "#endif\n");
+    ob_printf(ob, "#ifndef US_SZ_%s\n", g_func_pp->name);
+    ob_printf(ob, "#define US_SZ_%s USERSTACK_SIZE\n", g_func_pp->name);
+    ob_printf(ob, "#endif\n");
   }
 
   // the function itself
-  fprintf(fout, "%s ", g_func_pp->ret_type.name);
-  output_pp_attrs(fout, g_func_pp, g_ida_func_attr & IDAFA_NORETURN);
-  fprintf(fout, "%s(", g_func_pp->name);
+  ob_printf(ob, "%s ", g_func_pp->ret_type.name);
+  output_pp_attrs(ob, g_func_pp, g_ctx->ida_func_attr & IDAFA_NORETURN);
+  ob_printf(ob, "%s(", g_func_pp->name);
 
   for (i = 0; i < g_func_pp->argc; i++) {
     if (i > 0)
-      fprintf(fout, ", ");
+      ob_printf(ob, ", ");
     if (g_func_pp->arg[i].fptr != NULL) {
       // func pointer..
       pp = g_func_pp->arg[i].fptr;
-      fprintf(fout, "%s (", pp->ret_type.name);
-      output_pp_attrs(fout, pp, 0);
-      fprintf(fout, "*a%d)(", i + 1);
+      ob_printf(ob, "%s (", pp->ret_type.name);
+      output_pp_attrs(ob, pp, 0);
+      ob_printf(ob, "*a%d)(", i + 1);
       for (j = 0; j < pp->argc; j++) {
         if (j > 0)
-          fprintf(fout, ", ");
+          ob_printf(ob, ", ");
         if (pp->arg[j].fptr)
           ferr(ops, "nested fptr\n");
-        fprintf(fout, "%s", pp->arg[j].type.name);
+        ob_printf(ob, "%s", pp->arg[j].type.name);
       }
       if (pp->is_vararg) {
         if (j > 0)
-          fprintf(fout, ", ");
-        fprintf(fout, "...");
+          ob_printf(ob, ", ");
+        ob_printf(ob, "...");
       }
-      fprintf(fout, ")");
+      ob_printf(ob, ")");
     }
     else if (g_func_pp->arg[i].type.is_retreg) {
-      fprintf(fout, "u32 *r_%s", g_func_pp->arg[i].reg);
+      ob_printf(ob, "u32 *r_%s", g_func_pp->arg[i].reg);
     }
     else {
-      fprintf(fout, "%s a%d", g_func_pp->arg[i].type.name, i + 1);
+      ob_printf(ob, "%s a%d", g_func_pp->arg[i].type.name, i + 1);
     }
   }
   if (g_func_pp->is_vararg) {
     if (i > 0)
-      fprintf(fout, ", ");
-    fprintf(fout, "...");
+      ob_printf(ob, ", ");
+    ob_printf(ob, "...");
   }
 
-  fprintf(fout, ")\n{\n");
+  ob_printf(ob, ")\n{\n");
 
   // declare indirect functions
   for (i = 0; i < opcnt; i++) {
@@ -3779,14 +4804,15 @@ tailcall:
 
       if (pp->is_fptr && !(pp->name[0] != 0 && pp->is_arg)) {
         if (pp->name[0] != 0) {
-          memmove(pp->name + 2, pp->name, strlen(pp->name) + 1);
-          memcpy(pp->name, "i_", 2);
+          snprintf(buf1, g_opr_bufsz, "i_%s", pp->name);
+          pp = pp_m = call_pp_mut(po);
+          pp_m->name = fstrdup(buf1);
 
           // might be declared already
           found = 0;
           for (j = 0; j < i; j++) {
-            if (ops[j].op == OP_CALL && (pp_tmp = ops[j].pp)) {
-              if (pp_tmp->is_fptr && IS(pp->name, pp_tmp->name)) {
+            if (ops[j].op == OP_CALL && (pp_c = ops[j].pp)) {
+              if (pp_c->is_fptr && IS(pp->name, pp_c->name)) {
                 found = 1;
                 break;
               }
@@ -3795,64 +4821,67 @@ tailcall:
           if (found)
             continue;
         }
-        else
-          snprintf(pp->name, sizeof(pp->name), "icall%d", i);
+        else {
+          snprintf(buf1, g_opr_bufsz, "icall%d", i);
+          pp = pp_m = call_pp_mut(po);
+          pp_m->name = fstrdup(buf1);
+        }
 
-        fprintf(fout, "  %s (", pp->ret_type.name);
-        output_pp_attrs(fout, pp, 0);
-        fprintf(fout, "*%s)(", pp->name);
+        ob_printf(ob, "  %s (", pp->ret_type.name);
+        output_pp_attrs(ob, pp, 0);
+        ob_printf(ob, "*%s)(", pp->name);
         for (j = 0; j < pp->argc; j++) {
           if (j > 0)
-            fprintf(fout, ", ");
-          fprintf(fout, "%s a%d", pp->arg[j].type.name, j + 1);
+            ob_printf(ob, ", ");
+          ob_printf(ob, "%s a%d", pp->arg[j].type.name, j + 1);
         }
-        fprintf(fout, ");\n");
+        ob_printf(ob, ");\n");
       }
     }
   }
 
   // output LUTs/jumptables
-  for (i = 0; i < g_func_pd_cnt; i++) {
-    pd = &g_func_pd[i];
-    fprintf(fout, "  static const ");
+  for (i = 0; i < g_ctx->func_pd_cnt; i++) {
+    pd = &g_ctx->func_pd[i];
+    ob_printf(ob, "  static const ");
     if (pd->type == OPT_OFFSET) {
-      fprintf(fout, "void *jt_%s[] =\n    { ", pd->label);
+      ob_printf(ob, "void *jt_%s[] =\n    { ", pd->label);
 
       for (j = 0; j < pd->count; j++) {
         if (j > 0)
-          fprintf(fout, ", ");
-        fprintf(fout, "&&%s", pd->d[j].u.label);
+          ob_printf(ob, ", ");
+        ob_printf(ob, "&&%s", pd->d[j].u.label);
       }
     }
     else {
-      fprintf(fout, "%s %s[] =\n    { ",
+      ob_printf(ob, "%s %s[] =\n    { ",
         lmod_type_u(ops, pd->lmod), pd->label);
 
       for (j = 0; j < pd->count; j++) {
         if (j > 0)
-          fprintf(fout, ", ");
-        fprintf(fout, "%u", pd->d[j].u.val);
+          ob_printf(ob, ", ");
+        ob_printf(ob, "%u", pd->d[j].u.val);
       }
     }
-    fprintf(fout, " };\n");
+    ob_printf(ob, " };\n");
     had_decl = 1;
   }
 
   // declare stack frame, va_arg
   if (g_stack_fsz) {
-    fprintf(fout, "  union { u32 d[%d]; u16 w[%d]; u8 b[%d]; } sf;\n",
+    ob_printf(ob, "  union { u32 d[%d]; u16 w[%d]; u8 b[%d]; } sf;\n",
       (g_stack_fsz + 3) / 4, (g_stack_fsz + 1) / 2, g_stack_fsz);
     had_decl = 1;
   }
 
   if (g_func_pp->is_userstack) {
-    fprintf(fout, "  u32 fake_sf[US_SZ_%s / 4];\n", g_func_pp->name);
-    fprintf(fout, "  u32 *esp = &fake_sf[sizeof(fake_sf) / 4];\n");
+    ob_printf(ob, "  u32 fake_sf[US_SZ_%s / 4];\n", g_func_pp->name);
+    ob_printf(ob, "  u32 *esp = &fake_sf[sizeof(fake_sf) / 4];\n");
     had_decl = 1;
   }
 
   if (g_func_pp->is_vararg) {
-    fprintf(fout, "  va_list ap;\n");
+    ob_printf(ob, "  va_list ap;\n");
     had_decl = 1;
   }
 
@@ -3863,17 +4892,17 @@ tailcall:
               ARRAY_SIZE(regs_r32), g_func_pp->arg[i].reg);
       if (regmask & (1 << reg)) {
         if (g_func_pp->arg[i].type.is_retreg)
-          fprintf(fout, "  u32 %s = *r_%s;\n",
+          ob_printf(ob, "  u32 %s = *r_%s;\n",
             g_func_pp->arg[i].reg, g_func_pp->arg[i].reg);
         else
-          fprintf(fout, "  u32 %s = (u32)a%d;\n",
+          ob_printf(ob, "  u32 %s = (u32)a%d;\n",
             g_func_pp->arg[i].reg, i + 1);
       }
       else {
         if (g_func_pp->arg[i].type.is_retreg)
           ferr(ops, "retreg '%s' is unused?\n",
             g_func_pp->arg[i].reg);
-        fprintf(fout, "  // %s = a%d; // unused\n",
+        ob_printf(ob, "  // %s = a%d; // unused\n",
           g_func_pp->arg[i].reg, i + 1);
       }
       had_decl = 1;
@@ -3885,10 +4914,10 @@ tailcall:
   if (regmask_now) {
     for (reg = 0; reg < 8; reg++) {
       if (regmask_now & (1 << reg)) {
-        fprintf(fout, "  u32 %s", regs_r32[reg]);
+        ob_printf(ob, "  u32 %s", regs_r32[reg]);
         if (regmask_init & (1 << reg))
-          fprintf(fout, " = 0");
-        fprintf(fout, ";\n");
+          ob_printf(ob, " = 0");
+        ob_printf(ob, ";\n");
         had_decl = 1;
       }
     }
@@ -3897,7 +4926,7 @@ tailcall:
   if (regmask_save) {
     for (reg = 0; reg < 8; reg++) {
       if (regmask_save & (1 << reg)) {
-        fprintf(fout, "  u32 s_%s;\n", regs_r32[reg]);
+        ob_printf(ob, "  u32 s_%s;\n", regs_r32[reg]);
         had_decl = 1;
       }
     }
@@ -3906,7 +4935,7 @@ tailcall:
   if (save_arg_vars) {
     for (reg = 0; reg < 32; reg++) {
       if (save_arg_vars & (1 << reg)) {
-        fprintf(fout, "  u32 s_a%d;\n", reg + 1);
+        ob_printf(ob, "  u32 s_a%d;\n", reg + 1);
         had_decl = 1;
       }
     }
@@ -3915,36 +4944,36 @@ tailcall:
   if (cond_vars) {
     for (i = 0; i < 8; i++) {
       if (cond_vars & (1 << i)) {
-        fprintf(fout, "  u32 cond_%s;\n", parsed_flag_op_names[i]);
+        ob_printf(ob, "  u32 cond_%s;\n", parsed_flag_op_names[i]);
         had_decl = 1;
       }
     }
   }
 
   if (need_tmp_var) {
-    fprintf(fout, "  u32 tmp;\n");
+    ob_printf(ob, "  u32 tmp;\n");
     had_decl = 1;
   }
 
   if (need_tmp64) {
-    fprintf(fout, "  u64 tmp64;\n");
+    ob_printf(ob, "  u64 tmp64;\n");
     had_decl = 1;
   }
 
   if (had_decl)
-    fprintf(fout, "\n");
+    ob_printf(ob, "\n");
 
   if (g_func_pp->is_vararg) {
     if (g_func_pp->argc_stack == 0)
       ferr(ops, "vararg func without stack args?\n");
-    fprintf(fout, "  va_start(ap, a%d);\n", g_func_pp->argc);
+    ob_printf(ob, "  va_start(ap, a%d);\n", g_func_pp->argc);
   }
 
   // output ops
   for (i = 0; i < opcnt; i++)
   {
     if (g_labels[i][0] != 0) {
-      fprintf(fout, "\n%s:\n", g_labels[i]);
+      ob_printf(ob, "\n%s:\n", g_labels[i]);
       label_pending = 1;
 
       delayed_flag_op = NULL;
@@ -3972,8 +5001,7 @@ tailcall:
       // which makes generated code much nicer
       if (delayed_flag_op != NULL)
       {
-        out_cmp_test(buf1, sizeof(buf1), delayed_flag_op,
-          po->pfo, po->pfo_inv);
+        cond = out_cmp_test(delayed_flag_op, po->pfo, po->pfo_inv);
         is_delayed = 1;
       }
       else if (last_arith_dst != NULL
@@ -3981,8 +5009,8 @@ tailcall:
            || (tmp_op && (tmp_op->op == OP_AND || tmp_op->op == OP_OR))
            ))
       {
-        out_src_opr_u32(buf3, sizeof(buf3), po, last_arith_dst);
-        out_test_for_cc(buf1, sizeof(buf1), po, po->pfo, po->pfo_inv,
+        out_src_opr_u32(buf3, g_opr_bufsz, po, last_arith_dst);
+        cond = out_test_for_cc(po, po->pfo, po->pfo_inv,
           last_arith_dst->lmod, buf3);
         is_delayed = 1;
       }
@@ -3992,7 +5020,7 @@ tailcall:
           ferr(po, "not prepared for pfo %d\n", po->pfo);
 
         // note: pfo_inv was not yet applied
-        snprintf(buf1, sizeof(buf1), "(%scond_%s)",
+        cond = fsprintf("(%scond_%s)",
           po->pfo_inv ? "!" : "", parsed_flag_op_names[po->pfo]);
       }
       else {
@@ -4000,18 +5028,18 @@ tailcall:
       }
  
       if (po->flags & OPF_JMP) {
-        fprintf(fout, "  if %s", buf1);
+        ob_printf(ob, "  if %s", cond);
       }
       else if (po->op == OP_RCL || po->op == OP_RCR
                || po->op == OP_ADC || po->op == OP_SBB)
       {
         if (is_delayed)
-          fprintf(fout, "  cond_%s = %s;\n",
-            parsed_flag_op_names[po->pfo], buf1);
+          ob_printf(ob, "  cond_%s = %s;\n",
+            parsed_flag_op_names[po->pfo], cond);
       }
       else if (po->flags & OPF_DATA) { // SETcc
-        out_dst_opr(buf2, sizeof(buf2), po, &po->operand[0]);
-        fprintf(fout, "  %s = %s;", buf2, buf1);
+        out_dst_opr(buf2, g_opr_bufsz, po, &po->operand[0]);
+        ob_printf(ob, "  %s = %s;", buf2, cond);
       }
       else {
         ferr(po, "unhandled conditional op\n");
@@ -4022,6 +5050,7 @@ tailcall:
 
     if (po->flags & (OPF_REPZ|OPF_REPNZ)) {
       struct parsed_opr opr = {0,};
+      opr.name = g_sym_empty;
       opr.type = OPT_REG;
       opr.reg = xCX;
       opr.lmod = OPLM_DWORD;
@@ -4030,19 +5059,18 @@ tailcall:
       if (ret != 1 || uval == 0) {
         // we need initial flags for ecx=0 case..
         if (i > 0 && ops[i - 1].op == OP_XOR
-          && IS(ops[i - 1].operand[0].name,
-                ops[i - 1].operand[1].name))
+          && ops[i - 1].operand[0].name == ops[i - 1].operand[1].name)
         {
-          fprintf(fout, "  cond_z = ");
+          ob_printf(ob, "  cond_z = ");
           if (pfomask & (1 << PFO_C))
-            fprintf(fout, "cond_c = ");
-          fprintf(fout, "0;\n");
+            ob_printf(ob, "cond_c = ");
+          ob_printf(ob, "0;\n");
         }
         else if (last_arith_dst != NULL) {
-          out_src_opr_u32(buf3, sizeof(buf3), po, last_arith_dst);
-          out_test_for_cc(buf1, sizeof(buf1), po, PFO_Z, 0,
+          out_src_opr_u32(buf3, g_opr_bufsz, po, last_arith_dst);
+          cond = out_test_for_cc(po, PFO_Z, 0,
             last_arith_dst->lmod, buf3);
-          fprintf(fout, "  cond_z = %s;\n", buf1);
+          ob_printf(ob, "  cond_z = %s;\n", cond);
         }
         else
           ferr(po, "missing initial ZF\n");
@@ -4054,27 +5082,27 @@ tailcall:
       case OP_MOV:
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-        default_cast_to(buf3, sizeof(buf3), &po->operand[0]);
-        fprintf(fout, "  %s = %s;", buf1,
-            out_src_opr(buf2, sizeof(buf2), po, &po->operand[1],
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+        default_cast_to(buf3, g_opr_bufsz, &po->operand[0]);
+        ob_printf(ob, "  %s = %s;", buf1,
+            out_src_opr(buf2, g_opr_bufsz, po, &po->operand[1],
               buf3, 0));
         break;
 
       case OP_LEA:
         assert_operand_cnt(2);
         po->operand[1].lmod = OPLM_DWORD; // always
-        fprintf(fout, "  %s = %s;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
-            out_src_opr(buf2, sizeof(buf2), po, &po->operand[1],
+        ob_printf(ob, "  %s = %s;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
+            out_src_opr(buf2, g_opr_bufsz, po, &po->operand[1],
               NULL, 1));
         break;
 
       case OP_MOVZX:
         assert_operand_cnt(2);
-        fprintf(fout, "  %s = %s;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
-            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
+        ob_printf(ob, "  %s = %s;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
+            out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]));
         break;
 
       case OP_MOVSX:
@@ -4089,38 +5117,38 @@ tailcall:
         default:
           ferr(po, "invalid src lmod: %d\n", po->operand[1].lmod);
         }
-        fprintf(fout, "  %s = %s;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
-            out_src_opr(buf2, sizeof(buf2), po, &po->operand[1],
+        ob_printf(ob, "  %s = %s;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
+            out_src_opr(buf2, g_opr_bufsz, po, &po->operand[1],
               buf3, 0));
         break;
 
       case OP_XCHG:
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
-        fprintf(fout, "  tmp = %s;",
-          out_src_opr(buf1, sizeof(buf1), po, &po->operand[0], "", 0));
-        fprintf(fout, " %s = %s;",
-          out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
-          out_src_opr(buf2, sizeof(buf2), po, &po->operand[1],
-            default_cast_to(buf3, sizeof(buf3), &po->operand[0]), 0));
-        fprintf(fout, " %s = %stmp;",
-          out_dst_opr(buf1, sizeof(buf1), po, &po->operand[1]),
-          default_cast_to(buf3, sizeof(buf3), &po->operand[1]));
+        ob_printf(ob, "  tmp = %s;",
+          out_src_opr(buf1, g_opr_bufsz, po, &po->operand[0], "", 0));
+        ob_printf(ob, " %s = %s;",
+          out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
+          out_src_opr(buf2, g_opr_bufsz, po, &po->operand[1],
+            default_cast_to(buf3, g_opr_bufsz, &po->operand[0]), 0));
+        ob_printf(ob, " %s = %stmp;",
+          out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[1]),
+          default_cast_to(buf3, g_opr_bufsz, &po->operand[1]));
         snprintf(g_comment, sizeof(g_comment), "xchg");
         break;
 
       case OP_NOT:
         assert_operand_cnt(1);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-        fprintf(fout, "  %s = ~%s;", buf1, buf1);
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+        ob_printf(ob, "  %s = ~%s;", buf1, buf1);
         break;
 
       case OP_CDQ:
         assert_operand_cnt(2);
-        fprintf(fout, "  %s = (s32)%s >> 31;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
-            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
+        ob_printf(ob, "  %s = (s32)%s >> 31;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
+            out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]));
         strcpy(g_comment, "cdq");
         break;
 
@@ -4131,7 +5159,7 @@ tailcall:
           ferr(po, "TODO\n");
         }
         else {
-          fprintf(fout, "  eax = %sesi; esi %c= %d;",
+          ob_printf(ob, "  eax = %sesi; esi %c= %d;",
             lmod_cast_u_ptr(po, po->operand[0].lmod),
             (po->flags & OPF_DF) ? '-' : '+',
             lmod_bytes(po, po->operand[0].lmod));
@@ -4142,15 +5170,15 @@ tailcall:
       case OP_STOS:
         assert_operand_cnt(3);
         if (po->flags & OPF_REP) {
-          fprintf(fout, "  for (; ecx != 0; ecx--, edi %c= %d)\n",
+          ob_printf(ob, "  for (; ecx != 0; ecx--, edi %c= %d)\n",
             (po->flags & OPF_DF) ? '-' : '+',
             lmod_bytes(po, po->operand[0].lmod));
-          fprintf(fout, "    %sedi = eax;",
+          ob_printf(ob, "    %sedi = eax;",
             lmod_cast_u_ptr(po, po->operand[0].lmod));
           strcpy(g_comment, "rep stos");
         }
         else {
-          fprintf(fout, "  %sedi = eax; edi %c= %d;",
+          ob_printf(ob, "  %sedi = eax; edi %c= %d;",
             lmod_cast_u_ptr(po, po->operand[0].lmod),
             (po->flags & OPF_DF) ? '-' : '+',
             lmod_bytes(po, po->operand[0].lmod));
@@ -4164,15 +5192,15 @@ tailcall:
         strcpy(buf1, lmod_cast_u_ptr(po, po->operand[0].lmod));
         l = (po->flags & OPF_DF) ? '-' : '+';
         if (po->flags & OPF_REP) {
-          fprintf(fout,
+          ob_printf(ob,
             "  for (; ecx != 0; ecx--, edi %c= %d, esi %c= %d)\n",
             l, j, l, j);
-          fprintf(fout,
+          ob_printf(ob,
             "    %sedi = %sesi;", buf1, buf1);
           strcpy(g_comment, "rep movs");
         }
         else {
-          fprintf(fout, "  %sedi = %sesi; edi %c= %d; esi %c= %d;",
+          ob_printf(ob, "  %sedi = %sesi; edi %c= %d; esi %c= %d;",
             buf1, buf1, l, j, l, j);
           strcpy(g_comment, "movs");
         }
@@ -4185,27 +5213,27 @@ tailcall:
         strcpy(buf1, lmod_cast_u_ptr(po, po->operand[0].lmod));
         l = (po->flags & OPF_DF) ? '-' : '+';
         if (po->flags & OPF_REP) {
-          fprintf(fout,
+          ob_printf(ob,
             "  for (; ecx != 0; ecx--) {\n");
           if (pfomask & (1 << PFO_C)) {
             // ugh..
-            fprintf(fout,
+            ob_printf(ob,
             "    cond_c = %sesi < %sedi;\n", buf1, buf1);
             pfomask &= ~(1 << PFO_C);
           }
-          fprintf(fout,
+          ob_printf(ob,
             "    cond_z = (%sesi == %sedi); esi %c= %d, edi %c= %d;\n",
               buf1, buf1, l, j, l, j);
-          fprintf(fout,
+          ob_printf(ob,
             "    if (cond_z %s 0) break;\n",
               (po->flags & OPF_REPZ) ? "==" : "!=");
-          fprintf(fout,
+          ob_printf(ob,
             "  }");
           snprintf(g_comment, sizeof(g_comment), "rep%s cmps",
             (po->flags & OPF_REPZ) ? "e" : "ne");
         }
         else {
-          fprintf(fout,
+          ob_printf(ob,
             "  cond_z = (%sesi == %sedi); esi %c= %d; edi %c= %d;",
             buf1, buf1, l, j, l, j);
           strcpy(g_comment, "cmps");
@@ -4222,22 +5250,22 @@ tailcall:
         j = lmod_bytes(po, po->operand[0].lmod);
         l = (po->flags & OPF_DF) ? '-' : '+';
         if (po->flags & OPF_REP) {
-          fprintf(fout,
+          ob_printf(ob,
             "  for (; ecx != 0; ecx--) {\n");
-          fprintf(fout,
+          ob_printf(ob,
             "    cond_z = (%seax == %sedi); edi %c= %d;\n",
               lmod_cast_u(po, po->operand[0].lmod),
               lmod_cast_u_ptr(po, po->operand[0].lmod), l, j);
-          fprintf(fout,
+          ob_printf(ob,
             "    if (cond_z %s 0) break;\n",
               (po->flags & OPF_REPZ) ? "==" : "!=");
-          fprintf(fout,
+          ob_printf(ob,
             "  }");
           snprintf(g_comment, sizeof(g_comment), "rep%s scas",
             (po->flags & OPF_REPZ) ? "e" : "ne");
         }
         else {
-          fprintf(fout, "  cond_z = (%seax == %sedi); edi %c= %d;",
+          ob_printf(ob, "  cond_z = (%seax == %sedi); edi %c= %d;",
               lmod_cast_u(po, po->operand[0].lmod),
               lmod_cast_u_ptr(po, po->operand[0].lmod), l, j);
           strcpy(g_comment, "scas");
@@ -4254,11 +5282,11 @@ tailcall:
         // fallthrough
       dualop_arith:
         assert_operand_cnt(2);
-        fprintf(fout, "  %s %s= %s;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
+        ob_printf(ob, "  %s %s= %s;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
             op_to_c(po),
-            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
-        output_std_flags(fout, po, &pfomask, buf1);
+            out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]));
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
@@ -4266,7 +5294,7 @@ tailcall:
       case OP_SHL:
       case OP_SHR:
         assert_operand_cnt(2);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
         if (pfomask & (1 << PFO_C)) {
           if (po->operand[1].type == OPT_CONST) {
             l = lmod_bytes(po, po->operand[0].lmod) * 8;
@@ -4277,7 +5305,7 @@ tailcall:
                 j = l - j;
               else
                 j -= 1;
-              fprintf(fout, "  cond_c = (%s >> %d) & 1;\n",
+              ob_printf(ob, "  cond_c = (%s >> %d) & 1;\n",
                 buf1, j);
             }
             else
@@ -4287,20 +5315,20 @@ tailcall:
             ferr(po, "TODO\n");
           pfomask &= ~(1 << PFO_C);
         }
-        fprintf(fout, "  %s %s= %s;", buf1, op_to_c(po),
-            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
-        output_std_flags(fout, po, &pfomask, buf1);
+        ob_printf(ob, "  %s %s= %s;", buf1, op_to_c(po),
+            out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]));
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
 
       case OP_SAR:
         assert_operand_cnt(2);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-        fprintf(fout, "  %s = %s%s >> %s;", buf1,
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+        ob_printf(ob, "  %s = %s%s >> %s;", buf1,
           lmod_cast_s(po, po->operand[0].lmod), buf1,
-          out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
-        output_std_flags(fout, po, &pfomask, buf1);
+          out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]));
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
@@ -4309,13 +5337,13 @@ tailcall:
         assert_operand_cnt(3);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         l = lmod_bytes(po, po->operand[0].lmod) * 8;
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-        out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]);
-        out_src_opr_u32(buf3, sizeof(buf3), po, &po->operand[2]);
-        fprintf(fout, "  %s >>= %s; %s |= %s << (%d - %s);",
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+        out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]);
+        out_src_opr_u32(buf3, g_opr_bufsz, po, &po->operand[2]);
+        ob_printf(ob, "  %s >>= %s; %s |= %s << (%d - %s);",
           buf1, buf3, buf1, buf2, l, buf3);
         strcpy(g_comment, "shrd");
-        output_std_flags(fout, po, &pfomask, buf1);
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
@@ -4323,11 +5351,11 @@ tailcall:
       case OP_ROL:
       case OP_ROR:
         assert_operand_cnt(2);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
         if (po->operand[1].type == OPT_CONST) {
           j = po->operand[1].val;
           j %= lmod_bytes(po, po->operand[0].lmod) * 8;
-          fprintf(fout, po->op == OP_ROL ?
+          ob_printf(ob, po->op == OP_ROL ?
             "  %s = (%s << %d) | (%s >> %d);" :
             "  %s = (%s >> %d) | (%s << %d);",
             buf1, buf1, j, buf1,
@@ -4335,7 +5363,7 @@ tailcall:
         }
         else
           ferr(po, "TODO\n");
-        output_std_flags(fout, po, &pfomask, buf1);
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
@@ -4343,35 +5371,35 @@ tailcall:
       case OP_RCL:
       case OP_RCR:
         assert_operand_cnt(2);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
         l = lmod_bytes(po, po->operand[0].lmod) * 8;
         if (po->operand[1].type == OPT_CONST) {
           j = po->operand[1].val % l;
           if (j == 0)
             ferr(po, "zero rotate\n");
-          fprintf(fout, "  tmp = (%s >> %d) & 1;\n",
+          ob_printf(ob, "  tmp = (%s >> %d) & 1;\n",
             buf1, (po->op == OP_RCL) ? (l - j) : (j - 1));
           if (po->op == OP_RCL) {
-            fprintf(fout,
+            ob_printf(ob,
               "  %s = (%s << %d) | (cond_c << %d)",
               buf1, buf1, j, j - 1);
             if (j != 1)
-              fprintf(fout, " | (%s >> %d)", buf1, l + 1 - j);
+              ob_printf(ob, " | (%s >> %d)", buf1, l + 1 - j);
           }
           else {
-            fprintf(fout,
+            ob_printf(ob,
               "  %s = (%s >> %d) | (cond_c << %d)",
               buf1, buf1, j, l - j);
             if (j != 1)
-              fprintf(fout, " | (%s << %d)", buf1, l + 1 - j);
+              ob_printf(ob, " | (%s << %d)", buf1, l + 1 - j);
           }
-          fprintf(fout, ";\n");
-          fprintf(fout, "  cond_c = tmp;");
+          ob_printf(ob, ";\n");
+          ob_printf(ob, "  cond_c = tmp;");
         }
         else
           ferr(po, "TODO\n");
         strcpy(g_comment, (po->op == OP_RCL) ? "rcl" : "rcr");
-        output_std_flags(fout, po, &pfomask, buf1);
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
@@ -4382,11 +5410,11 @@ tailcall:
         if (IS(opr_name(po, 0), opr_name(po, 1))) {
           // special case for XOR
           if (pfomask & (1 << PFO_BE)) { // weird, but it happens..
-            fprintf(fout, "  cond_be = 1;\n");
+            ob_printf(ob, "  cond_be = 1;\n");
             pfomask &= ~(1 << PFO_BE);
           }
-          fprintf(fout, "  %s = 0;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]));
+          ob_printf(ob, "  %s = 0;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]));
           last_arith_dst = &po->operand[0];
           delayed_flag_op = NULL;
           break;
@@ -4397,24 +5425,24 @@ tailcall:
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
         if (pfomask & (1 << PFO_C)) {
-          out_src_opr_u32(buf1, sizeof(buf1), po, &po->operand[0]);
-          out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]);
+          out_src_opr_u32(buf1, g_opr_bufsz, po, &po->operand[0]);
+          out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]);
           if (po->operand[0].lmod == OPLM_DWORD) {
-            fprintf(fout, "  tmp64 = (u64)%s + %s;\n", buf1, buf2);
-            fprintf(fout, "  cond_c = tmp64 >> 32;\n");
-            fprintf(fout, "  %s = (u32)tmp64;",
-              out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]));
+            ob_printf(ob, "  tmp64 = (u64)%s + %s;\n", buf1, buf2);
+            ob_printf(ob, "  cond_c = tmp64 >> 32;\n");
+            ob_printf(ob, "  %s = (u32)tmp64;",
+              out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]));
             strcat(g_comment, "add64");
           }
           else {
-            fprintf(fout, "  cond_c = ((u32)%s + %s) >> %d;\n",
+            ob_printf(ob, "  cond_c = ((u32)%s + %s) >> %d;\n",
               buf1, buf2, lmod_bytes(po, po->operand[0].lmod) * 8);
-            fprintf(fout, "  %s += %s;",
-              out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
+            ob_printf(ob, "  %s += %s;",
+              out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
               buf2);
           }
           pfomask &= ~(1 << PFO_C);
-          output_std_flags(fout, po, &pfomask, buf1);
+          output_std_flags(ob, po, &pfomask, buf1);
           last_arith_dst = &po->operand[0];
           delayed_flag_op = NULL;
           break;
@@ -4431,9 +5459,9 @@ tailcall:
             if (j == PFO_Z || j == PFO_S)
               continue;
 
-            out_cmp_for_cc(buf1, sizeof(buf1), po, j, 0);
-            fprintf(fout, "  cond_%s = %s;\n",
-              parsed_flag_op_names[j], buf1);
+            cond = out_cmp_for_cc(po, j, 0);
+            ob_printf(ob, "  cond_%s = %s;\n",
+              parsed_flag_op_names[j], cond);
             pfomask &= ~(1 << j);
           }
         }
@@ -4443,31 +5471,31 @@ tailcall:
       case OP_SBB:
         assert_operand_cnt(2);
         propagate_lmod(po, &po->operand[0], &po->operand[1]);
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
         if (po->op == OP_SBB
-          && IS(po->operand[0].name, po->operand[1].name))
+          && po->operand[0].name == po->operand[1].name)
         {
           // avoid use of unitialized var
-          fprintf(fout, "  %s = -cond_c;", buf1);
+          ob_printf(ob, "  %s = -cond_c;", buf1);
           // carry remains what it was
           pfomask &= ~(1 << PFO_C);
         }
         else {
-          fprintf(fout, "  %s %s= %s + cond_c;", buf1, op_to_c(po),
-            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]));
+          ob_printf(ob, "  %s %s= %s + cond_c;", buf1, op_to_c(po),
+            out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]));
         }
-        output_std_flags(fout, po, &pfomask, buf1);
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
 
       case OP_BSF:
         assert_operand_cnt(2);
-        out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[1]);
-        fprintf(fout, "  %s = %s ? __builtin_ffs(%s) - 1 : 0;",
-          out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]),
+        out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[1]);
+        ob_printf(ob, "  %s = %s ? __builtin_ffs(%s) - 1 : 0;",
+          out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]),
           buf2, buf2);
-        output_std_flags(fout, po, &pfomask, buf1);
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         strcat(g_comment, "bsf");
@@ -4475,29 +5503,29 @@ tailcall:
 
       case OP_INC:
       case OP_DEC:
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
         if (po->operand[0].type == OPT_REG) {
           strcpy(buf2, po->op == OP_INC ? "++" : "--");
-          fprintf(fout, "  %s%s;", buf1, buf2);
+          ob_printf(ob, "  %s%s;", buf1, buf2);
         }
         else {
           strcpy(buf2, po->op == OP_INC ? "+" : "-");
-          fprintf(fout, "  %s %s= 1;", buf1, buf2);
+          ob_printf(ob, "  %s %s= 1;", buf1, buf2);
         }
-        output_std_flags(fout, po, &pfomask, buf1);
+        output_std_flags(ob, po, &pfomask, buf1);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         break;
 
       case OP_NEG:
-        out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-        out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[0]);
-        fprintf(fout, "  %s = -%s%s;", buf1,
+        out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+        out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[0]);
+        ob_printf(ob, "  %s = -%s%s;", buf1,
           lmod_cast_s(po, po->operand[0].lmod), buf2);
         last_arith_dst = &po->operand[0];
         delayed_flag_op = NULL;
         if (pfomask & (1 << PFO_C)) {
-          fprintf(fout, "\n  cond_c = (%s != 0);", buf1);
+          ob_printf(ob, "\n  cond_c = (%s != 0);", buf1);
           pfomask &= ~(1 << PFO_C);
         }
         break;
@@ -4515,15 +5543,15 @@ tailcall:
         switch (po->operand[0].lmod) {
         case OPLM_DWORD:
           strcpy(buf1, po->op == OP_IMUL ? "(s64)(s32)" : "(u64)");
-          fprintf(fout, "  tmp64 = %seax * %s%s;\n", buf1, buf1,
-            out_src_opr_u32(buf2, sizeof(buf2), po, &po->operand[0]));
-          fprintf(fout, "  edx = tmp64 >> 32;\n");
-          fprintf(fout, "  eax = tmp64;");
+          ob_printf(ob, "  tmp64 = %seax * %s%s;\n", buf1, buf1,
+            out_src_opr_u32(buf2, g_opr_bufsz, po, &po->operand[0]));
+          ob_printf(ob, "  edx = tmp64 >> 32;\n");
+          ob_printf(ob, "  eax = tmp64;");
           break;
         case OPLM_BYTE:
           strcpy(buf1, po->op == OP_IMUL ? "(s16)(s8)" : "(u16)(u8)");
-          fprintf(fout, "  LOWORD(eax) = %seax * %s;", buf1,
-            out_src_opr(buf2, sizeof(buf2), po, &po->operand[0],
+          ob_printf(ob, "  LOWORD(eax) = %seax * %s;", buf1,
+            out_src_opr(buf2, g_opr_bufsz, po, &po->operand[0],
               buf1, 0));
           break;
         default:
@@ -4540,27 +5568,27 @@ tailcall:
         if (po->operand[0].lmod != OPLM_DWORD)
           ferr(po, "unhandled lmod %d\n", po->operand[0].lmod);
 
-        out_src_opr_u32(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_src_opr_u32(buf1, g_opr_bufsz, po, &po->operand[0]);
         strcpy(buf2, lmod_cast(po, po->operand[0].lmod,
           po->op == OP_IDIV));
         switch (po->operand[0].lmod) {
         case OPLM_DWORD:
           if (po->flags & OPF_32BIT)
-            snprintf(buf3, sizeof(buf3), "%seax", buf2);
+            snprintf(buf3, g_opr_bufsz, "%seax", buf2);
           else {
-            fprintf(fout, "  tmp64 = ((u64)edx << 32) | eax;\n");
-            snprintf(buf3, sizeof(buf3), "%stmp64",
+            ob_printf(ob, "  tmp64 = ((u64)edx << 32) | eax;\n");
+            snprintf(buf3, g_opr_bufsz, "%stmp64",
               (po->op == OP_IDIV) ? "(s64)" : "");
           }
           if (po->operand[0].type == OPT_REG
             && po->operand[0].reg == xDX)
           {
-            fprintf(fout, "  eax = %s / %s%s;", buf3, buf2, buf1);
-            fprintf(fout, "  edx = %s %% %s%s;\n", buf3, buf2, buf1);
+            ob_printf(ob, "  eax = %s / %s%s;", buf3, buf2, buf1);
+            ob_printf(ob, "  edx = %s %% %s%s;\n", buf3, buf2, buf1);
           }
           else {
-            fprintf(fout, "  edx = %s %% %s%s;\n", buf3, buf2, buf1);
-            fprintf(fout, "  eax = %s / %s%s;", buf3, buf2, buf1);
+            ob_printf(ob, "  edx = %s %% %s%s;\n", buf3, buf2, buf1);
+            ob_printf(ob, "  eax = %s / %s%s;", buf3, buf2, buf1);
           }
           break;
         default:
@@ -4576,9 +5604,9 @@ tailcall:
         if (pfomask != 0) {
           for (j = 0; j < 8; j++) {
             if (pfomask & (1 << j)) {
-              out_cmp_test(buf1, sizeof(buf1), po, j, 0);
-              fprintf(fout, "  cond_%s = %s;",
-                parsed_flag_op_names[j], buf1);
+              cond = out_cmp_test(po, j, 0);
+              ob_printf(ob, "  cond_%s = %s;",
+                parsed_flag_op_names[j], cond);
             }
           }
           pfomask = 0;
@@ -4595,12 +5623,12 @@ tailcall:
 
       // note: we reuse OP_Jcc for SETcc, only flags differ
       case OP_JCC:
-        fprintf(fout, "\n    goto %s;", po->operand[0].name);
+        ob_printf(ob, "\n    goto %s;", po->operand[0].name);
         break;
 
       case OP_JECXZ:
-        fprintf(fout, "  if (ecx == 0)\n");
-        fprintf(fout, "    goto %s;", po->operand[0].name);
+        ob_printf(ob, "  if (ecx == 0)\n");
+        ob_printf(ob, "    goto %s;", po->operand[0].name);
         strcat(g_comment, "jecxz");
         break;
 
@@ -4615,13 +5643,13 @@ tailcall:
           if (ret != 2)
             ferr(po, "parse failure for jmp '%s'\n",
               po->operand[0].name);
-          fprintf(fout, "  goto *jt_%s[%s];", buf1, buf2);
+          ob_printf(ob, "  goto *jt_%s[%s];", buf1, buf2);
           break;
         }
         else if (po->operand[0].type != OPT_LABEL)
           ferr(po, "unhandled jmp type\n");
 
-        fprintf(fout, "  goto %s;", po->operand[0].name);
+        ob_printf(ob, "  goto %s;", po->operand[0].name);
         break;
 
       case OP_CALL:
@@ -4634,42 +5662,44 @@ tailcall:
           // we treat conditional branch to another func
           // (yes such code exists..) as conditional tailcall
           strcat(buf3, "  ");
-          fprintf(fout, " {\n");
+          ob_printf(ob, " {\n");
         }
 
         if (pp->is_fptr && !pp->is_arg) {
-          fprintf(fout, "%s%s = %s;\n", buf3, pp->name,
-            out_src_opr(buf1, sizeof(buf1), po, &po->operand[0],
+          ob_printf(ob, "%s%s = %s;\n", buf3, pp->name,
+            out_src_opr(buf1, g_opr_bufsz, po, &po->operand[0],
               "(void *)", 0));
-          if (pp->is_unresolved)
-            fprintf(fout, "%sunresolved_call(\"%s:%d\", %s);\n",
+          if (pp->is_unresolved) {
+            ob_printf(ob, "%sunresolved_call(\"%s:%d\", %s);\n",
               buf3, asmfn, po->asmln, pp->name);
+            g_ctx->ln_used = 1;
+          }
         }
 
-        fprintf(fout, "%s", buf3);
+        ob_printf(ob, "%s", buf3);
         if (strstr(pp->ret_type.name, "int64")) {
           if (po->flags & OPF_TAIL)
             ferr(po, "int64 and tail?\n");
-          fprintf(fout, "tmp64 = ");
+          ob_printf(ob, "tmp64 = ");
         }
         else if (!IS(pp->ret_type.name, "void")) {
           if (po->flags & OPF_TAIL) {
             if (!IS(g_func_pp->ret_type.name, "void")) {
-              fprintf(fout, "return ");
+              ob_printf(ob, "return ");
               if (g_func_pp->ret_type.is_ptr != pp->ret_type.is_ptr)
-                fprintf(fout, "(%s)", g_func_pp->ret_type.name);
+                ob_printf(ob, "(%s)", g_func_pp->ret_type.name);
             }
           }
           else if (regmask & (1 << xAX)) {
-            fprintf(fout, "eax = ");
+            ob_printf(ob, "eax = ");
             if (pp->ret_type.is_ptr)
-              fprintf(fout, "(u32)");
+              ob_printf(ob, "(u32)");
           }
         }
 
         if (pp->name[0] == 0)
           ferr(po, "missing pp->name\n");
-        fprintf(fout, "%s%s(", pp->name,
+        ob_printf(ob, "%s%s(", pp->name,
           pp->has_structarg ? "_sa" : "");
 
         if (po->flags & OPF_ATAIL) {
@@ -4682,7 +5712,7 @@ tailcall:
 
           for (arg = j = 0; arg < pp->argc; arg++) {
             if (arg > 0)
-              fprintf(fout, ", ");
+              ob_printf(ob, ", ");
 
             cast[0] = 0;
             if (pp->arg[arg].type.is_ptr)
@@ -4690,21 +5720,21 @@ tailcall:
                 pp->arg[arg].type.name);
 
             if (pp->arg[arg].reg != NULL) {
-              fprintf(fout, "%s%s", cast, pp->arg[arg].reg);
+              ob_printf(ob, "%s%s", cast, pp->arg[arg].reg);
               continue;
             }
             // stack arg
             for (; j < g_func_pp->argc; j++)
               if (g_func_pp->arg[j].reg == NULL)
                 break;
-            fprintf(fout, "%sa%d", cast, j + 1);
+            ob_printf(ob, "%sa%d", cast, j + 1);
             j++;
           }
         }
         else {
           for (arg = 0; arg < pp->argc; arg++) {
             if (arg > 0)
-              fprintf(fout, ", ");
+              ob_printf(ob, ", ");
 
             cast[0] = 0;
             if (pp->arg[arg].type.is_ptr)
@@ -4713,43 +5743,43 @@ tailcall:
 
             if (pp->arg[arg].reg != NULL) {
               if (pp->arg[arg].type.is_retreg)
-                fprintf(fout, "&%s", pp->arg[arg].reg);
+                ob_printf(ob, "&%s", pp->arg[arg].reg);
               else
-                fprintf(fout, "%s%s", cast, pp->arg[arg].reg);
+                ob_printf(ob, "%s%s", cast, pp->arg[arg].reg);
               continue;
             }
 
             // stack arg
-            tmp_op = pp->arg[arg].datap;
+            tmp_op = call_arg_op(po, arg);
             if (tmp_op == NULL)
               ferr(po, "parsed_op missing for arg%d\n", arg);
 
             if (tmp_op->flags & OPF_VAPUSH) {
-              fprintf(fout, "ap");
+              ob_printf(ob, "ap");
             }
             else if (tmp_op->p_argpass != 0) {
-              fprintf(fout, "a%d", tmp_op->p_argpass);
+              ob_printf(ob, "a%d", tmp_op->p_argpass);
             }
             else if (tmp_op->p_argnum != 0) {
-              fprintf(fout, "%ss_a%d", cast, tmp_op->p_argnum);
+              ob_printf(ob, "%ss_a%d", cast, tmp_op->p_argnum);
             }
             else {
-              fprintf(fout, "%s",
-                out_src_opr(buf1, sizeof(buf1),
+              ob_printf(ob, "%s",
+                out_src_opr(buf1, g_opr_bufsz,
                   tmp_op, &tmp_op->operand[0], cast, 0));
             }
           }
         }
-        fprintf(fout, ");");
+        ob_printf(ob, ");");
 
         if (strstr(pp->ret_type.name, "int64")) {
-          fprintf(fout, "\n");
-          fprintf(fout, "%sedx = tmp64 >> 32;\n", buf3);
-          fprintf(fout, "%seax = tmp64;", buf3);
+          ob_printf(ob, "\n");
+          ob_printf(ob, "%sedx = tmp64 >> 32;\n", buf3);
+          ob_printf(ob, "%seax = tmp64;", buf3);
         }
 
         if (pp->is_unresolved) {
-          snprintf(buf2, sizeof(buf2), " unresolved %dreg",
+          snprintf(buf2, g_opr_bufsz, " unresolved %dreg",
             pp->argc_reg);
           strcat(g_comment, buf2);
         }
@@ -4769,7 +5799,7 @@ tailcall:
               ferr(po, "int func -> void func tailcall?\n");
             }
             else {
-              fprintf(fout, "\n%sreturn;", buf3);
+              ob_printf(ob, "\n%sreturn;", buf3);
               strcat(g_comment, " ^ tailcall");
             }
           }
@@ -4784,7 +5814,7 @@ tailcall:
           strcat(g_comment, " cond");
 
         if (po->flags & OPF_CC)
-          fprintf(fout, "\n  }");
+          ob_printf(ob, "\n  }");
 
         delayed_flag_op = NULL;
         last_arith_dst = NULL;
@@ -4792,70 +5822,70 @@ tailcall:
 
       case OP_RET:
         if (g_func_pp->is_vararg)
-          fprintf(fout, "  va_end(ap);\n");
+          ob_printf(ob, "  va_end(ap);\n");
         if (g_func_pp->has_retreg) {
           for (arg = 0; arg < g_func_pp->argc; arg++)
             if (g_func_pp->arg[arg].type.is_retreg)
-              fprintf(fout, "  *r_%s = %s;\n",
+              ob_printf(ob, "  *r_%s = %s;\n",
                 g_func_pp->arg[arg].reg, g_func_pp->arg[arg].reg);
         }
  
         if (IS(g_func_pp->ret_type.name, "void")) {
           if (i != opcnt - 1 || label_pending)
-            fprintf(fout, "  return;");
+            ob_printf(ob, "  return;");
         }
         else if (g_func_pp->ret_type.is_ptr) {
-          fprintf(fout, "  return (%s)eax;",
+          ob_printf(ob, "  return (%s)eax;",
             g_func_pp->ret_type.name);
         }
         else if (IS(g_func_pp->ret_type.name, "__int64"))
-          fprintf(fout, "  return ((u64)edx << 32) | eax;");
+          ob_printf(ob, "  return ((u64)edx << 32) | eax;");
         else
-          fprintf(fout, "  return eax;");
+          ob_printf(ob, "  return eax;");
 
         last_arith_dst = NULL;
         delayed_flag_op = NULL;
         break;
 
       case OP_PUSH:
-        out_src_opr_u32(buf1, sizeof(buf1), po, &po->operand[0]);
+        out_src_opr_u32(buf1, g_opr_bufsz, po, &po->operand[0]);
         if (po->p_argnum != 0) {
           // special case - saved func arg
-          fprintf(fout, "  s_a%d = %s;", po->p_argnum, buf1);
+          ob_printf(ob, "  s_a%d = %s;", po->p_argnum, buf1);
           break;
         }
         else if (po->flags & OPF_RSAVE) {
-          fprintf(fout, "  s_%s = %s;", buf1, buf1);
+          ob_printf(ob, "  s_%s = %s;", buf1, buf1);
           break;
         }
         else if (g_func_pp->is_userstack) {
-          fprintf(fout, "  *(--esp) = %s;", buf1);
+          ob_printf(ob, "  *(--esp) = %s;", buf1);
           break;
         }
-        if (!(g_ida_func_attr & IDAFA_NORETURN))
+        if (!(g_ctx->ida_func_attr & IDAFA_NORETURN))
           ferr(po, "stray push encountered\n");
         no_output = 1;
         break;
 
       case OP_POP:
         if (po->flags & OPF_RSAVE) {
-          out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-          fprintf(fout, "  %s = s_%s;", buf1, buf1);
+          out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+          ob_printf(ob, "  %s = s_%s;", buf1, buf1);
           break;
         }
         else if (po->datap != NULL) {
           // push/pop pair
           tmp_op = po->datap;
-          out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]);
-          fprintf(fout, "  %s = %s;", buf1,
-            out_src_opr(buf2, sizeof(buf2),
+          out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]);
+          ob_printf(ob, "  %s = %s;", buf1,
+            out_src_opr(buf2, g_opr_bufsz,
               tmp_op, &tmp_op->operand[0],
-              default_cast_to(buf3, sizeof(buf3), &po->operand[0]), 0));
+              default_cast_to(buf3, g_opr_bufsz, &po->operand[0]), 0));
           break;
         }
         else if (g_func_pp->is_userstack) {
-          fprintf(fout, "  %s = *esp++;",
-            out_dst_opr(buf1, sizeof(buf1), po, &po->operand[0]));
+          ob_printf(ob, "  %s = *esp++;",
+            out_dst_opr(buf1, g_opr_bufsz, po, &po->operand[0]));
           break;
         }
         else
@@ -4877,12 +5907,12 @@ tailcall:
       char *p = g_comment;
       while (my_isblank(*p))
         p++;
-      fprintf(fout, "  // %s", p);
+      ob_printf(ob, "  // %s", p);
       g_comment[0] = 0;
       no_output = 0;
     }
     if (!no_output)
-      fprintf(fout, "\n");
+      ob_printf(ob, "\n");
 
     // some sanity checking
     if (po->flags & OPF_REP) {
@@ -4915,28 +5945,12 @@ tailcall:
   }
 
   if (g_stack_fsz && !g_stack_frame_used)
-    fprintf(fout, "  (void)sf;\n");
-
-  fprintf(fout, "}\n\n");
-
-  // cleanup
-  for (i = 0; i < opcnt; i++) {
-    struct label_ref *lr, *lr_del;
+    ob_printf(ob, "  (void)sf;\n");
 
-    lr = g_label_refs[i].next;
-    while (lr != NULL) {
-      lr_del = lr;
-      lr = lr->next;
-      free(lr_del);
-    }
-    g_label_refs[i].i = -1;
-    g_label_refs[i].next = NULL;
+  ob_printf(ob, "}\n\n");
+  tm_mark(TM_OUT);
 
-    if (ops[i].op == OP_CALL) {
-      if (ops[i].pp)
-        proto_release(ops[i].pp);
-    }
-  }
+  // label refs and call protos go with the arena
   g_func_pp = NULL;
 }
 
@@ -4956,266 +5970,1084 @@ static void set_label(int i, const char *name)
     aerr("dupe label '%s' vs '%s'?\n", name, g_labels[i]);
   memcpy(g_labels[i], name, len);
   g_labels[i][len] = 0;
+  label_idx_add(i);
 }
 
-// '=' needs special treatment..
-static char *next_word_s(char *w, size_t wsize, char *s)
+static struct func_ctx *func_ctx_new(void)
 {
-	size_t i;
-
-	s = sskip(s);
+  struct func_ctx *ctx;
+
+  ctx = mem_calloc(MEM_IR, 1, sizeof(*ctx));
+  my_assert_not(ctx, NULL);
+  ctx->op_alloc = 256;
+  ctx->ops = mem_calloc(MEM_IR, ctx->op_alloc, sizeof(ctx->ops[0]));
+  my_assert_not(ctx->ops, NULL);
+  ctx->labels = mem_calloc(MEM_LABELS, ctx->op_alloc, sizeof(ctx->labels[0]));
+  my_assert_not(ctx->labels, NULL);
+  ctx->label_refs = mem_calloc(MEM_LABELS, ctx->op_alloc,
+    sizeof(ctx->label_refs[0]));
+  my_assert_not(ctx->label_refs, NULL);
+  ctx->label_refs[0].i = -1;
+  ctx->label_idx_size = 256;
+  ctx->label_idx = mem_calloc(MEM_LABELS, ctx->label_idx_size,
+    sizeof(ctx->label_idx[0]));
+  my_assert_not(ctx->label_idx, NULL);
+  ctx->label_idx_gen = 1;
+
+  ctx->eq_alloc = 128;
+  ctx->eqs = mem_malloc(MEM_IR, ctx->eq_alloc * sizeof(ctx->eqs[0]));
+  my_assert_not(ctx->eqs, NULL);
+  ctx->asm_hash = HASH64_INIT;
+
+  return ctx;
+}
 
-	for (i = 0; i < wsize - 1; i++) {
-		if (s[i] == 0 || my_isblank(s[i]) || (s[i] == '=' && i > 0))
-			break;
-		w[i] = s[i];
-	}
-	w[i] = 0;
+static void func_ctx_bind(struct func_ctx *ctx)
+{
+  g_ctx = ctx;
+  ops = ctx->ops;
+  g_labels = ctx->labels;
+  g_label_refs = ctx->label_refs;
+}
 
-	if (s[i] != 0 && !my_isblank(s[i]) && s[i] != '=')
-		printf("warning: '%s' truncated\n", w);
+// op slot i is about to be used: make room and clear it, slots are
+// only cleared here so that ending a function doesn't touch them
+static void op_slot_init(int i)
+{
+  struct func_ctx *ctx = g_ctx;
+
+  if (i >= ctx->op_alloc) {
+    ctx->op_alloc = ctx->op_alloc * 2 + 256;
+    ctx->ops = mem_realloc(MEM_IR, ctx->ops,
+      ctx->op_alloc * sizeof(ctx->ops[0]));
+    my_assert_not(ctx->ops, NULL);
+    ctx->labels = mem_realloc(MEM_LABELS, ctx->labels,
+      ctx->op_alloc * sizeof(ctx->labels[0]));
+    my_assert_not(ctx->labels, NULL);
+    ctx->label_refs = mem_realloc(MEM_LABELS, ctx->label_refs,
+      ctx->op_alloc * sizeof(ctx->label_refs[0]));
+    my_assert_not(ctx->label_refs, NULL);
+    func_ctx_bind(ctx);
+  }
 
-	return s + i;
+  memset(&ops[i], 0, sizeof(ops[i]));
+  g_labels[i][0] = 0;
+  g_label_refs[i].i = -1;
+  g_label_refs[i].next = NULL;
 }
 
-struct chunk_item {
-  char *name;
-  long fptr;
-  int asmln;
-};
+// make current ctx ready for the next function
+static void func_ctx_reset(void)
+{
+  int i;
 
-static struct chunk_item *func_chunks;
-static int func_chunk_cnt;
-static int func_chunk_alloc;
+  g_ctx->opcnt = 0;
+  op_slot_init(0);
 
-static void add_func_chunk(FILE *fasm, const char *name, int line)
-{
-  if (func_chunk_cnt >= func_chunk_alloc) {
-    func_chunk_alloc *= 2;
-    func_chunks = realloc(func_chunks,
-      func_chunk_alloc * sizeof(func_chunks[0]));
-    my_assert_not(func_chunks, NULL);
+  label_idx_reset();
+  g_ctx->eqcnt = 0;
+  for (i = 0; i < g_ctx->func_pd_cnt; i++) {
+    mem_free(g_ctx->func_pd[i].d);
+    g_ctx->func_pd[i].d = NULL;
   }
-  func_chunks[func_chunk_cnt].fptr = ftell(fasm);
-  func_chunks[func_chunk_cnt].name = strdup(name);
-  func_chunks[func_chunk_cnt].asmln = line;
-  func_chunk_cnt++;
+  g_ctx->func_pd_cnt = 0;
+  g_ctx->ida_func_attr = 0;
+  g_ctx->func[0] = 0;
+
+  // label refs, call protos, jumptable labels, pp_deps, CFG
+  arena_reset(&g_ctx->arena);
+  g_ctx->bb_cnt = g_ctx->rpo_cnt = g_ctx->exit_cnt = 0;
+  g_ctx->arg_walks = NULL;
+  g_ctx->pp_dep_cnt = 0;
+  g_ctx->asm_hash = HASH64_INIT;
+  g_ctx->ln_used = 0;
+  memset(&g_ctx->tm, 0, sizeof(g_ctx->tm));
 }
 
-static int cmp_chunks(const void *p1, const void *p2)
+// -c: gen_func() results on disk, named by a hash of the function's
+// asm lines (chunks and jumptables included, as those are read while
+// the function is parsed).  Protos are checked on lookup, so editing
+// the header only misses on functions that use the changed protos.
+// Entry: "tcache <ln_hash> <deps> <msg_size> <out_size> <ln_used>\n",
+// "<hash> <name>\n" per proto, then messages and C output.
+static const char *g_cache_dir;
+static __thread int g_cache_checking;
+static int g_keep_going;
+
+// gen_func() output being captured for the cache
+static __thread struct {
+  FILE *msg_up;   // where it would have gone
+  FILE *msg;
+  char *msg_buf;
+  size_t msg_size;
+  struct outbuf *out;
+  size_t out_start; // output is what's appended after this
+} g_cap;
+
+static unsigned long long hash64(unsigned long long h,
+  const void *data, size_t size)
 {
-  const struct chunk_item *c1 = p1, *c2 = p2;
-  return strcmp(c1->name, c2->name);
-}
+  const unsigned char *p = data;
+  size_t i;
 
-static int cmpstringp(const void *p1, const void *p2)
-{
-  return strcmp(*(char * const *)p1, *(char * const *)p2);
+  for (i = 0; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+
+  return h;
 }
 
-static void scan_ahead(FILE *fasm)
+static void cache_note_proto(const char *name, int len,
+  const struct parsed_proto *pp)
 {
-  char words[2][256];
-  char line[256];
-  long oldpos;
-  int oldasmln;
-  int wordc;
+  struct pp_dep *dep;
   char *p;
   int i;
 
-  oldpos = ftell(fasm);
-  oldasmln = asmln;
+  if (g_cache_dir == NULL || g_cache_checking)
+    return;
 
-  while (fgets(line, sizeof(line), fasm))
-  {
-    wordc = 0;
-    asmln++;
+  for (i = 0; i < g_ctx->pp_dep_cnt; i++)
+    if (!strncmp(g_ctx->pp_deps[i].name, name, len)
+        && g_ctx->pp_deps[i].name[len] == 0)
+      return;
 
-    p = sskip(line);
-    if (*p == 0)
-      continue;
+  if (g_ctx->pp_dep_cnt >= g_ctx->pp_dep_alloc) {
+    g_ctx->pp_dep_alloc = g_ctx->pp_dep_alloc * 2 + 16;
+    g_ctx->pp_deps = mem_realloc(MEM_PROTO, g_ctx->pp_deps,
+      g_ctx->pp_dep_alloc * sizeof(g_ctx->pp_deps[0]));
+    my_assert_not(g_ctx->pp_deps, NULL);
+  }
+  dep = &g_ctx->pp_deps[g_ctx->pp_dep_cnt++];
+  dep->name = p = fzalloc(len + 1);
+  memcpy(p, name, len);
+  dep->hash = pp != NULL ? pp->src_hash : 0;
+}
 
-    if (*p == ';')
-    {
-      // get rid of random tabs
-      for (i = 0; line[i] != 0; i++)
-        if (line[i] == '\t')
-          line[i] = ' ';
+static void note_proto_lookup(const char *name, int len,
+  const struct parsed_proto *pp)
+{
+  g_ctx->tm.cnt[TMC_PROTO]++;
+  cache_note_proto(name, len, pp);
+}
 
-      if (p[2] == 'S' && IS_START(p, "; START OF FUNCTION CHUNK FOR "))
-      {
-        p += 30;
-        next_word(words[0], sizeof(words[0]), p);
-        if (words[0][0] == 0)
-          aerr("missing name for func chunk?\n");
+// things only messages and line refs depend on
+static unsigned long long cache_ln_hash(int opcnt)
+{
+  unsigned long long h = HASH64_INIT;
+  int i;
 
-        add_func_chunk(fasm, words[0], asmln);
-      }
-      else if (IS_START(p, "; sctend"))
-        break;
+  h = hash64(h, asmfn, strlen(asmfn) + 1);
+  h = hash64(h, hdrfn, strlen(hdrfn) + 1);
+  h = hash64(h, &g_ctx->asmln, sizeof(g_ctx->asmln));
+  for (i = 0; i < opcnt; i++)
+    h = hash64(h, &ops[i].asmln, sizeof(ops[i].asmln));
 
-      continue;
-    } // *p == ';'
+  return h;
+}
 
-    for (wordc = 0; wordc < ARRAY_SIZE(words); wordc++) {
-      words[wordc][0] = 0;
-      p = sskip(next_word_s(words[wordc], sizeof(words[0]), p));
-      if (*p == 0 || *p == ';') {
-        wordc++;
-        break;
-      }
-    }
+static int cache_load(const char *path, struct outbuf *ob,
+  unsigned long long ln_hash)
+{
+  const struct parsed_proto *pp;
+  unsigned long long ln_hash_c;
+  size_t msg_size, out_size;
+  char name[256], line[320];
+  unsigned int hash;
+  int ret = 0, ln_used;
+  char *buf = NULL;
+  int i, cnt;
+  FILE *f;
+
+  f = fopen(path, "rb");
+  if (f == NULL)
+    return 0;
 
-    if (wordc == 2 && IS(words[1], "ends"))
+  if (fscanf(f, "tcache %llx %d %zu %zu %d\n", &ln_hash_c, &cnt,
+        &msg_size, &out_size, &ln_used) != 5)
+    goto out;
+  if ((msg_size != 0 || ln_used) && ln_hash_c != ln_hash)
+    goto out;
+
+  g_cache_checking = 1;
+  for (i = 0; i < cnt; i++) {
+    if (fgets(line, sizeof(line), f) == NULL)
+      break;
+    if (sscanf(line, "%x %255s", &hash, name) != 2)
+      break;
+    pp = proto_parse(g_fhdr, name, 1);
+    if (hash != (pp != NULL ? pp->src_hash : 0))
       break;
   }
-
-  fseek(fasm, oldpos, SEEK_SET);
-  asmln = oldasmln;
+  g_cache_checking = 0;
+  if (i != cnt)
+    goto out;
+
+  buf = mem_malloc(MEM_OUTPUT, msg_size + 1);
+  my_assert_not(buf, NULL);
+  ob_reserve(ob, out_size);
+  if (fread(buf, 1, msg_size, f) != msg_size
+      || fread(ob->buf + ob->len, 1, out_size, f) != out_size)
+    goto out;
+
+  fwrite(buf, 1, msg_size, g_msgf);
+  ob->len += out_size;
+  ret = 1;
+
+out:
+  mem_free(buf);
+  fclose(f);
+  return ret;
 }
 
-int main(int argc, char *argv[])
+static void cache_store(const char *path, unsigned long long ln_hash)
 {
-  FILE *fout, *fasm, *frlist;
-  struct parsed_data *pd = NULL;
-  int pd_alloc = 0;
-  char **rlist = NULL;
-  int rlist_len = 0;
-  int rlist_alloc = 0;
-  int func_chunks_used = 0;
-  int func_chunks_sorted = 0;
-  int func_chunk_i = -1;
-  long func_chunk_ret = 0;
-  int func_chunk_ret_ln = 0;
-  int scanned_ahead = 0;
-  char line[256];
-  char words[20][256];
-  enum opr_lenmod lmod;
-  char *sctproto = NULL;
-  int in_func = 0;
-  int pending_endp = 0;
-  int skip_func = 0;
-  int skip_warned = 0;
-  int eq_alloc;
-  int verbose = 0;
-  int multi_seg = 0;
-  int end = 0;
-  int arg_out;
-  int arg;
-  int pi = 0;
-  int i, j;
-  int ret, len;
-  char *p;
-  int wordc;
+  char tmp[600];
+  size_t out_size;
+  FILE *f;
+  int i;
 
-  for (arg = 1; arg < argc; arg++) {
-    if (IS(argv[arg], "-v"))
-      verbose = 1;
-    else if (IS(argv[arg], "-rf"))
-      g_allow_regfunc = 1;
-    else if (IS(argv[arg], "-m"))
-      multi_seg = 1;
-    else
-      break;
-  }
+  snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, (int)getpid(),
+    (unsigned long)pthread_self());
+  f = fopen(tmp, "wb");
+  if (f == NULL)
+    return;
 
-  if (argc < arg + 3) {
-    printf("usage:\n%s [-v] [-rf] [-m] <.c> <.asm> <hdrf> [rlist]*\n",
-      argv[0]);
-    return 1;
-  }
+  out_size = g_cap.out->len - g_cap.out_start;
+  fprintf(f, "tcache %llx %d %zu %zu %d\n", ln_hash, g_ctx->pp_dep_cnt,
+    g_cap.msg_size, out_size, g_ctx->ln_used);
+  for (i = 0; i < g_ctx->pp_dep_cnt; i++)
+    fprintf(f, "%x %s\n", g_ctx->pp_deps[i].hash, g_ctx->pp_deps[i].name);
+  fwrite(g_cap.msg_buf, 1, g_cap.msg_size, f);
+  fwrite(g_cap.out->buf + g_cap.out_start, 1, out_size, f);
 
-  arg_out = arg++;
+  if (fclose(f) != 0 || rename(tmp, path) != 0)
+    unlink(tmp);
+}
 
-  asmfn = argv[arg++];
-  fasm = fopen(asmfn, "r");
-  my_assert_not(fasm, NULL);
+// stop capturing, pass on what was captured
+static void cache_cap_end(int keep_out)
+{
+  if (g_cap.msg == NULL)
+    return;
 
-  hdrfn = argv[arg++];
-  g_fhdr = fopen(hdrfn, "r");
-  my_assert_not(g_fhdr, NULL);
+  fclose(g_cap.msg);
+  g_msgf = g_cap.msg_up;
+  fwrite(g_cap.msg_buf, 1, g_cap.msg_size, g_cap.msg_up);
+  if (!keep_out)
+    g_cap.out->len = g_cap.out_start;
+}
 
-  rlist_alloc = 64;
-  rlist = malloc(rlist_alloc * sizeof(rlist[0]));
-  my_assert_not(rlist, NULL);
-  // needs special handling..
-  rlist[rlist_len++] = "__alloca_probe";
+static void cache_cap_free(void)
+{
+  free(g_cap.msg_buf);
+  memset(&g_cap, 0, sizeof(g_cap));
+}
 
-  func_chunk_alloc = 32;
-  func_chunks = malloc(func_chunk_alloc * sizeof(func_chunks[0]));
-  my_assert_not(func_chunks, NULL);
+// -k also captures, so that a failed function leaves no partial output
+static void gen_func_cached(struct outbuf *ob, FILE *fhdr, const char *funcn,
+  int opcnt)
+{
+  unsigned long long key, ln_hash = 0;
+  char path[512];
 
-  memset(words, 0, sizeof(words));
+  if (g_cache_dir == NULL && !g_keep_going) {
+    gen_func(ob, fhdr, funcn, opcnt);
+    return;
+  }
 
-  for (; arg < argc; arg++) {
-    frlist = fopen(argv[arg], "r");
-    my_assert_not(frlist, NULL);
+  if (g_cache_dir != NULL) {
+    key = hash64(g_ctx->asm_hash, funcn, strlen(funcn) + 1);
+    key = hash64(key, &g_allow_regfunc, sizeof(g_allow_regfunc));
+    key = hash64(key, __DATE__ __TIME__, sizeof(__DATE__ __TIME__));
+    snprintf(path, sizeof(path), "%s/%016llx", g_cache_dir, key);
+    ln_hash = cache_ln_hash(opcnt);
 
-    while (fgets(line, sizeof(line), frlist)) {
-      p = sskip(line);
-      if (*p == 0 || *p == ';')
-        continue;
-      if (*p == '#') {
-        if (IS_START(p, "#if 0")
-         || (g_allow_regfunc && IS_START(p, "#if NO_REGFUNC")))
-        {
-          skip_func = 1;
-        }
-        else if (IS_START(p, "#endif"))
-          skip_func = 0;
-        continue;
-      }
-      if (skip_func)
-        continue;
+    if (cache_load(path, ob, ln_hash))
+      return;
+  }
 
-      p = next_word(words[0], sizeof(words[0]), p);
-      if (words[0][0] == 0)
-        continue;
+  g_cap.msg_up = g_msgf;
+  g_cap.msg = open_memstream(&g_cap.msg_buf, &g_cap.msg_size);
+  my_assert_not(g_cap.msg, NULL);
+  g_cap.out = ob;
+  g_cap.out_start = ob->len;
+  g_msgf = g_cap.msg;
 
-      if (rlist_len >= rlist_alloc) {
-        rlist_alloc = rlist_alloc * 2 + 64;
-        rlist = realloc(rlist, rlist_alloc * sizeof(rlist[0]));
-        my_assert_not(rlist, NULL);
-      }
-      rlist[rlist_len++] = strdup(words[0]);
-    }
-    skip_func = 0;
+  gen_func(ob, fhdr, funcn, opcnt);
 
-    fclose(frlist);
-    frlist = NULL;
-  }
+  cache_cap_end(1);
+  if (g_cache_dir != NULL)
+    cache_store(path, ln_hash);
+  cache_cap_free();
+}
 
-  if (rlist_len > 0)
-    qsort(rlist, rlist_len, sizeof(rlist[0]), cmpstringp);
+static __thread jmp_buf *g_err_jmp;
 
-  fout = fopen(argv[arg_out], "w");
-  my_assert_not(fout, NULL);
+// -T: totals and every translated function, for the report
+struct tm_func {
+  char *name;
+  unsigned long long ns;
+  struct func_tm tm;
+};
 
-  eq_alloc = 128;
-  g_eqs = malloc(eq_alloc * sizeof(g_eqs[0]));
-  my_assert_not(g_eqs, NULL);
+static struct {
+  pthread_mutex_t lock;
+  unsigned long long start;
+  unsigned long long hdr_ns;
+  unsigned long long chunk_ns;
+  struct func_tm total;
+  struct tm_func *funcs;
+  int func_cnt;
+  int func_alloc;
+} g_tm = { PTHREAD_MUTEX_INITIALIZER };
 
-  for (i = 0; i < ARRAY_SIZE(g_label_refs); i++) {
-    g_label_refs[i].i = -1;
-    g_label_refs[i].next = NULL;
-  }
+#define TM_TOP_FUNCS 10
 
-  while (fgets(line, sizeof(line), fasm))
+static void tm_func_done(void)
+{
+  struct tm_func *tf;
+  int i;
+
+  pthread_mutex_lock(&g_tm.lock);
+  if (g_tm.func_cnt >= g_tm.func_alloc) {
+    g_tm.func_alloc = g_tm.func_alloc * 2 + 64;
+    g_tm.funcs = mem_realloc(MEM_MISC, g_tm.funcs,
+      g_tm.func_alloc * sizeof(g_tm.funcs[0]));
+    my_assert_not(g_tm.funcs, NULL);
+  }
+  tf = &g_tm.funcs[g_tm.func_cnt++];
+  tf->name = mem_strdup(MEM_MISC, g_ctx->func);
+  my_assert_not(tf->name, NULL);
+  tf->tm = g_ctx->tm;
+  tf->ns = 0;
+  for (i = 0; i < TM_PHASES; i++) {
+    tf->ns += tf->tm.ns[i];
+    g_tm.total.ns[i] += tf->tm.ns[i];
+  }
+  for (i = 0; i < TM_COUNTS; i++)
+    g_tm.total.cnt[i] += tf->tm.cnt[i];
+  pthread_mutex_unlock(&g_tm.lock);
+}
+
+// slowest first, -j finishes functions in any order
+static int cmp_tm_funcs(const void *p1, const void *p2)
+{
+  const struct tm_func *f1 = p1, *f2 = p2;
+
+  if (f1->ns != f2->ns)
+    return f1->ns < f2->ns ? 1 : -1;
+  return strcmp(f1->name, f2->name);
+}
+
+static void tm_print_phases(const struct func_tm *tm)
+{
+  static const char *names[TM_PHASES] = {
+    "parse", "pass1", "pass2", "pass3", "pass4", "output",
+  };
+  int i;
+
+  for (i = 0; i < TM_PHASES; i++)
+    printf(" %s %.3fms", names[i], tm->ns[i] / 1000000.0);
+  printf("\n");
+}
+
+static void tm_print(void)
+{
+  const struct func_tm *t = &g_tm.total;
+  int i;
+
+  printf("timing: %.3fs total, headers %.3fs, chunk index %.3fs, "
+    "%d functions\n", (tm_now() - g_tm.start) / 1000000000.0,
+    g_tm.hdr_ns / 1000000000.0, g_tm.chunk_ns / 1000000000.0,
+    g_tm.func_cnt);
+  printf("  phases (summed over -j threads):");
+  tm_print_phases(t);
+  printf("  calls: scan_for_pop %llu, call arg walks %llu, "
+    "scan_for_flag_set %llu, proto lookups %llu\n",
+    t->cnt[TMC_SCAN_POP], t->cnt[TMC_CALL_ARGS],
+    t->cnt[TMC_FLAG_SET], t->cnt[TMC_PROTO]);
+
+  qsort(g_tm.funcs, g_tm.func_cnt, sizeof(g_tm.funcs[0]), cmp_tm_funcs);
+  printf("slowest functions:\n");
+  for (i = 0; i < g_tm.func_cnt && i < TM_TOP_FUNCS; i++) {
+    t = &g_tm.funcs[i].tm;
+    printf("  %s: %.3fms, scan_for_pop %llu, call arg walks %llu, "
+      "scan_for_flag_set %llu, proto lookups %llu\n   ",
+      g_tm.funcs[i].name, g_tm.funcs[i].ns / 1000000.0,
+      t->cnt[TMC_SCAN_POP], t->cnt[TMC_CALL_ARGS],
+      t->cnt[TMC_FLAG_SET], t->cnt[TMC_PROTO]);
+    tm_print_phases(t);
+  }
+}
+
+// gen_func() for the current ctx, an error only fails the function here,
+// func_failed() decides if it's fatal
+static void gen_func_unit(void)
+{
+  jmp_buf jb;
+
+  if (setjmp(jb) == 0) {
+    g_err_jmp = &jb;
+    gen_func_cached(&g_ctx->out, g_fhdr, g_ctx->func, g_ctx->opcnt);
+  }
+  else {
+    g_ctx->failed = 1;
+    g_ctx->err_msg = mem_strdup(MEM_MISC, g_err_msg);
+    my_assert_not(g_ctx->err_msg, NULL);
+    if (g_keep_going)
+      ob_printf(&g_ctx->out, "// %s: translation failed\n\n",
+        g_ctx->func);
+  }
+  g_err_jmp = NULL;
+
+  if (g_timing)
+    tm_func_done();
+}
+
+// -k: failures are collected for the summary
+static char **g_failures;
+static int g_failure_cnt;
+
+// called in output order
+static void func_failed(struct func_ctx *ctx)
+{
+  if (!g_keep_going) {
+    fcloseall();
+    exit(1);
+  }
+
+  g_failures = mem_realloc(MEM_MISC, g_failures,
+    (g_failure_cnt + 1) * sizeof(g_failures[0]));
+  my_assert_not(g_failures, NULL);
+  g_failures[g_failure_cnt++] = ctx->err_msg;
+  ctx->err_msg = NULL;
+  ctx->failed = 0;
+}
+
+// -j: functions are parsed by the main thread and handed to workers,
+// results are written in submission order by the main thread
+static struct {
+  int count;              // workers, 0 if not used
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  struct func_ctx **queue; // ring, submission order
+  int q_size;
+  int q_head;             // next to write out
+  int q_next;             // next for a worker to take
+  int q_tail;             // next to submit
+  int stop;
+  struct func_ctx **free_ctx;
+  int free_cnt;
+  FILE *fout;
+} g_jobs;
+
+static __thread int g_is_worker;
+
+static void *job_worker(void *arg)
+{
+  struct func_ctx *ctx;
+
+  g_is_worker = 1;
+
+  for (;;) {
+    pthread_mutex_lock(&g_jobs.lock);
+    while (g_jobs.q_next == g_jobs.q_tail && !g_jobs.stop)
+      pthread_cond_wait(&g_jobs.work_cond, &g_jobs.lock);
+    if (g_jobs.q_next == g_jobs.q_tail) {
+      pthread_mutex_unlock(&g_jobs.lock);
+      break;
+    }
+    ctx = g_jobs.queue[g_jobs.q_next % g_jobs.q_size];
+    g_jobs.q_next++;
+    pthread_mutex_unlock(&g_jobs.lock);
+
+    func_ctx_bind(ctx);
+    asmln = ctx->asmln;
+    g_msgf = ctx->msg;
+
+    if (ctx->gen)
+      gen_func_unit();
+    func_ctx_reset();
+
+    pthread_mutex_lock(&g_jobs.lock);
+    ctx->done = 1;
+    pthread_cond_broadcast(&g_jobs.done_cond);
+    pthread_mutex_unlock(&g_jobs.lock);
+  }
+
+  return NULL;
+}
+
+static void job_ctx_bind(struct func_ctx *ctx)
+{
+  ctx->msg = open_memstream(&ctx->msg_buf, &ctx->msg_size);
+  my_assert_not(ctx->msg, NULL);
+  func_ctx_bind(ctx);
+  g_msgf = ctx->msg;
+}
+
+static void job_ctx_flush(struct func_ctx *ctx)
+{
+  fclose(ctx->msg);
+  fwrite(ctx->msg_buf, 1, ctx->msg_size, stdout);
+  free(ctx->msg_buf);
+  // nothing is output between .asm files, when there's no fout
+  ob_flush(&ctx->out, g_jobs.fout);
+  ctx->msg = NULL;
+  ctx->msg_buf = NULL;
+}
+
+// write out the oldest job, if it's done (or wait for it)
+static int jobs_write_one(int wait)
+{
+  struct func_ctx *ctx;
+
+  pthread_mutex_lock(&g_jobs.lock);
+  while (g_jobs.q_head != g_jobs.q_tail
+    && !g_jobs.queue[g_jobs.q_head % g_jobs.q_size]->done)
   {
-    wordc = 0;
-    asmln++;
+    if (!wait) {
+      pthread_mutex_unlock(&g_jobs.lock);
+      return 0;
+    }
+    pthread_cond_wait(&g_jobs.done_cond, &g_jobs.lock);
+  }
+  if (g_jobs.q_head == g_jobs.q_tail) {
+    pthread_mutex_unlock(&g_jobs.lock);
+    return 0;
+  }
+  ctx = g_jobs.queue[g_jobs.q_head % g_jobs.q_size];
+  g_jobs.q_head++;
+  pthread_mutex_unlock(&g_jobs.lock);
+
+  job_ctx_flush(ctx);
+  if (ctx->failed)
+    func_failed(ctx);
+  ctx->done = 0;
+  g_jobs.free_ctx[g_jobs.free_cnt++] = ctx;
+  return 1;
+}
+
+// hand current ctx to the workers, bind a free one
+static void jobs_submit(int gen)
+{
+  struct func_ctx *ctx = g_ctx;
+
+  ctx->gen = gen;
+  ctx->asmln = asmln;
+
+  pthread_mutex_lock(&g_jobs.lock);
+  g_jobs.queue[g_jobs.q_tail % g_jobs.q_size] = ctx;
+  g_jobs.q_tail++;
+  pthread_cond_signal(&g_jobs.work_cond);
+  pthread_mutex_unlock(&g_jobs.lock);
+
+  while (jobs_write_one(0))
+    ;
+  while (g_jobs.free_cnt == 0)
+    jobs_write_one(1);
+
+  job_ctx_bind(g_jobs.free_ctx[--g_jobs.free_cnt]);
+}
+
+static void jobs_start(int count)
+{
+  int i;
+
+  g_jobs.count = count;
+  // every ctx may end up queued, including the one being parsed
+  g_jobs.q_size = count * 4 + 1;
+  g_jobs.queue = mem_calloc(MEM_MISC, g_jobs.q_size, sizeof(g_jobs.queue[0]));
+  my_assert_not(g_jobs.queue, NULL);
+  g_jobs.free_ctx = mem_calloc(MEM_MISC, g_jobs.q_size,
+    sizeof(g_jobs.free_ctx[0]));
+  my_assert_not(g_jobs.free_ctx, NULL);
+  for (i = 0; i < g_jobs.q_size - 1; i++)
+    g_jobs.free_ctx[g_jobs.free_cnt++] = func_ctx_new();
+
+  pthread_mutex_init(&g_jobs.lock, NULL);
+  pthread_cond_init(&g_jobs.work_cond, NULL);
+  pthread_cond_init(&g_jobs.done_cond, NULL);
+
+  g_jobs.threads = mem_calloc(MEM_MISC, count, sizeof(g_jobs.threads[0]));
+  my_assert_not(g_jobs.threads, NULL);
+  for (i = 0; i < count; i++) {
+    if (pthread_create(&g_jobs.threads[i], NULL, job_worker, NULL) != 0) {
+      printf("pthread_create failed\n");
+      exit(1);
+    }
+  }
+
+  // the main thread's ctx goes to the pool too
+  job_ctx_bind(g_ctx);
+}
+
+// wait until everything submitted is written out (to g_jobs.fout,
+// which may change after this), a new ctx is bound for what follows
+static void jobs_sync(void)
+{
+  // last one carries the remaining messages
+  jobs_submit(0);
+  while (jobs_write_one(1))
+    ;
+}
+
+static void jobs_finish(void)
+{
+  int i;
+
+  jobs_sync();
+
+  pthread_mutex_lock(&g_jobs.lock);
+  g_jobs.stop = 1;
+  pthread_cond_broadcast(&g_jobs.work_cond);
+  pthread_mutex_unlock(&g_jobs.lock);
+  for (i = 0; i < g_jobs.count; i++)
+    pthread_join(g_jobs.threads[i], NULL);
+
+  job_ctx_flush(g_ctx);
+  g_msgf = stdout;
+  g_jobs.count = 0;
+}
+
+static void err_exit(void)
+{
+  fputs(g_err_msg, g_msgf);
+
+  if (g_cap.msg != NULL) {
+    cache_cap_end(!g_keep_going);
+    cache_cap_free();
+  }
+
+  if (g_err_jmp != NULL)
+    longjmp(*g_err_jmp, 1);
+
+  if (g_jobs.count > 0 && !g_is_worker) {
+    // keep serial order: earlier functions come first,
+    // one of them may fail and exit here too
+    while (jobs_write_one(1))
+      ;
+    job_ctx_flush(g_ctx);
+  }
+  else if (g_jobs.count == 0 && g_jobs.fout != NULL)
+    ob_flush(&g_ctx->out, g_jobs.fout);
+
+  fcloseall();
+  exit(1);
+}
+
+// input files are mapped whole, lines are handed out
+// as (pointer, length) views into the mapping
+struct src_file {
+  const char *data;
+  size_t size;
+  size_t pos;
+};
+
+static void src_open(struct src_file *sf, const char *fn)
+{
+  struct stat st;
+  int fd;
+
+  memset(sf, 0, sizeof(*sf));
+
+  fd = open(fn, O_RDONLY);
+  if (fd == -1) {
+    perror(fn);
+    exit(1);
+  }
+  my_assert(fstat(fd, &st), 0);
+
+  sf->size = st.st_size;
+  if (sf->size > 0) {
+    sf->data = mmap(NULL, sf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    my_assert_not(sf->data, MAP_FAILED);
+    madvise((void *)sf->data, sf->size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+}
+
+static void src_close(struct src_file *sf)
+{
+  if (sf->size > 0)
+    munmap((void *)sf->data, sf->size);
+  memset(sf, 0, sizeof(*sf));
+}
+
+// returns NULL on EOF, *end is set to the '\n' (or end of data)
+static const char *src_getline(struct src_file *sf, const char **end)
+{
+  const char *s, *e;
+
+  if (sf->pos >= sf->size)
+    return NULL;
+
+  s = sf->data + sf->pos;
+  e = memchr(s, '\n', sf->size - sf->pos);
+  if (e == NULL)
+    e = sf->data + sf->size;
+  sf->pos = e - sf->data + 1;
+  *end = e;
+
+  return s;
+}
+
+static const char *sskip_v(const char *s, const char *end)
+{
+  while (s < end && my_isblank(*s))
+    s++;
+
+  return s;
+}
+
+// '=' needs special treatment..
+static const char *next_word_v(const char *s, const char *end, int *len)
+{
+  int i;
+
+  s = sskip_v(s, end);
+
+  for (i = 0; s + i < end; i++)
+    if (my_isblank(s[i]) || (s[i] == '=' && i > 0))
+      break;
+  *len = i;
+
+  return s;
+}
+
+// words get a NUL terminated copy here, word 0 is always empty
+static char *g_wordbuf;
+static size_t g_wordbuf_size;
+
+// split s..end to words, up to ';'
+static int split_words(char **words, int words_max,
+  const char *s, const char *end, const char **rest)
+{
+  size_t need = (end - s) + words_max + 2;
+  char *o;
+  int wordc = 0;
+  int len;
+  int i;
+
+  if (need > g_wordbuf_size) {
+    g_wordbuf_size = need * 2;
+    g_wordbuf = mem_realloc(MEM_MISC, g_wordbuf, g_wordbuf_size);
+    my_assert_not(g_wordbuf, NULL);
+  }
+  g_wordbuf[0] = 0;
+  o = g_wordbuf + 1;
+
+  while (wordc < words_max) {
+    s = next_word_v(s, end, &len);
+    memcpy(o, s, len);
+    o[len] = 0;
+    words[wordc++] = o;
+    o += len + 1;
+
+    s = sskip_v(s + len, end);
+    if (s == end || *s == ';')
+      break;
+  }
+  for (i = wordc; i < words_max; i++)
+    words[i] = g_wordbuf;
+
+  *rest = s;
+  return wordc;
+}
+
+// NUL terminated copy of a comment, with tabs replaced
+static char *g_linebuf;
+static size_t g_linebuf_size;
+
+static char *line_copy(const char *s, const char *end)
+{
+  size_t len = end - s;
+  size_t i;
+
+  if (len + 1 > g_linebuf_size) {
+    g_linebuf_size = len * 2 + 256;
+    g_linebuf = mem_realloc(MEM_MISC, g_linebuf, g_linebuf_size);
+    my_assert_not(g_linebuf, NULL);
+  }
+
+  // get rid of random tabs
+  for (i = 0; i < len; i++)
+    g_linebuf[i] = s[i] == '\t' ? ' ' : s[i];
+  g_linebuf[len] = 0;
+
+  return g_linebuf;
+}
+
+// terminated name at s, modifies s
+static char *cut_word(char *s)
+{
+  char *p;
+
+  s = sskip(s);
+  for (p = s; *p != 0 && !my_isblank(*p); p++)
+    ;
+  *p = 0;
+
+  return s;
+}
+
+static struct src_file g_asm;
+
+struct chunk_item {
+  char *name;
+  size_t offs;
+  int asmln;
+};
+
+static struct chunk_item *func_chunks;
+static int func_chunk_cnt;
+static int func_chunk_alloc;
+
+static void add_func_chunk(const char *name, int line)
+{
+  if (func_chunk_cnt >= func_chunk_alloc) {
+    func_chunk_alloc *= 2;
+    func_chunks = mem_realloc(MEM_CHUNKS, func_chunks,
+      func_chunk_alloc * sizeof(func_chunks[0]));
+    my_assert_not(func_chunks, NULL);
+  }
+  func_chunks[func_chunk_cnt].offs = g_asm.pos;
+  func_chunks[func_chunk_cnt].name = mem_strdup(MEM_CHUNKS, name);
+  func_chunks[func_chunk_cnt].asmln = line;
+  func_chunk_cnt++;
+}
+
+static int cmp_chunk_names(const void *p1, const void *p2)
+{
+  const struct chunk_item *c1 = p1, *c2 = p2;
+  return strcmp(c1->name, c2->name);
+}
+
+static int cmp_chunks(const void *p1, const void *p2)
+{
+  const struct chunk_item *c1 = p1, *c2 = p2;
+  int ret = strcmp(c1->name, c2->name);
+  if (ret != 0)
+    return ret;
+  return c1->offs < c2->offs ? -1 : c1->offs > c2->offs;
+}
+
+static int cmpstringp(const void *p1, const void *p2)
+{
+  return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+// functions not to translate, from an rlist file, which is
+// loaded once however many .asm files use it
+struct rlist {
+  char *path;
+  char **names;     // sorted
+  int cnt;
+};
 
-    p = sskip(line);
+static struct rlist **g_rlists;
+static int g_rlist_cnt;
+
+// needs special handling..
+static char *g_rlist_builtin_names[] = { "__alloca_probe" };
+static struct rlist g_rlist_builtin = {
+  "", g_rlist_builtin_names, ARRAY_SIZE(g_rlist_builtin_names)
+};
+
+static struct rlist *rlist_load(const char *path)
+{
+  struct src_file frlist;
+  const char *line, *line_end;
+  struct rlist *rl;
+  int skip_func = 0;
+  int alloc = 0;
+  char *p;
+  int i;
+
+  for (i = 0; i < g_rlist_cnt; i++)
+    if (IS(g_rlists[i]->path, path))
+      return g_rlists[i];
+
+  rl = mem_calloc(MEM_SYMS, 1, sizeof(*rl));
+  my_assert_not(rl, NULL);
+  rl->path = mem_strdup(MEM_SYMS, path);
+  my_assert_not(rl->path, NULL);
+
+  src_open(&frlist, path);
+
+  while ((line = src_getline(&frlist, &line_end))) {
+    p = line_copy(line, line_end);
+    p = sskip(p);
+    if (*p == 0 || *p == ';')
+      continue;
+    if (*p == '#') {
+      if (IS_START(p, "#if 0")
+       || (g_allow_regfunc && IS_START(p, "#if NO_REGFUNC")))
+      {
+        skip_func = 1;
+      }
+      else if (IS_START(p, "#endif"))
+        skip_func = 0;
+      continue;
+    }
+    if (skip_func)
+      continue;
+
+    p = cut_word(p);
     if (*p == 0)
       continue;
 
-    // get rid of random tabs
-    for (i = 0; line[i] != 0; i++)
-      if (line[i] == '\t')
-        line[i] = ' ';
+    if (rl->cnt >= alloc) {
+      alloc = alloc * 2 + 64;
+      rl->names = mem_realloc(MEM_SYMS, rl->names,
+        alloc * sizeof(rl->names[0]));
+      my_assert_not(rl->names, NULL);
+    }
+    rl->names[rl->cnt++] = mem_strdup(MEM_SYMS, p);
+  }
+
+  src_close(&frlist);
+
+  if (rl->cnt > 0)
+    qsort(rl->names, rl->cnt, sizeof(rl->names[0]), cmpstringp);
+
+  g_rlists = mem_realloc(MEM_SYMS, g_rlists,
+    (g_rlist_cnt + 1) * sizeof(g_rlists[0]));
+  my_assert_not(g_rlists, NULL);
+  g_rlists[g_rlist_cnt++] = rl;
+
+  return rl;
+}
+
+static int rlist_has(struct rlist **rlists, int rlist_cnt,
+  const char *name)
+{
+  int i;
+
+  for (i = 0; i < rlist_cnt; i++) {
+    if (bsearch(&name, rlists[i]->names, rlists[i]->cnt,
+          sizeof(rlists[i]->names[0]), cmpstringp))
+      return 1;
+  }
+
+  return 0;
+}
+
+// find all function chunks before translating, so that the main loop
+// can jump to any of them when their function ends
+static void index_func_chunks(int multi_seg)
+{
+  const char *line, *end;
+  const char *w = NULL;
+  int wordc;
+  int len = 0;
+  char *p;
+
+  asmln = 0;
+  while ((line = src_getline(&g_asm, &end)))
+  {
+    asmln++;
+
+    line = sskip_v(line, end);
+    if (line == end)
+      continue;
+
+    if (*line == ';')
+    {
+      if (line + 2 >= end || (line[2] != 'S' && line[2] != 's'))
+        continue;
+
+      p = line_copy(line, end);
+
+      if (p[2] == 'S' && IS_START(p, "; START OF FUNCTION CHUNK FOR "))
+      {
+        p = cut_word(p + 30);
+        if (*p == 0)
+          aerr("missing name for func chunk?\n");
+
+        add_func_chunk(p, asmln);
+      }
+      else if (IS_START(p, "; sctend"))
+        break;
+
+      continue;
+    } // *line == ';'
+
+    if (multi_seg)
+      continue;
+
+    // only need to know if the 2nd word is "ends"
+    for (wordc = 0; wordc < 2; wordc++) {
+      w = next_word_v(line, end, &len);
+      line = sskip_v(w + len, end);
+      if (line == end || *line == ';') {
+        wordc++;
+        break;
+      }
+    }
+
+    if (wordc == 2 && len == 4 && !memcmp(w, "ends", 4))
+      break;
+  }
+
+  // file order within a function
+  qsort(func_chunks, func_chunk_cnt, sizeof(func_chunks[0]), cmp_chunks);
+
+  g_asm.pos = 0;
+  asmln = 0;
+}
+
+// translate one .asm to fout, headers and rlists are already loaded
+static void translate_asm(FILE *fout, struct rlist **rlists,
+  int rlist_cnt, int multi_seg, int verbose)
+{
+  int func_chunks_used = 0;
+  int func_chunk_i = -1;
+  size_t func_chunk_ret = 0;
+  int func_chunk_ret_ln = 0;
+  struct parsed_data *pd = NULL;
+  const char *line, *line_end;
+  char *words[20];
+  enum opr_lenmod lmod;
+  char *sctproto = NULL;
+  int in_func = 0;
+  int pending_endp = 0;
+  int skip_func = 0;
+  int skip_warned = 0;
+  jmp_buf parse_jmp;
+  int end = 0;
+  int pi = 0;
+  int i;
+  int len;
+  char *p;
+  int wordc;
+
+  split_words(words, ARRAY_SIZE(words), "", "", &line);
+  tm_start();
+  index_func_chunks(multi_seg);
+  if (g_timing)
+    g_tm.chunk_ns += tm_now() - g_tm_last;
+
+  while ((line = src_getline(&g_asm, &line_end)))
+  {
+    wordc = 0;
+    asmln++;
+
+    if (g_cache_dir != NULL) {
+      g_ctx->asm_hash = hash64(g_ctx->asm_hash, line, line_end - line);
+      g_ctx->asm_hash = hash64(g_ctx->asm_hash, "\n", 1);
+    }
+
+    line = sskip_v(line, line_end);
+    if (line == line_end)
+      continue;
 
-    if (*p == ';')
+    if (*line == ';')
     {
+      p = line_copy(line, line_end);
+
       if (p[2] == '=' && IS_START(p, "; =============== S U B"))
         goto do_pending_endp; // eww..
 
@@ -5231,13 +7063,13 @@ int main(int argc, char *argv[])
         };
 
         // parse IDA's attribute-list comment
-        g_ida_func_attr = 0;
+        g_ctx->ida_func_attr = 0;
         p = sskip(p + 13);
 
         for (; *p != 0; p = sskip(p)) {
           for (i = 0; i < ARRAY_SIZE(attrs); i++) {
             if (!strncmp(p, attrs[i], strlen(attrs[i]))) {
-              g_ida_func_attr |= 1 << i;
+              g_ctx->ida_func_attr |= 1 << i;
               p += strlen(attrs[i]);
               break;
             }
@@ -5247,88 +7079,56 @@ int main(int argc, char *argv[])
             break;
           }
           if (IS(attrs[i], "fpd=")) {
-            p = next_word(words[0], sizeof(words[0]), p);
+            while (*p != 0 && !my_isblank(*p))
+              p++;
             // ignore for now..
           }
         }
       }
-      else if (p[2] == 'S' && IS_START(p, "; START OF FUNCTION CHUNK FOR "))
-      {
-        p += 30;
-        next_word(words[0], sizeof(words[0]), p);
-        if (words[0][0] == 0)
-          aerr("missing name for func chunk?\n");
-
-        if (!scanned_ahead) {
-          add_func_chunk(fasm, words[0], asmln);
-          func_chunks_sorted = 0;
-        }
-      }
       else if (p[2] == 'E' && IS_START(p, "; END OF FUNCTION CHUNK"))
       {
         if (func_chunk_i >= 0) {
           if (func_chunk_i < func_chunk_cnt
-            && IS(func_chunks[func_chunk_i].name, g_func))
+            && IS(func_chunks[func_chunk_i].name, g_ctx->func))
           {
             // move on to next chunk
-            ret = fseek(fasm, func_chunks[func_chunk_i].fptr, SEEK_SET);
-            if (ret)
-              aerr("seek failed for '%s' chunk #%d\n",
-                g_func, func_chunk_i);
+            g_asm.pos = func_chunks[func_chunk_i].offs;
             asmln = func_chunks[func_chunk_i].asmln;
             func_chunk_i++;
           }
           else {
             if (func_chunk_ret == 0)
               aerr("no return from chunk?\n");
-            fseek(fasm, func_chunk_ret, SEEK_SET);
+            g_asm.pos = func_chunk_ret;
             asmln = func_chunk_ret_ln;
             func_chunk_ret = 0;
             pending_endp = 1;
           }
         }
       }
-      else if (p[2] == 'F' && IS_START(p, "; FUNCTION CHUNK AT ")) {
+      else if (p[2] == 'F' && IS_START(p, "; FUNCTION CHUNK AT "))
         func_chunks_used = 1;
-        p += 20;
-        if (IS_START(g_func, "sub_")) {
-          unsigned long addr = strtoul(p, NULL, 16);
-          unsigned long f_addr = strtoul(g_func + 4, NULL, 16);
-          if (addr > f_addr && !scanned_ahead) {
-            anote("scan_ahead caused by '%s', addr %lx\n",
-              g_func, addr);
-            scan_ahead(fasm);
-            scanned_ahead = 1;
-            func_chunks_sorted = 0;
-          }
-        }
-      }
       continue;
-    } // *p == ';'
+    } // *line == ';'
 
 parse_words:
-    for (i = wordc; i < ARRAY_SIZE(words); i++)
-      words[i][0] = 0;
-    for (wordc = 0; wordc < ARRAY_SIZE(words); wordc++) {
-      p = sskip(next_word_s(words[wordc], sizeof(words[0]), p));
-      if (*p == 0 || *p == ';') {
-        wordc++;
-        break;
-      }
-    }
-    if (*p != 0 && *p != ';')
+    wordc = split_words(words, ARRAY_SIZE(words), line, line_end, &line);
+    if (line != line_end && *line != ';')
       aerr("too many words\n");
 
     // alow asm patches in comments
-    if (*p == ';') {
+    if (line != line_end) {
+      p = line_copy(line, line_end);
       if (IS_START(p, "; sctpatch:")) {
         p = sskip(p + 11);
         if (*p == 0 || *p == ';')
           continue;
+        line = p;
+        line_end = p + strlen(p);
         goto parse_words; // lame
       }
       if (IS_START(p, "; sctproto:")) {
-        sctproto = strdup(p + 11);
+        sctproto = mem_strdup(MEM_PROTO, p + 11);
       }
       else if (IS_START(p, "; sctend")) {
         end = 1;
@@ -5362,15 +7162,17 @@ do_pending_endp:
         i = 1;
         if (words[1][0] == 'd' && words[1][2] == 0) {
           // label
-          if (g_func_pd_cnt >= pd_alloc) {
-            pd_alloc = pd_alloc * 2 + 16;
-            g_func_pd = realloc(g_func_pd,
-              sizeof(g_func_pd[0]) * pd_alloc);
-            my_assert_not(g_func_pd, NULL);
+          if (g_ctx->func_pd_cnt >= g_ctx->func_pd_alloc) {
+            g_ctx->func_pd_alloc = g_ctx->func_pd_alloc * 2 + 16;
+            g_ctx->func_pd = mem_realloc(MEM_IR, g_ctx->func_pd,
+              sizeof(g_ctx->func_pd[0]) * g_ctx->func_pd_alloc);
+            my_assert_not(g_ctx->func_pd, NULL);
           }
-          pd = &g_func_pd[g_func_pd_cnt];
-          g_func_pd_cnt++;
+          pd = &g_ctx->func_pd[g_ctx->func_pd_cnt];
+          g_ctx->func_pd_cnt++;
           memset(pd, 0, sizeof(*pd));
+          if (strlen(words[0]) >= sizeof(pd->label))
+            aerr("data label too long: '%s'\n", words[0]);
           strcpy(pd->label, words[0]);
           pd->type = OPT_CONST;
           pd->lmod = lmod_from_directive(words[1]);
@@ -5389,7 +7191,8 @@ do_pending_endp:
 
         if (pd->count_alloc < pd->count + wordc) {
           pd->count_alloc = pd->count_alloc * 2 + 14 + wordc;
-          pd->d = realloc(pd->d, sizeof(pd->d[0]) * pd->count_alloc);
+          pd->d = mem_realloc(MEM_IR, pd->d,
+            sizeof(pd->d[0]) * pd->count_alloc);
           my_assert_not(pd->d, NULL);
         }
         for (; i < wordc; i++) {
@@ -5401,7 +7204,7 @@ do_pending_endp:
           if (p != NULL)
             *p = 0;
           if (pd->type == OPT_OFFSET)
-            pd->d[pd->count].u.label = strdup(words[i]);
+            pd->d[pd->count].u.label = fstrdup(words[i]);
           else
             pd->d[pd->count].u.val = parse_number(words[i]);
           pd->d[pd->count].bt_i = -1;
@@ -5410,33 +7213,26 @@ do_pending_endp:
         continue;
       }
 
-      if (in_func && !skip_func)
-        gen_func(fout, g_fhdr, g_func, pi);
+      g_ctx->opcnt = pi;
+      tm_mark(TM_PARSE);
+      if (g_jobs.count > 0)
+        jobs_submit(in_func && !skip_func);
+      else {
+        if (in_func && !skip_func)
+          gen_func_unit();
+        ob_flush(&g_ctx->out, fout);
+        func_ctx_reset();
+        if (g_ctx->failed)
+          func_failed(g_ctx);
+      }
 
       pending_endp = 0;
       in_func = 0;
-      g_ida_func_attr = 0;
       skip_warned = 0;
       skip_func = 0;
-      g_func[0] = 0;
       func_chunks_used = 0;
       func_chunk_i = -1;
-      if (pi != 0) {
-        memset(&ops, 0, pi * sizeof(ops[0]));
-        memset(g_labels, 0, pi * sizeof(g_labels[0]));
-        pi = 0;
-      }
-      g_eqcnt = 0;
-      for (i = 0; i < g_func_pd_cnt; i++) {
-        pd = &g_func_pd[i];
-        if (pd->type == OPT_OFFSET) {
-          for (j = 0; j < pd->count; j++)
-            free(pd->d[j].u.label);
-        }
-        free(pd->d);
-        pd->d = NULL;
-      }
-      g_func_pd_cnt = 0;
+      pi = 0;
       pd = NULL;
 
       if (end)
@@ -5448,13 +7244,15 @@ do_pending_endp:
     if (IS(words[1], "proc")) {
       if (in_func)
         aerr("proc '%s' while in_func '%s'?\n",
-          words[0], g_func);
-      p = words[0];
-      if (bsearch(&p, rlist, rlist_len, sizeof(rlist[0]), cmpstringp))
+          words[0], g_ctx->func);
+      if (rlist_has(rlists, rlist_cnt, words[0]))
         skip_func = 1;
-      strcpy(g_func, words[0]);
+      if (strlen(words[0]) >= sizeof(g_ctx->func))
+        aerr("func name too long: '%s'\n", words[0]);
+      strcpy(g_ctx->func, words[0]);
       set_label(0, words[0]);
       in_func = 1;
+      tm_start();
       continue;
     }
 
@@ -5462,11 +7260,11 @@ do_pending_endp:
     {
       if (!in_func)
         aerr("endp '%s' while not in_func?\n", words[0]);
-      if (!IS(g_func, words[0]))
+      if (!IS(g_ctx->func, words[0]))
         aerr("endp '%s' while in_func '%s'?\n",
-          words[0], g_func);
+          words[0], g_ctx->func);
 
-      if ((g_ida_func_attr & IDAFA_THUNK) && pi == 1
+      if ((g_ctx->ida_func_attr & IDAFA_THUNK) && pi == 1
         && ops[0].op == OP_JMP && ops[0].operand[0].had_ds)
       {
         // import jump
@@ -5475,27 +7273,20 @@ do_pending_endp:
 
       if (!skip_func && func_chunks_used) {
         // start processing chunks
-        struct chunk_item *ci, key = { g_func, 0 };
+        struct chunk_item *ci, key = { g_ctx->func, 0 };
 
-        func_chunk_ret = ftell(fasm);
+        func_chunk_ret = g_asm.pos;
         func_chunk_ret_ln = asmln;
-        if (!func_chunks_sorted) {
-          qsort(func_chunks, func_chunk_cnt,
-            sizeof(func_chunks[0]), cmp_chunks);
-          func_chunks_sorted = 1;
-        }
         ci = bsearch(&key, func_chunks, func_chunk_cnt,
-               sizeof(func_chunks[0]), cmp_chunks);
+               sizeof(func_chunks[0]), cmp_chunk_names);
         if (ci == NULL)
-          aerr("'%s' needs chunks, but none found\n", g_func);
+          aerr("'%s' needs chunks, but none found\n", g_ctx->func);
         func_chunk_i = ci - func_chunks;
         for (; func_chunk_i > 0; func_chunk_i--)
-          if (!IS(func_chunks[func_chunk_i - 1].name, g_func))
+          if (!IS(func_chunks[func_chunk_i - 1].name, g_ctx->func))
             break;
 
-        ret = fseek(fasm, func_chunks[func_chunk_i].fptr, SEEK_SET);
-        if (ret)
-          aerr("seek failed for '%s' chunk #%d\n", g_func, func_chunk_i);
+        g_asm.pos = func_chunks[func_chunk_i].offs;
         asmln = func_chunks[func_chunk_i].asmln;
         func_chunk_i++;
         continue;
@@ -5513,13 +7304,15 @@ do_pending_endp:
       }
 
       // scan for next text segment
-      while (fgets(line, sizeof(line), fasm)) {
+      while ((line = src_getline(&g_asm, &line_end))) {
+        static const char seg_str[] = "segment para public 'CODE' use32";
+
         asmln++;
-        p = sskip(line);
-        if (*p == 0 || *p == ';')
+        line = sskip_v(line, line_end);
+        if (line == line_end || *line == ';')
           continue;
 
-        if (strstr(p, "segment para public 'CODE' use32"))
+        if (memmem(line, line_end - line, seg_str, sizeof(seg_str) - 1))
           break;
       }
 
@@ -5539,6 +7332,7 @@ do_pending_endp:
         skip_warned = 1;
       }
       g_labels[pi][0] = 0;
+      label_idx_reset();
       continue;
     }
 
@@ -5546,37 +7340,53 @@ do_pending_endp:
     {
       if (wordc != 5)
         aerr("unhandled equ, wc=%d\n", wordc);
-      if (g_eqcnt >= eq_alloc) {
-        eq_alloc *= 2;
-        g_eqs = realloc(g_eqs, eq_alloc * sizeof(g_eqs[0]));
-        my_assert_not(g_eqs, NULL);
+      if (g_ctx->eqcnt >= g_ctx->eq_alloc) {
+        g_ctx->eq_alloc *= 2;
+        g_ctx->eqs = mem_realloc(MEM_IR, g_ctx->eqs,
+          g_ctx->eq_alloc * sizeof(g_ctx->eqs[0]));
+        my_assert_not(g_ctx->eqs, NULL);
       }
 
       len = strlen(words[0]);
-      if (len > sizeof(g_eqs[0].name) - 1)
+      if (len > sizeof(g_ctx->eqs[0].name) - 1)
         aerr("equ name too long: %d\n", len);
-      strcpy(g_eqs[g_eqcnt].name, words[0]);
+      strcpy(g_ctx->eqs[g_ctx->eqcnt].name, words[0]);
 
       if (!IS(words[3], "ptr"))
         aerr("unhandled equ\n");
       if (IS(words[2], "dword"))
-        g_eqs[g_eqcnt].lmod = OPLM_DWORD;
+        g_ctx->eqs[g_ctx->eqcnt].lmod = OPLM_DWORD;
       else if (IS(words[2], "word"))
-        g_eqs[g_eqcnt].lmod = OPLM_WORD;
+        g_ctx->eqs[g_ctx->eqcnt].lmod = OPLM_WORD;
       else if (IS(words[2], "byte"))
-        g_eqs[g_eqcnt].lmod = OPLM_BYTE;
+        g_ctx->eqs[g_ctx->eqcnt].lmod = OPLM_BYTE;
       else
         aerr("bad lmod: '%s'\n", words[2]);
 
-      g_eqs[g_eqcnt].offset = parse_number(words[4]);
-      g_eqcnt++;
+      g_ctx->eqs[g_ctx->eqcnt].offset = parse_number(words[4]);
+      g_ctx->eqcnt++;
       continue;
     }
 
-    if (pi >= ARRAY_SIZE(ops))
-      aerr("too many ops\n");
+    if (g_keep_going) {
+      // bad op only fails this function
+      if (setjmp(parse_jmp) != 0) {
+        g_err_jmp = NULL;
+        g_ctx->failed = 1;
+        g_ctx->err_msg = mem_strdup(MEM_MISC, g_err_msg);
+        my_assert_not(g_ctx->err_msg, NULL);
+        ob_printf(&g_ctx->out, "// %s: translation failed\n\n",
+          g_ctx->func);
+        memset(&ops[pi], 0, sizeof(ops[0]));
+        sctproto = NULL;
+        skip_func = 1;
+        continue;
+      }
+      g_err_jmp = &parse_jmp;
+    }
 
     parse_op(&ops[pi], words, wordc);
+    g_err_jmp = NULL;
 
     if (sctproto != NULL) {
       if (ops[pi].op == OP_CALL || ops[pi].op == OP_JMP)
@@ -5584,12 +7394,204 @@ do_pending_endp:
       sctproto = NULL;
     }
     pi++;
+    op_slot_init(pi);
   }
 
+
+  if (g_jobs.count > 0)
+    jobs_sync();
+
+  for (i = 0; i < func_chunk_cnt; i++)
+    mem_free(func_chunks[i].name);
+  func_chunk_cnt = 0;
+}
+
+static void translate_file(const char *out_fn, const char *asm_fn,
+  struct rlist **rlists, int rlist_cnt, int multi_seg, int verbose)
+{
+  FILE *fout;
+
+  asmfn = asm_fn;
+  src_open(&g_asm, asmfn);
+
+  fout = fopen(out_fn, "w");
+  my_assert_not(fout, NULL);
+  g_jobs.fout = fout;
+
+  translate_asm(fout, rlists, rlist_cnt, multi_seg, verbose);
+
+  g_jobs.fout = NULL;
   fclose(fout);
-  fclose(fasm);
+  src_close(&g_asm);
+}
+
+// -b: a "<.c> <.asm> [rlist]*" line per .asm, translated one after
+// another, with the header and rlists loaded only once
+static void translate_batch(const char *batch_fn, struct rlist **rlists,
+  int rlist_cnt, int multi_seg, int verbose)
+{
+  struct src_file fbatch;
+  const char *line, *line_end;
+  struct rlist **rl;
+  char *words[16];
+  char *out_fn, *asm_fn;
+  int batch_ln = 0;
+  int wordc;
+  int i;
+
+  rl = mem_malloc(MEM_SYMS, (rlist_cnt + ARRAY_SIZE(words)) * sizeof(rl[0]));
+  my_assert_not(rl, NULL);
+  memcpy(rl, rlists, rlist_cnt * sizeof(rl[0]));
+
+  src_open(&fbatch, batch_fn);
+
+  while ((line = src_getline(&fbatch, &line_end))) {
+    batch_ln++;
+    line = sskip_v(line, line_end);
+    if (line == line_end || *line == ';' || *line == '#')
+      continue;
+
+    wordc = split_words(words, ARRAY_SIZE(words), line, line_end, &line);
+    if (wordc < 2 || (line != line_end && *line != ';')) {
+      printf("%s:%d: expected <.c> <.asm> [rlist]*\n",
+        batch_fn, batch_ln);
+      exit(1);
+    }
+
+    // words get reused by translate_asm()
+    out_fn = mem_strdup(MEM_MISC, words[0]);
+    asm_fn = mem_strdup(MEM_MISC, words[1]);
+    my_assert_not(out_fn, NULL);
+    my_assert_not(asm_fn, NULL);
+    for (i = 2; i < wordc; i++)
+      rl[rlist_cnt + i - 2] = rlist_load(words[i]);
+
+    translate_file(out_fn, asm_fn, rl, rlist_cnt + wordc - 2,
+      multi_seg, verbose);
+
+    mem_free(out_fn);
+    mem_free(asm_fn);
+  }
+
+  src_close(&fbatch);
+  mem_free(rl);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *batch_fn = NULL;
+  const char *out_fn = NULL;
+  const char *asm_fn = NULL;
+  struct rlist **rlists;
+  int rlist_cnt = 0;
+  int verbose = 0;
+  int jobs = 0;
+  int multi_seg = 0;
+  int mem_rep = 0;
+  int arg;
+  int i;
+
+  for (arg = 1; arg < argc; arg++) {
+    if (IS(argv[arg], "-v"))
+      verbose = 1;
+    else if (IS(argv[arg], "-rf"))
+      g_allow_regfunc = 1;
+    else if (IS(argv[arg], "-m"))
+      multi_seg = 1;
+    else if (IS(argv[arg], "-j") && arg + 1 < argc)
+      jobs = atoi(argv[++arg]);
+    else if (IS(argv[arg], "-c") && arg + 1 < argc)
+      g_cache_dir = argv[++arg];
+    else if (IS(argv[arg], "-k"))
+      g_keep_going = 1;
+    else if (IS(argv[arg], "-b") && arg + 1 < argc)
+      batch_fn = argv[++arg];
+    else if (IS(argv[arg], "-T"))
+      g_timing = 1;
+    else if (IS(argv[arg], "-M"))
+      mem_rep = 1;
+    else
+      break;
+  }
+
+  if (argc < arg + (batch_fn != NULL ? 1 : 3)) {
+    printf("usage:\n%s [-v] [-rf] [-m] [-k] [-T] [-M] [-j N] [-c cachedir] "
+      "<.c> <.asm> <hdrf> [rlist]*\n"
+      "%s [-v] [-rf] [-m] [-k] [-T] [-M] [-j N] [-c cachedir] "
+      "-b <batch> <hdrf> [rlist]*\n"
+      "  batch: \"<.c> <.asm> [rlist]*\" lines, "
+      "command line rlists apply to all\n",
+      argv[0], argv[0]);
+    return 1;
+  }
+
+  g_msgf = stdout;
+  if (g_timing)
+    g_tm.start = tm_now();
+
+  if (batch_fn == NULL) {
+    out_fn = argv[arg++];
+    asm_fn = argv[arg++];
+  }
+
+  hdrfn = argv[arg++];
+  g_fhdr = fopen(hdrfn, "r");
+  my_assert_not(g_fhdr, NULL);
+
+  rlists = mem_malloc(MEM_SYMS, (argc - arg + 1) * sizeof(rlists[0]));
+  my_assert_not(rlists, NULL);
+  rlists[rlist_cnt++] = &g_rlist_builtin;
+  for (; arg < argc; arg++)
+    rlists[rlist_cnt++] = rlist_load(argv[arg]);
+
+  func_chunk_alloc = 32;
+  func_chunks = mem_malloc(MEM_CHUNKS,
+    func_chunk_alloc * sizeof(func_chunks[0]));
+  my_assert_not(func_chunks, NULL);
+
+  if (g_cache_dir != NULL)
+    mkdir(g_cache_dir, 0777);
+
+  func_ctx_bind(func_ctx_new());
+
+  // before sym_intern(), which looks protos up;
+  // -j workers then only read the cache
+  if (jobs > 1)
+    pp_jobs = jobs;
+  tm_start();
+  build_pp_cache(g_fhdr);
+  if (g_timing)
+    g_tm.hdr_ns = tm_now() - g_tm_last;
+  g_sym_empty = sym_intern("");
+
+  if (jobs > 1)
+    jobs_start(jobs);
+
+  if (batch_fn != NULL)
+    translate_batch(batch_fn, rlists, rlist_cnt, multi_seg, verbose);
+  else
+    translate_file(out_fn, asm_fn, rlists, rlist_cnt, multi_seg, verbose);
+
+  if (jobs > 1)
+    jobs_finish();
+
   fclose(g_fhdr);
 
+  if (g_timing)
+    tm_print();
+
+  mem_free(rlists);
+  mem_free(func_chunks);
+  if (mem_rep)
+    mem_report(stdout);
+
+  if (g_failure_cnt > 0) {
+    printf("%d function(s) failed:\n", g_failure_cnt);
+    for (i = 0; i < g_failure_cnt; i++)
+      printf("  %s", g_failures[i]);
+    return 1;
+  }
+
   return 0;
 }
 
@@ -0,0 +1,174 @@
+/*
+ * ia32rtools
+ * (C) notaz, 2013,2014
+ *
+ * This work is licensed under the terms of 3-clause BSD license.
+ * See COPYING file in the top-level directory.
+ */
+
+// prefix, opcode and register descriptors.
+// include with the needed PREFIX/OP/REG macros defined,
+// mkopdec generates the name lookup (opdec.h) from this.
+
+#ifndef PREFIX
+#define PREFIX(name, flags)
+#endif
+#ifndef OP
+#define OP(name, op, minopr, maxopr, flags, pfo, pfo_inv)
+#endif
+#ifndef REG
+#define REG(name, reg, lmod)
+#endif
+
+PREFIX("rep",   OPF_REP)
+PREFIX("repe",  OPF_REP|OPF_REPZ)
+PREFIX("repz",  OPF_REP|OPF_REPZ)
+PREFIX("repne", OPF_REP|OPF_REPNZ)
+PREFIX("repnz", OPF_REP|OPF_REPNZ)
+PREFIX("lock",  OPF_LOCK) // ignored for now..
+
+OP("nop",   OP_NOP,   0, 0, 0, 0, 0)
+OP("push",  OP_PUSH,  1, 1, 0, 0, 0)
+OP("pop",   OP_POP,   1, 1, OPF_DATA, 0, 0)
+OP("leave", OP_LEAVE, 0, 0, OPF_DATA, 0, 0)
+OP("mov",   OP_MOV,   2, 2, OPF_DATA, 0, 0)
+OP("lea",   OP_LEA,   2, 2, OPF_DATA, 0, 0)
+OP("movzx", OP_MOVZX, 2, 2, OPF_DATA, 0, 0)
+OP("movsx", OP_MOVSX, 2, 2, OPF_DATA, 0, 0)
+OP("xchg",  OP_XCHG,  2, 2, OPF_DATA, 0, 0)
+OP("not",   OP_NOT,   1, 1, OPF_DATA, 0, 0)
+OP("cdq",   OP_CDQ,   0, 0, OPF_DATA, 0, 0)
+OP("lodsb", OP_LODS,  0, 0, OPF_DATA, 0, 0)
+OP("lodsw", OP_LODS,  0, 0, OPF_DATA, 0, 0)
+OP("lodsd", OP_LODS,  0, 0, OPF_DATA, 0, 0)
+OP("stosb", OP_STOS,  0, 0, OPF_DATA, 0, 0)
+OP("stosw", OP_STOS,  0, 0, OPF_DATA, 0, 0)
+OP("stosd", OP_STOS,  0, 0, OPF_DATA, 0, 0)
+OP("movsb", OP_MOVS,  0, 0, OPF_DATA, 0, 0)
+OP("movsw", OP_MOVS,  0, 0, OPF_DATA, 0, 0)
+OP("movsd", OP_MOVS,  0, 0, OPF_DATA, 0, 0)
+OP("cmpsb", OP_CMPS,  0, 0, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("cmpsw", OP_CMPS,  0, 0, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("cmpsd", OP_CMPS,  0, 0, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("scasb", OP_SCAS,  0, 0, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("scasw", OP_SCAS,  0, 0, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("scasd", OP_SCAS,  0, 0, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("std",   OP_STD,   0, 0, OPF_DATA, 0, 0) // special flag
+OP("cld",   OP_CLD,   0, 0, OPF_DATA, 0, 0)
+OP("add",   OP_ADD,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("sub",   OP_SUB,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("and",   OP_AND,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("or",    OP_OR,    2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("xor",   OP_XOR,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("shl",   OP_SHL,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("shr",   OP_SHR,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("sal",   OP_SHL,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("sar",   OP_SAR,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("shrd",  OP_SHRD,  3, 3, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("rol",   OP_ROL,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("ror",   OP_ROR,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("rcl",   OP_RCL,   2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C, 0)
+OP("rcr",   OP_RCR,   2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C, 0)
+OP("adc",   OP_ADC,   2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C, 0)
+OP("sbb",   OP_SBB,   2, 2, OPF_DATA|OPF_FLAGS|OPF_CC, PFO_C, 0)
+OP("bsf",   OP_BSF,   2, 2, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("inc",   OP_INC,   1, 1, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("dec",   OP_DEC,   1, 1, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("neg",   OP_NEG,   1, 1, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("mul",   OP_MUL,   1, 1, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("imul",  OP_IMUL,  1, 3, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("div",   OP_DIV,   1, 1, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("idiv",  OP_IDIV,  1, 1, OPF_DATA|OPF_FLAGS, 0, 0)
+OP("test",  OP_TEST,  2, 2, OPF_FLAGS, 0, 0)
+OP("cmp",   OP_CMP,   2, 2, OPF_FLAGS, 0, 0)
+OP("retn",  OP_RET,   0, 1, OPF_TAIL, 0, 0)
+OP("call",  OP_CALL,  1, 1, OPF_JMP|OPF_DATA|OPF_FLAGS, 0, 0)
+OP("jmp",   OP_JMP,   1, 1, OPF_JMP, 0, 0)
+OP("jecxz", OP_JECXZ, 1, 1, OPF_JMP|OPF_CJMP, 0, 0)
+OP("jo",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_O, 0) // 70 OF=1
+OP("jno",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_O, 1) // 71 OF=0
+OP("jc",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_C, 0) // 72 CF=1
+OP("jb",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_C, 0) // 72
+OP("jnc",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_C, 1) // 73 CF=0
+OP("jnb",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_C, 1) // 73
+OP("jae",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_C, 1) // 73
+OP("jz",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_Z, 0) // 74 ZF=1
+OP("je",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_Z, 0) // 74
+OP("jnz",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_Z, 1) // 75 ZF=0
+OP("jne",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_Z, 1) // 75
+OP("jbe",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_BE, 0) // 76 CF=1||ZF=1
+OP("jna",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_BE, 0) // 76
+OP("ja",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_BE, 1) // 77 CF=0&&ZF=0
+OP("jnbe",  OP_JCC,   1, 1, OPF_CJMP_CC, PFO_BE, 1) // 77
+OP("js",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_S, 0) // 78 SF=1
+OP("jns",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_S, 1) // 79 SF=0
+OP("jp",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_P, 0) // 7a PF=1
+OP("jpe",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_P, 0) // 7a
+OP("jnp",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_P, 1) // 7b PF=0
+OP("jpo",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_P, 1) // 7b
+OP("jl",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_L, 0) // 7c SF!=OF
+OP("jnge",  OP_JCC,   1, 1, OPF_CJMP_CC, PFO_L, 0) // 7c
+OP("jge",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_L, 1) // 7d SF=OF
+OP("jnl",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_L, 1) // 7d
+OP("jle",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_LE, 0) // 7e ZF=1||SF!=OF
+OP("jng",   OP_JCC,   1, 1, OPF_CJMP_CC, PFO_LE, 0) // 7e
+OP("jg",    OP_JCC,   1, 1, OPF_CJMP_CC, PFO_LE, 1) // 7f ZF=0&&SF=OF
+OP("jnle",  OP_JCC,   1, 1, OPF_CJMP_CC, PFO_LE, 1) // 7f
+OP("seto",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_O, 0)
+OP("setno", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_O, 1)
+OP("setc",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_C, 0)
+OP("setb",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_C, 0)
+OP("setnc", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_C, 1)
+OP("setae", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_C, 1)
+OP("setnb", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_C, 1)
+OP("setz",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_Z, 0)
+OP("sete",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_Z, 0)
+OP("setnz", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_Z, 1)
+OP("setne", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_Z, 1)
+OP("setbe", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_BE, 0)
+OP("setna", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_BE, 0)
+OP("seta",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_BE, 1)
+OP("setnbe",OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_BE, 1)
+OP("sets",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_S, 0)
+OP("setns", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_S, 1)
+OP("setp",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_P, 0)
+OP("setpe", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_P, 0)
+OP("setnp", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_P, 1)
+OP("setpo", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_P, 1)
+OP("setl",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_L, 0)
+OP("setnge",OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_L, 0)
+OP("setge", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_L, 1)
+OP("setnl", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_L, 1)
+OP("setle", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_LE, 0)
+OP("setng", OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_LE, 0)
+OP("setg",  OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_LE, 1)
+OP("setnle",OP_SCC,   1, 1, OPF_DATA|OPF_CC, PFO_LE, 1)
+
+REG("eax",  xAX, OPLM_DWORD)
+REG("ebx",  xBX, OPLM_DWORD)
+REG("ecx",  xCX, OPLM_DWORD)
+REG("edx",  xDX, OPLM_DWORD)
+REG("esi",  xSI, OPLM_DWORD)
+REG("edi",  xDI, OPLM_DWORD)
+REG("ebp",  xBP, OPLM_DWORD)
+REG("esp",  xSP, OPLM_DWORD)
+REG("ax",   xAX, OPLM_WORD)
+REG("bx",   xBX, OPLM_WORD)
+REG("cx",   xCX, OPLM_WORD)
+REG("dx",   xDX, OPLM_WORD)
+REG("si",   xSI, OPLM_WORD)
+REG("di",   xDI, OPLM_WORD)
+REG("bp",   xBP, OPLM_WORD)
+REG("sp",   xSP, OPLM_WORD)
+REG("ah",   xAX, OPLM_BYTE)
+REG("bh",   xBX, OPLM_BYTE)
+REG("ch",   xCX, OPLM_BYTE)
+REG("dh",   xDX, OPLM_BYTE)
+REG("al",   xAX, OPLM_BYTE)
+REG("bl",   xBX, OPLM_BYTE)
+REG("cl",   xCX, OPLM_BYTE)
+REG("dl",   xDX, OPLM_BYTE)
+
+#undef PREFIX
+#undef OP
+#undef REG